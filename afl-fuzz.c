@@ -56,7 +56,8 @@ static void usage(u8* argv0) {
 
       "  -d            - quick & dirty mode (skips deterministic steps)\n"
       "  -n            - fuzz without instrumentation (dumb mode)\n"
-      "  -x dir        - optional fuzzer dictionary (see README)\n\n"
+      "  -x dir        - optional fuzzer dictionary (see README)\n"
+      "  -s seed       - fixed seed for the random number generator\n\n"
 
       "Other stuff:\n\n"
 
@@ -248,17 +249,11 @@ int main(int argc, char** argv) {
   u8 exit_1 = !!getenv("AFL_BENCH_JUST_ONE");
   char** use_argv;
 
-  struct timeval tv;
-  struct timezone tz;
-
   SAYF(cCYA "afl-fuzz " cBRI VERSION cRST " by <lcamtuf@google.com>\n");
 
   doc_path = access(DOC_PATH, F_OK) ? "docs" : DOC_PATH;
 
-  gettimeofday(&tv, &tz);
-  srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
-
-  while ((opt = getopt(argc, argv, "+i:o:f:m:b:t:T:dnCB:S:M:x:e:QV")) > 0)
+  while ((opt = getopt(argc, argv, "+i:o:f:m:b:t:T:dnCB:S:M:x:e:s:QV")) > 0)
 
     switch (opt) {
       case 'i': /* input dir */
@@ -412,7 +407,6 @@ int main(int argc, char** argv) {
         if (in_bitmap) FATAL("Multiple -B options not supported");
 
         in_bitmap = optarg;
-        read_bitmap(in_bitmap);
         break;
 
       case 'C': /* crash mode */
@@ -451,6 +445,14 @@ int main(int argc, char** argv) {
         /* Version number has been printed already, just quit. */
         exit(0);
 
+      case 's': /* PRNG seed */
+
+        if (rand_seed_given) FATAL("Multiple -s options not supported");
+        if (sscanf(optarg, "%llu", &rand_seed) < 1)
+          FATAL("Bad syntax used for -s");
+        rand_seed_given = 1;
+        break;
+
       case 'e':
         if (file_extension) FATAL("Multiple -e options not supported");
         file_extension = optarg;
@@ -464,6 +466,21 @@ int main(int argc, char** argv) {
 
   if (optind == argc || !in_dir || !out_dir) usage(argv[0]);
 
+  /* Log the seed, so that a run of the mutators can be replayed with -s. */
+
+  if (!rand_seed_given) {
+    s32 fd = open("/dev/urandom", O_RDONLY);
+
+    if (fd < 0) PFATAL("Unable to open /dev/urandom");
+    ck_read(fd, &rand_seed, sizeof(rand_seed), "/dev/urandom");
+    close(fd);
+  }
+
+  seed_rng(rand_seed);
+  srandom(rand_seed);
+
+  OKF("Random seed is %llu.", rand_seed);
+
   setup_signal_handlers();
   check_asan_opts();
 
@@ -485,12 +502,28 @@ int main(int argc, char** argv) {
   if (getenv("AFL_NO_ARITH")) no_arith = 1;
   if (getenv("AFL_SHUFFLE_QUEUE")) shuffle_queue = 1;
   if (getenv("AFL_FAST_CAL")) fast_cal = 1;
+  if (getenv("AFL_REUSING_SPILL")) reusing_spill = 1;
+  if (getenv("AFL_SHM_FUZZ")) shm_fuzz = 1;
+
+  if (getenv("AFL_EXECUTORS")) {
+    executors = atoi(getenv("AFL_EXECUTORS"));
+    if (executors < 1 || executors > EXECUTORS_MAX)
+      FATAL("AFL_EXECUTORS must be between 1 and %u", EXECUTORS_MAX);
+  }
 
   if (getenv("AFL_HANG_TMOUT")) {
     hang_tmout = atoi(getenv("AFL_HANG_TMOUT"));
     if (!hang_tmout) FATAL("Invalid value of AFL_HANG_TMOUT");
   }
 
+  struct_store = getenv("AFL_STRUCT_STORE");
+
+  if (struct_store && mkdir(struct_store, 0700) && errno != EEXIST)
+    PFATAL("Unable to create '%s'", struct_store);
+
+  if (getenv("AFL_SHARED_VIRGIN") && !sync_id)
+    FATAL("AFL_SHARED_VIRGIN only makes sense with -M or -S");
+
   if (dumb_mode == 2 && no_forkserver)
     FATAL("AFL_DUMB_FORKSRV and AFL_NO_FORKSRV are mutually exclusive");
 
@@ -520,11 +553,14 @@ int main(int argc, char** argv) {
   setup_post();
   setup_shm();
   init_count_class16();
+  init_bitmap_ops();
   init_value_sets();
 
   setup_dirs_fds();
   read_testcases();
   load_auto();
+  load_value_pools();
+  read_journal();
   pivot_inputs();
 
   if (extras_dir) load_extras(extras_dir);
@@ -544,8 +580,18 @@ int main(int argc, char** argv) {
   else
     use_argv = argv + optind;
 
+  /* The executor pool takes care of the dry run, too, so it has to be up
+     first - and the main fork server before that, to settle the map size. */
+
+  if (executors) {
+    if (!dumb_mode && !no_forkserver) init_forkserver(use_argv);
+    init_executors(use_argv);
+  }
+
   perform_dry_run(use_argv);
 
+  if (getenv("AFL_SHARED_VIRGIN") && !dumb_mode) setup_host_virgin();
+
   cull_queue();
 
   show_init_stats();
@@ -576,10 +622,10 @@ int main(int argc, char** argv) {
       cur_skipped_paths = 0;
       queue_cur = queue;
 
-      while (seek_to) {
-        current_entry++;
-        seek_to--;
-        queue_cur = queue_cur->next;
+      if (seek_to) {
+        current_entry = seek_to;
+        queue_cur = queue_buf[seek_to];
+        seek_to = 0;
       }
 
       show_stats();
@@ -629,6 +675,7 @@ int main(int argc, char** argv) {
   if (stop_soon == 2) {
     if (child_pid > 0) kill(child_pid, SIGKILL);
     if (forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
+    kill_executors();
   }
   /* Now that we've killed the forkserver, we wait for it to be able to get
    * rusage stats. */
@@ -639,6 +686,7 @@ int main(int argc, char** argv) {
   write_bitmap();
   write_stats_file(0, 0, 0);
   save_auto();
+  save_value_pools();
 
 stop_fuzzing:
 
@@ -8,12 +8,14 @@
 #endif
 #define _FILE_OFFSET_BITS 64
 
+#include <assert.h>
 #include <ctype.h>
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <poll.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdio.h>
@@ -33,6 +35,7 @@
 #include <unistd.h>
 
 #include "alloc-inl.h"
+#include "batch.h"
 #include "cJSON.h"
 #include "chunk.h"
 #include "config.h"
@@ -82,7 +85,8 @@ extern u8 *in_dir,   /* Input directory with test cases  */
     *doc_path,       /* Path to documentation dir        */
     *target_path,    /* Path to target binary            */
     *orig_cmdline,   /* Original command line            */
-    *file_extension; /* Extension of .cur_input          */
+    *file_extension, /* Extension of .cur_input          */
+    *struct_store;   /* Host-wide structure store        */
 
 extern u64 total_mutation;
 extern u64 interest_mutation;
@@ -90,6 +94,7 @@ extern u64 increase_mutation;
 
 extern u32 exec_tmout; /* Configurable exec timeout (ms)   */
 extern u32 hang_tmout; /* Timeout used for hang det (ms)   */
+extern u32 fuzz_tmout; /* Timeout for the current entry    */
 
 extern u64 mem_limit; /* Memory cap for child (MB)        */
 
@@ -125,13 +130,15 @@ extern u8 skip_deterministic, /* Skip deterministic stages?       */
     bitmap_changed,       /* Time to update bitmap?           */
     qemu_mode,                /* Running in QEMU mode?            */
     skip_requested,           /* Skip request, via SIGUSR1        */
+    pool_dump_requested,      /* Value pool dump, via SIGUSR2     */
     run_over10m,              /* Run time over 10 minutes?        */
     persistent_mode,          /* Running in persistent mode?      */
     deferred_mode,            /* Deferred forkserver mode?        */
-    fast_cal;                 /* Try to calibrate faster?         */
+    fast_cal,                 /* Try to calibrate faster?         */
+    adapt_tmout,              /* Per-entry timeouts?              */
+    reusing_spill;            /* Write reusing candidates to disk */
 
 extern s32 out_fd,       /* Persistent fd for out_file       */
-    dev_urandom_fd, /* Persistent fd for /dev/urandom   */
     dev_null_fd,    /* Persistent fd for /dev/null      */
     fsrv_ctl_fd,         /* Fork server control pipe (write) */
     fsrv_st_fd;          /* Fork server status pipe (read)   */
@@ -142,14 +149,42 @@ extern s32 forksrv_pid, /* PID of the fork server           */
 
 extern u8* trace_bits; /* SHM with instrumentation bitmap  */
 
-extern u8 virgin_bits[MAP_SIZE], /* Regions yet untouched by fuzzing */
-    virgin_tmout[MAP_SIZE],      /* Bits we haven't seen in tmouts   */
-    virgin_crash[MAP_SIZE];      /* Bits we haven't seen in crashes  */
+extern u32 map_size; /* Size of trace_bits and the maps  */
 
-extern u8 var_bytes[MAP_SIZE]; /* Bytes that appear to be variable */
+extern u32 cull_from; /* First top_rated[] slot changed  */
+
+extern u8 dense_map; /* Map holds dense edge IDs?        */
+
+extern u8 dirty_map; /* Target flags the blocks it hits? */
+
+extern u8 *virgin_bits, /* Regions yet untouched by fuzzing */
+    *virgin_tmout,      /* Bits we haven't seen in tmouts   */
+    *virgin_crash,      /* Bits we haven't seen in crashes  */
+    *virgin_host;       /* Bits no local instance has seen  */
+
+extern u8* var_bytes; /* Bytes that appear to be variable */
 
 extern s32 shm_id; /* ID of the SHM region             */
 
+extern u8 shm_fuzz,   /* Testcases via SHM requested?     */
+    shm_fuzz_on;      /* ...and supported by the target?  */
+
+extern s32 shm_fuzz_id; /* ID of the testcase SHM region    */
+
+extern u8* shm_fuzz_buf; /* Testcase data in the SHM region  */
+
+extern u32 shm_fuzz_len; /* Length of the testcase in there  */
+
+extern s32 batch_shm_id; /* ID of the batch SHM region       */
+
+extern struct batch_shm* batch_shm; /* Batches for persistent targets */
+
+extern u8 batch_on; /* Target takes batches?            */
+
+extern u32 executors; /* Fork servers in the pool, if any  */
+
+extern u8 pool_on; /* Executor pool up and running?    */
+
 extern volatile u8 stop_soon, /* Ctrl-C pressed?                  */
     clear_screen,         /* Window resized?                  */
     child_timed_out;          /* Traced process timed out?        */
@@ -193,6 +228,9 @@ extern u64 total_crashes, /* Total number of crashes          */
 
 extern u32 subseq_tmouts; /* Number of timeouts in a row      */
 
+extern u64 struct_cache_hits, /* Structure cache hits             */
+    struct_cache_misses;      /* Structure cache misses           */
+
 extern u8 *stage_name, /* Name of the current fuzz stage   */
     *stage_short,               /* Short stage name                 */
     *syncing_party;             /* Currently syncing with...        */
@@ -212,7 +250,10 @@ extern u8 stage_val_type; /* Value type (STAGE_VAL_*)         */
 extern u64 stage_finds[32], /* Patterns found per fuzz stage    */
     stage_cycles[32];       /* Execs per fuzz stage             */
 
-extern u32 rand_cnt; /* Random number counter            */
+extern u64 rand_seed,    /* Seed of the PRNG (-s or random)  */
+    rand_state[4];       /* xoshiro256** state               */
+
+extern u8 rand_seed_given; /* Seed fixed with -s?              */
 
 extern u64 total_cal_us, /* Total calibration time (us)      */
     total_cal_cycles;    /* Total calibration cycles         */
@@ -253,7 +294,8 @@ struct queue_entry {
       favored,      /* Currently favored?               */
       fs_redundant; /* Marked as redundant in the fs?   */
 
-  u32 bitmap_size, /* Number of bits set in bitmap     */
+  u32 id,          /* Position in the queue            */
+      bitmap_size, /* Number of bits set in bitmap     */
       exec_cksum;  /* Checksum of the execution trace  */
 
   u64 exec_us,  /* Execution time (us)              */
@@ -263,17 +305,27 @@ struct queue_entry {
   u8* trace_mini; /* Trace bytes, if kept             */
   u32 tc_ref;     /* Trace bytes ref count            */
 
-  struct queue_entry *next, /* Next element, if any             */
-      *next_100;            /* 100 elements ahead               */
+  Chunk* tree_cache;  /* Parsed structure, if cached      */
+  Track* track_cache; /* Parsed constraints, if cached    */
+  ChunkIndex* index_cache; /* Interned chunk ids, if cached */
+  u32 struct_stamp;   /* Sources the cache was built from */
+  u8 struct_cached;   /* Cache populated?                 */
+
+  struct queue_entry *lru_prev, /* Structure cache LRU links   */
+      *lru_next;
+
+  struct queue_entry *next; /* Next element, if any             */
 };
 
 extern struct queue_entry *queue, /* Fuzzing queue (linked list)      */
     *queue_cur,                   /* Current offset within the queue  */
-    *queue_top,                   /* Top of the list                  */
-    *q_prev100;                   /* Previous 100 marker              */
+    *queue_top;                   /* Top of the list                  */
+
+extern struct queue_entry**
+    queue_buf; /* All the entries, by index        */
 
-extern struct queue_entry*
-    top_rated[MAP_SIZE]; /* Top entries for bitmap bytes     */
+extern struct queue_entry**
+    top_rated; /* Top entries for bitmap bytes     */
 
 struct extra_data {
   u8* data;    /* Dictionary token data            */
@@ -350,6 +402,8 @@ void check_crash_handling(void);
 void check_cpu_governor(void);
 void setup_post(void);
 void setup_shm(void);
+void resize_map(u32 size);
+void setup_host_virgin(void);
 void setup_dirs_fds(void);
 void read_testcases(void);
 void pivot_inputs(void);
@@ -370,20 +424,57 @@ void write_stats_file(double bitmap_cvg, double stability, double eps);
 void read_bitmap(u8 *fname);
 void write_bitmap(void);
 void init_count_class16(void);
+void init_bitmap_ops(void);
 u8  has_new_bits(u8* virgin_map);
+u8  claim_host_bits(void);
+u8  host_ahead(void);
 void update_bitmap_score(struct queue_entry *q);
 u8   save_if_interesting(char** argv, void* mem, u32 len, u8 fault, Chunk* tree, Track *track);
 u8   save_if_interesting_for_reusing(char** argv, void* mem, u32 len, u8 fault, Chunk* tree, Track *track);
 u32  calculate_score(struct queue_entry *q);
-#ifdef __x86_64__
-void classify_counts(u64 *mem);
-#else
-void classify_counts(u32 *mem);
-#endif
+void clear_trace(void);
+void classify_trace(void);
+void trace_changed(void);
+u32 trace_cksum(void);
 u32 count_bits(u8 *mem);
 u32 count_bytes(u8 *mem);
 u32 count_non_255_bytes(u8 *mem);
 
+/* bitmap_simd.c */
+
+/* Bitmap kernels. All of them take a map length that is a multiple of 64
+   bytes. classify() classifies the hit counts in place and tells if any of
+   the result still shows up in virgin[], which it does not touch. has_new()
+   is has_new_bits() minus the bookkeeping. cksum() adds up the checksum
+   terms for mem[from .. to), see hash_trace_word(). */
+
+struct bitmap_ops {
+  const char* name;
+  u8   (*classify)(u8* mem, u8* virgin, u32 len);
+  u8   (*has_new)(u8* mem, u8* virgin, u32 len);
+  u64  (*cksum)(u8* mem, u32 from, u32 to);
+  u32  (*count_bytes)(u8* mem, u32 len);
+  u32  (*count_non_255)(u8* mem, u32 len);
+  void (*simplify)(u8* mem, u32 len);
+};
+
+extern u16 count_class_lookup16[65536];
+
+static inline u64 classify_word(u64 w) {
+
+  return (u64)count_class_lookup16[(u16)w] |
+         (u64)count_class_lookup16[(u16)(w >> 16)] << 16 |
+         (u64)count_class_lookup16[(u16)(w >> 32)] << 32 |
+         (u64)count_class_lookup16[(u16)(w >> 48)] << 48;
+
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_BITMAP_SIMD 1
+extern const struct bitmap_ops bitmap_ops_sse2, bitmap_ops_avx2,
+                               bitmap_ops_avx512;
+#endif /* (__x86_64__ || __i386__) && __GNUC__ */
+
 /* extras.c */
 
 void load_auto(void);
@@ -400,7 +491,11 @@ void mark_as_redundant(struct queue_entry* q, u8 state);
 void cull_queue(void);
 void add_to_queue(u8* fname, u8* format_file, u8* track_file, u32 len, u8 passed_det);
 void destroy_queue(void);
+
+/* sync.c */
+
 void sync_fuzzers(char** argv);
+u8   import_case(char** argv, u8* mem, u32 len, u8 fault);
 
 /* utils.c */
 
@@ -418,7 +513,53 @@ void   link_or_copy(u8 *old_path, u8 *new_path);
 u8     delete_files(u8 *path, u8 *prefix);
 double get_runnable_processes(void);
 void   get_core_count(void);
-u32 UR(u32 limit);
+void   seed_rng(u64 seed);
+void   rand_fill(u32 *buf, u32 cnt, u32 limit);
+
+/* xoshiro256** by Blackman and Vigna: four xor/shift/rotate steps per 64-bit
+   output, no syscalls, and small enough to inline into the mutators. */
+
+static inline u64 rand_next(void) {
+
+  u64* s = rand_state;
+  u64  r = s[1] * 5, t = s[1] << 17;
+
+  r = ((r << 7) | (r >> 57)) * 9;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3]  = (s[3] << 45) | (s[3] >> 19);
+
+  return r;
+
+}
+
+/* Generate a random number (from 0 to limit - 1). Uses Lemire's multiply-shift
+   with rejection, so it has no modulo bias and usually no division. There is
+   nothing to draw from with limit = 0; the old modulo version at least died
+   of SIGFPE there, this one would quietly return 0. */
+
+static inline u32 UR(u32 limit) {
+
+  u64 m;
+
+  assert(limit > 0);
+
+  m = (rand_next() >> 32) * limit;
+
+  if (unlikely((u32)m < limit)) {
+
+    u32 t = -limit % limit;
+    while ((u32)m < t) m = (rand_next() >> 32) * limit;
+
+  }
+
+  return m >> 32;
+
+}
 
 /* run.c */
 
@@ -427,6 +568,28 @@ void init_forkserver(char** argv);
 u8   run_target(char** argv, u32 timeout);
 u8   common_fuzz_stuff(char** argv, u8* out_buf, u32 len, Chunk* tree, Track *track);
 u8   common_fuzz_stuff_for_reusing(char** argv, u8* out_buf, u32 len, Chunk* tree, Track *track);
+u8   batch_fuzz_stuff(char** argv, u8* out_buf, u32 len, Chunk* tree, Track* track);
+u8   flush_batch(char** argv);
+u8   finish_fuzz_stuff(char** argv, u8* out_buf, u32 len, u8 fault, Chunk* tree,
+                       Track* track);
+
+/* executor.c */
+
+void init_executors(char** argv);
+u8   run_executors(char** argv, struct batch_shm* b, u32 n, s32* cur_byte,
+                   Chunk* tree, Track* track);
+void kill_executors(void);
+u8   calibrate_on_executors(struct queue_entry* q);
+
+/* journal.c */
+
+void journal_entry(struct queue_entry* q);
+void journal_state(struct queue_entry* q);
+void read_journal(void);
+void check_journal(char** argv);
+void drop_old_journal(void);
+u8   journal_has(struct queue_entry* q);
+u8   journal_restore(struct queue_entry* q, u8* fault);
 
 /* pre_fuzz.c */
 
@@ -447,6 +610,25 @@ cJSON *track_to_json(Track *track);
 void free_tree(Chunk *tree, Boolean recurse);
 u8 fuzz_one();
 
+/* structure_image.c */
+
+void load_structure(u8* path, u8* in_buf, u32 len, Chunk** tree,
+                    Track** track, ChunkIndex** index);
+void write_structure_image(u8* base, Chunk* tree, Track* track);
+u32 structure_stamp(u8* path);
+
+/* structure_rebase.c */
+
+void edit_reset(void);
+void edit_insert(u32 at, u32 len);
+void edit_owner(u32 start, u32 end);
+void edit_delete(u32 at, u32 len);
+void edit_swap(u32 l_start, u32 l_end, u32 r_start, u32 r_end);
+void edit_save(u32 slot);
+void edit_restore(u32 slot);
+u8 rebase_structure(Chunk* tree, Track* track, u32 len, Chunk** new_tree,
+                    Track** new_track);
+
 /* signals.c */
 
 void setup_signal_handlers(void);
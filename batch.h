@@ -0,0 +1,53 @@
+/*
+   american fuzzy lop - persistent-mode batches
+   --------------------------------------------
+
+   Shared between afl-fuzz and the afl-clang-fast runtime.
+*/
+
+#ifndef _HAVE_BATCH_H
+#define _HAVE_BATCH_H
+
+#include "config.h"
+#include "types.h"
+
+#include <time.h>
+
+/* Layout of the SHM region used to hand a persistent-mode target several
+   test cases at once. afl-fuzz fills in off[], len[] and data[], sets cnt
+   and pos = 0, and places the first test case in the regular testcase
+   region. The target then runs them back to back without stopping: after
+   each but the last, it copies the raw trace to the pos-th map in trace[],
+   clears the bitmap and moves on, noting in start_us when the next one
+   started. afl-fuzz holds each test case to the timeout from there on. When
+   the target is done, or dies, pos is the test case it was running. */
+
+struct batch_shm {
+
+  u32 cnt;                              /* Test cases in this batch    */
+  u32 pos;                              /* Test case being run         */
+  u64 start_us;                         /* When it started running     */
+  u32 off[BATCH_MAX];                   /* Offsets into data[]         */
+  u32 len[BATCH_MAX];                   /* Test case lengths           */
+  u8  data[MAX_FILE];                   /* Test cases, back to back    */
+  u8  trace[];                          /* Traces of completed runs    */
+
+};
+
+/* Clock for start_us, the same on both sides: */
+
+static inline u64 batch_clock_us(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+}
+
+/* Size of the region, with room for BATCH_MAX traces of the given size: */
+
+#define BATCH_SHM_SIZE(_map) (sizeof(struct batch_shm) + BATCH_MAX * (_map))
+
+#endif /* ! _HAVE_BATCH_H */
@@ -0,0 +1,443 @@
+/*
+   american fuzzy lop - bitmap benchmark
+   -------------------------------------
+
+   Times the code afl-fuzz runs over trace_bits after every exec, once with
+   the plain C kernels (as with AFL_NO_SIMD=1) and once with whatever
+   init_bitmap_ops() picks for this CPU, on made-up traces with more and
+   more bytes set. All kernels the CPU can run have to come up with the
+   same results, or this bails out. After that, it does the same for what
+   dirty block flags (AFL_DIRTY_MAP) save on sparse traces in a 64 kB and a
+   1 MB map. Build and run with "make bench".
+
+   Given two targets, one that flags the blocks it writes to and one that
+   doesn't, it checks that they come up with the same traces for the same
+   inputs through the fork server, and times them; see "make test_dirtymap".
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+*/
+
+#include "afl-fuzz.h"
+
+#define BENCH_EXECS 2000 /* Calls timed per figure              */
+
+static const u32 densities[] = { 0, 300, 3000, 24000 };
+
+#define DENSITY_CNT (sizeof(densities) / sizeof(densities[0]))
+
+static u8 *raw_trace,          /* Counts before classify_trace()   */
+          *virgin_tmp;         /* Virgin map that isn't virgin_bits */
+
+static u8 *ref_trace[DENSITY_CNT],  /* Results of the first tier   */
+          *ref_virgin[DENSITY_CNT];
+
+static u32 ref_sum[DENSITY_CNT], ref_bytes[DENSITY_CNT];
+static u8  ref_new[DENSITY_CNT];
+
+static volatile u32 sink;
+
+/* Put cnt random counts at as many random places. */
+
+static void make_trace(u32 cnt) {
+  u32 i = 0;
+
+  memset(raw_trace, 0, map_size);
+
+  while (i < cnt) {
+    u32 pos = random() % map_size;
+
+    if (raw_trace[pos]) continue;
+
+    raw_trace[pos] = 1 + random() % 255;
+    i++;
+  }
+}
+
+/* The kernels. Each call goes through the public interface, the way
+   afl-fuzz uses it; trace_changed() makes sure nothing is served from
+   what the previous call found out. */
+
+static void do_classify(void) {
+  trace_changed();
+  classify_trace();
+}
+
+static void do_has_new(void) {
+  trace_changed();
+  sink = has_new_bits(virgin_tmp);
+}
+
+static void do_cksum(void) {
+  trace_changed();
+  sink = trace_cksum();
+}
+
+static void do_count(void) {
+  sink = count_bytes(trace_bits);
+}
+
+static void do_count_255(void) {
+  sink = count_non_255_bytes(virgin_tmp);
+}
+
+static void (*const kernels[])(void) = {
+  do_classify, do_has_new, do_cksum, do_count, do_count_255
+};
+
+#define KERNEL_CNT (sizeof(kernels) / sizeof(kernels[0]))
+
+/* Nanoseconds per call. */
+
+static u32 time_kernel(void (*fn)(void)) {
+  u64 start = get_cur_time_us();
+  u32 i;
+
+  for (i = 0; i < BENCH_EXECS; i++) fn();
+
+  return (get_cur_time_us() - start) * 1000 / BENCH_EXECS;
+}
+
+#ifdef HAVE_BITMAP_SIMD
+
+/* The tiers init_bitmap_ops() passes over on this CPU don't get timed, but
+   are checked against the portable code all the same. */
+
+static void check_simd(u32 d) {
+  static const struct bitmap_ops* tiers[] = {
+    &bitmap_ops_sse2, &bitmap_ops_avx2, &bitmap_ops_avx512
+  };
+
+  u8* mem = ck_alloc(map_size);
+  u8* vir = ck_alloc(map_size);
+  u8  can_run[3];
+  u32 i;
+
+  __builtin_cpu_init();
+
+  can_run[0] = !!__builtin_cpu_supports("sse2");
+  can_run[1] = !!__builtin_cpu_supports("avx2");
+  can_run[2] = !!__builtin_cpu_supports("avx512bw");
+
+  for (i = 0; i < 3; i++) {
+    const struct bitmap_ops* ops = tiers[i];
+
+    if (!can_run[i]) continue;
+
+    memcpy(mem, raw_trace, map_size);
+    memset(vir, 255, map_size);
+
+    if (ops->classify(mem, vir, map_size) != !!densities[d] ||
+        memcmp(mem, ref_trace[d], map_size))
+      FATAL("%s classify() mismatch with %u bytes set", ops->name,
+            densities[d]);
+
+    if (hash_trace_sum(ops->cksum(mem, 0, map_size)) != ref_sum[d])
+      FATAL("%s cksum() mismatch with %u bytes set", ops->name, densities[d]);
+
+    if (ops->count_bytes(mem, map_size) != ref_bytes[d])
+      FATAL("%s count_bytes() mismatch with %u bytes set", ops->name,
+            densities[d]);
+
+    if (ops->has_new(mem, vir, map_size) != ref_new[d] ||
+        memcmp(vir, ref_virgin[d], map_size))
+      FATAL("%s has_new() mismatch with %u bytes set", ops->name,
+            densities[d]);
+
+    if (ops->count_non_255(vir, map_size) !=
+        count_non_255_bytes(ref_virgin[d]))
+      FATAL("%s count_non_255() mismatch with %u bytes set", ops->name,
+            densities[d]);
+  }
+
+  ck_free(mem);
+  ck_free(vir);
+}
+
+#endif /* HAVE_BITMAP_SIMD */
+
+static u32 time_kernel_n(void (*fn)(u32), u32 n) {
+  u64 start = get_cur_time_us();
+  u32 i;
+
+  for (i = 0; i < BENCH_EXECS; i++) fn(n);
+
+  return (get_cur_time_us() - start) * 1000 / BENCH_EXECS;
+}
+
+/* Work out what a trace of the given density comes to, and check it
+   against the first tier, or keep it for the ones after it. */
+
+static void check_results(u32 d, u8 first) {
+  u32 sum, bytes;
+  u8  hnb;
+
+  memcpy(trace_bits, raw_trace, map_size);
+  memset(virgin_tmp, 255, map_size);
+
+  do_classify();
+  sum   = trace_cksum();
+  bytes = count_bytes(trace_bits);
+  hnb   = has_new_bits(virgin_tmp);
+
+  if (first) {
+    ref_trace[d]  = ck_memdup(trace_bits, map_size);
+    ref_virgin[d] = ck_memdup(virgin_tmp, map_size);
+    ref_sum[d]    = sum;
+    ref_bytes[d]  = bytes;
+    ref_new[d]    = hnb;
+
+#ifdef HAVE_BITMAP_SIMD
+    check_simd(d);
+#endif /* HAVE_BITMAP_SIMD */
+
+    return;
+  }
+
+  if (memcmp(trace_bits, ref_trace[d], map_size))
+    FATAL("classify_trace() mismatch with %u bytes set", densities[d]);
+
+  if (memcmp(virgin_tmp, ref_virgin[d], map_size) || hnb != ref_new[d])
+    FATAL("has_new_bits() mismatch with %u bytes set", densities[d]);
+
+  if (sum != ref_sum[d])
+    FATAL("trace_cksum() mismatch with %u bytes set", densities[d]);
+
+  if (bytes != ref_bytes[d] ||
+      count_non_255_bytes(virgin_tmp) != count_non_255_bytes(ref_virgin[d]))
+    FATAL("count_bytes() mismatch with %u bytes set", densities[d]);
+}
+
+static void run_tier(u8 first) {
+  u32 d, k;
+
+  init_bitmap_ops();
+
+  SAYF("\n     set   classify  has_new    cksum    count  count_255\n");
+
+  for (d = 0; d < DENSITY_CNT; d++) {
+    srandom(d + 1);
+    make_trace(densities[d]);
+
+    check_results(d, first);
+
+    /* Time the usual case: a classified trace with nothing new in it. */
+
+    memset(virgin_bits, 255, map_size);
+    do_classify();
+    has_new_bits(virgin_bits);
+
+    SAYF("  %6u", densities[d]);
+
+    for (k = 0; k < KERNEL_CNT; k++)
+      SAYF(" %8u", time_kernel(kernels[k]));
+
+    SAYF("\n");
+  }
+
+  SAYF("\n");
+}
+
+static const u32 dirty_sizes[] = { MAP_SIZE, MAP_SIZE_MAX },
+                 dirty_edges[] = { 50, 300, 1000, 4000 };
+
+#define DIRTY_SIZE_CNT (sizeof(dirty_sizes) / sizeof(dirty_sizes[0]))
+#define DIRTY_EDGE_CNT (sizeof(dirty_edges) / sizeof(dirty_edges[0]))
+
+static u32 edge_pos[4000];
+
+/* The afl-fuzz side of an exec that hits the edges in edge_pos[]. */
+
+static void fake_exec(u32 cnt) {
+  u8* dirty = trace_bits + map_size;
+  u32 i;
+
+  clear_trace();
+
+  trace_bits[0] = 1;
+
+  for (i = 0; i < cnt; i++) {
+    trace_bits[edge_pos[i]]++;
+    dirty[edge_pos[i] >> MAP_DIRTY_POW2] = 1;
+  }
+
+  classify_trace();
+  sink = has_new_bits(virgin_bits);
+}
+
+static void run_dirty(void) {
+  u32 s, e, i;
+  u8  hnb = 0;
+
+  ACTF("Clearing, classifying and checking a trace, nanoseconds per exec:");
+
+  SAYF("\n       map  edges     full    dirty\n");
+
+  for (s = 0; s < DIRTY_SIZE_CNT; s++) {
+    map_size = dirty_sizes[s];
+
+    for (e = 0; e < DIRTY_EDGE_CNT; e++) {
+      u32 t[2];
+
+      srandom(s * DIRTY_EDGE_CNT + e + 1);
+
+      for (i = 0; i < dirty_edges[e]; i++)
+        edge_pos[i] = 1 + random() % (map_size - 1);
+
+      for (dirty_map = 0; dirty_map < 2; dirty_map++) {
+        trace_changed();
+        memset(virgin_bits, 255, map_size);
+
+        fake_exec(dirty_edges[e]);
+
+        if (!dirty_map) {
+          memcpy(raw_trace, trace_bits, map_size);
+          hnb = sink;
+        } else if (memcmp(raw_trace, trace_bits, map_size) || sink != hnb)
+          FATAL("Dirty blocks change the trace of %u edges in %u bytes",
+                dirty_edges[e], map_size);
+
+        t[dirty_map] = time_kernel_n(fake_exec, dirty_edges[e]);
+      }
+
+      SAYF("  %8u %6u %8u %8u\n", map_size, dirty_edges[e], t[0], t[1]);
+    }
+  }
+
+  SAYF("\n");
+
+  dirty_map = 0;
+  map_size  = MAP_SIZE;
+  trace_changed();
+}
+
+/* Run all of check_buf[] through a target, comparing the traces with
+   check_trace[] if it's already there, and time it. */
+
+#define CHECK_INPUTS 64  /* Inputs to run through the targets   */
+#define CHECK_ROUNDS 100 /* Times each of them is timed         */
+
+static u8* check_buf[CHECK_INPUTS];
+static u32 check_len[CHECK_INPUTS];
+
+static u8* check_trace[CHECK_INPUTS];
+static u32 check_sum[CHECK_INPUTS];
+
+static u32 check_target(u8* bin, u8 want_dirty) {
+  char* argv[] = { (char*)bin, NULL };
+  u64   start;
+  u32   i, r;
+
+  target_path = bin;
+
+  trace_changed();
+  init_forkserver(argv);
+
+  if (dirty_map != want_dirty)
+    FATAL("'%s' %s flag dirty blocks", bin, want_dirty ? "doesn't" : "does");
+
+  for (i = 0; i < CHECK_INPUTS; i++) {
+    write_to_testcase(check_buf[i], check_len[i]);
+
+    if (run_target(argv, exec_tmout) != FAULT_NONE)
+      FATAL("'%s' failed on input %u", bin, i);
+
+    if (!check_trace[i]) {
+      check_trace[i] = ck_memdup(trace_bits, map_size);
+      check_sum[i]   = trace_cksum();
+      continue;
+    }
+
+    if (memcmp(trace_bits, check_trace[i], map_size) ||
+        trace_cksum() != check_sum[i])
+      FATAL("'%s' gives another trace for input %u", bin, i);
+  }
+
+  start = get_cur_time_us();
+
+  for (r = 0; r < CHECK_ROUNDS; r++)
+    for (i = 0; i < CHECK_INPUTS; i++) {
+      write_to_testcase(check_buf[i], check_len[i]);
+      run_target(argv, exec_tmout);
+      has_new_bits(virgin_bits);
+    }
+
+  kill(forksrv_pid, SIGKILL);
+  if (waitpid(forksrv_pid, NULL, 0) <= 0) PFATAL("waitpid() failed");
+
+  close(fsrv_ctl_fd);
+  close(fsrv_st_fd);
+
+  return (get_cur_time_us() - start) * 1000 / (CHECK_ROUNDS * CHECK_INPUTS);
+}
+
+static void check_dirty_map(u8* dirty_bin, u8* full_bin) {
+  u32 i, t_full, t_dirty;
+
+  /* Mostly short inputs for sparse traces, with a long one now and then
+     that leaves a lot to clean up before the next. */
+
+  srandom(1);
+
+  for (i = 0; i < CHECK_INPUTS; i++) {
+    u32 j;
+
+    check_len[i] = (i % 8 == 7) ? 4000 : i % 8 * 8;
+    check_buf[i] = ck_alloc_nozero(check_len[i] + 1);
+
+    for (j = 0; j < check_len[i]; j++) check_buf[i][j] = random();
+  }
+
+  out_dir     = (u8*)".";
+  dev_null_fd = open("/dev/null", O_RDWR);
+  plot_file   = fopen("/dev/null", "w");
+
+  if (dev_null_fd < 0 || !plot_file) PFATAL("Unable to open /dev/null");
+
+  setup_shm();
+  setup_stdio_file();
+
+  t_dirty = check_target(dirty_bin, 1);
+  t_full  = check_target(full_bin, 0);
+
+  unlink(".cur_input");
+
+  OKF("Same traces for all %u inputs, %u-byte map.", CHECK_INPUTS, map_size);
+  OKF("Microseconds per exec: %u.%03u with dirty blocks, %u.%03u without.",
+      t_dirty / 1000, t_dirty % 1000, t_full / 1000, t_full % 1000);
+}
+
+int main(int argc, char** argv) {
+  init_count_class16();
+
+  if (argc == 3) {
+    init_bitmap_ops();
+    check_dirty_map((u8*)argv[1], (u8*)argv[2]);
+    return 0;
+  }
+
+  if (argc != 1) FATAL("Usage: %s [dirty_target full_target]", argv[0]);
+
+  map_size    = MAP_SIZE;
+  trace_bits  = ck_alloc(MAP_SHM_SIZE(MAP_SIZE_MAX));
+  virgin_bits = ck_alloc(MAP_SIZE_MAX);
+  raw_trace   = ck_alloc(MAP_SIZE_MAX);
+  virgin_tmp  = ck_alloc(map_size);
+
+  ACTF("Map size %u, nanoseconds per call:", map_size);
+
+  setenv("AFL_NO_SIMD", "1", 1);
+  run_tier(1);
+
+  unsetenv("AFL_NO_SIMD");
+  run_tier(0);
+
+  OKF("All kernels agree.");
+
+  run_dirty();
+
+  return 0;
+}
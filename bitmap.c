@@ -16,7 +16,7 @@ void write_bitmap(void) {
 
   if (fd < 0) PFATAL("Unable to open '%s'", fname);
 
-  ck_write(fd, virgin_bits, MAP_SIZE, fname);
+  ck_write(fd, virgin_bits, map_size, fname);
 
   close(fd);
   ck_free(fname);
@@ -25,11 +25,18 @@ void write_bitmap(void) {
 /* Read bitmap from file. This is for the -B option again. */
 
 void read_bitmap(u8* fname) {
+  struct stat st;
   s32 fd = open(fname, O_RDONLY);
 
   if (fd < 0) PFATAL("Unable to open '%s'", fname);
 
-  ck_read(fd, virgin_bits, MAP_SIZE, fname);
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  if (st.st_size != map_size)
+    FATAL("'%s' is for a %llu-byte map, but the target uses %u bytes", fname,
+          (u64)st.st_size, map_size);
+
+  ck_read(fd, virgin_bits, map_size, fname);
 
   close(fd);
 }
@@ -40,22 +47,23 @@ void read_bitmap(u8* fname) {
    Updates the map, so subsequent calls will always return 0.
 
    This function is called after every exec() on a fairly large buffer, so
-   it needs to be fast. We do this in 32-bit and 64-bit flavors. */
+   it needs to be fast. We do this in 32-bit and 64-bit flavors, and in SIMD
+   ones in bitmap_simd.c. */
 
-inline u8 has_new_bits(u8* virgin_map) {
+static u8 has_new_scalar(u8* mem, u8* virgin_map, u32 len) {
 #ifdef WORD_SIZE_64
 
-  u64* current = (u64*)trace_bits;
+  u64* current = (u64*)mem;
   u64* virgin = (u64*)virgin_map;
 
-  u32 i = (MAP_SIZE >> 3);
+  u32 i = (len >> 3);
 
 #else
 
-  u32* current = (u32*)trace_bits;
+  u32* current = (u32*)mem;
   u32* virgin = (u32*)virgin_map;
 
-  u32 i = (MAP_SIZE >> 2);
+  u32 i = (len >> 2);
 
 #endif /* ^WORD_SIZE_64 */
 
@@ -102,17 +110,12 @@ inline u8 has_new_bits(u8* virgin_map) {
     virgin++;
   }
 
-  if (ret && virgin_map == virgin_bits) bitmap_changed = 1;
-
   return ret;
 }
 
-/* Count the number of bits set in the provided bitmap. Used for the status
-   screen several times every second, does not have to be fast. */
-
 u32 count_bits(u8* mem) {
   u32* ptr = (u32*)mem;
-  u32 i = (MAP_SIZE >> 2);
+  u32 i = (map_size >> 2);
   u32 ret = 0;
 
   while (i--) {
@@ -134,15 +137,16 @@ u32 count_bits(u8* mem) {
   return ret;
 }
 
+
 #define FF(_b) (0xff << ((_b) << 3))
 
 /* Count the number of bytes set in the bitmap. Called fairly sporadically,
    mostly to update the status screen or calibrate and examine confirmed
    new paths. */
 
-u32 count_bytes(u8* mem) {
+static u32 count_bytes_scalar(u8* mem, u32 len) {
   u32* ptr = (u32*)mem;
-  u32 i = (MAP_SIZE >> 2);
+  u32 i = (len >> 2);
   u32 ret = 0;
 
   while (i--) {
@@ -161,9 +165,9 @@ u32 count_bytes(u8* mem) {
 /* Count the number of non-255 bytes set in the bitmap. Used strictly for the
    status screen, several calls per second or so. */
 
-u32 count_non_255_bytes(u8* mem) {
+static u32 count_non_255_scalar(u8* mem, u32 len) {
   u32* ptr = (u32*)mem;
-  u32 i = (MAP_SIZE >> 2);
+  u32 i = (len >> 2);
   u32 ret = 0;
 
   while (i--) {
@@ -195,8 +199,9 @@ static const u8 simplify_lookup[256] = {
 
 #ifdef WORD_SIZE_64
 
-static void simplify_trace(u64* mem) {
-  u32 i = MAP_SIZE >> 3;
+static void simplify_scalar(u8* mem8, u32 len) {
+  u64* mem = (u64*)mem8;
+  u32 i = len >> 3;
 
   while (i--) {
     /* Optimize for sparse bitmaps. */
@@ -222,8 +227,9 @@ static void simplify_trace(u64* mem) {
 
 #else
 
-static void simplify_trace(u32* mem) {
-  u32 i = MAP_SIZE >> 2;
+static void simplify_scalar(u8* mem8, u32 len) {
+  u32* mem = (u32*)mem8;
+  u32 i = len >> 2;
 
   while (i--) {
     /* Optimize for sparse bitmaps. */
@@ -247,7 +253,8 @@ static void simplify_trace(u32* mem) {
 
 /* Destructively classify execution counts in a trace. This is used as a
    preprocessing step for any newly acquired traces. Called on every exec,
-   must be fast. */
+   must be fast. While at it, see if any of the result is still set in the
+   virgin map. */
 
 static const u8 count_class_lookup8[256] = {
 
@@ -263,7 +270,7 @@ static const u8 count_class_lookup8[256] = {
 
 };
 
-static u16 count_class_lookup16[65536];
+u16 count_class_lookup16[65536];
 
 void init_count_class16(void) {
   u32 b1, b2;
@@ -274,47 +281,365 @@ void init_count_class16(void) {
           (count_class_lookup8[b1] << 8) | count_class_lookup8[b2];
 }
 
-#ifdef WORD_SIZE_64
-
-inline void classify_counts(u64* mem) {
-  u32 i = MAP_SIZE >> 3;
+static u8 classify_scalar(u8* mem8, u8* virgin8, u32 len) {
+  u64* mem = (u64*)mem8;
+  u64* virgin = (u64*)virgin8;
+  u64 news = 0;
+  u32 i;
 
-  while (i--) {
+  for (i = 0; i < (len >> 3); i++) {
     /* Optimize for sparse bitmaps. */
 
-    if (unlikely(*mem)) {
-      u16* mem16 = (u16*)mem;
-
-      mem16[0] = count_class_lookup16[mem16[0]];
-      mem16[1] = count_class_lookup16[mem16[1]];
-      mem16[2] = count_class_lookup16[mem16[2]];
-      mem16[3] = count_class_lookup16[mem16[3]];
+    if (unlikely(mem[i])) {
+      mem[i] = classify_word(mem[i]);
+      news |= mem[i] & virgin[i];
     }
+  }
 
-    mem++;
+  return !!news;
+}
+
+/* Checksum a trace, to tell it apart from others. See hash_trace_word(). */
+
+static u64 cksum_scalar(u8* mem8, u32 from, u32 to) {
+  u64* mem = (u64*)mem8;
+  u64 sum = 0;
+  u32 i;
+
+  for (i = from >> 3; i < (to >> 3); i++)
+    if (unlikely(mem[i])) sum += hash_trace_word(mem[i], i);
+
+  return sum;
+}
+
+static const struct bitmap_ops bitmap_ops_scalar = {
+
+    "scalar", classify_scalar, has_new_scalar, cksum_scalar,
+    count_bytes_scalar, count_non_255_scalar, simplify_scalar
+
+};
+
+static const struct bitmap_ops* bops = &bitmap_ops_scalar;
+
+/* Pick the fastest kernels the CPU can run. */
+
+void init_bitmap_ops(void) {
+  bops = &bitmap_ops_scalar;
+
+#ifdef HAVE_BITMAP_SIMD
+
+  if (!getenv("AFL_NO_SIMD")) {
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512bw"))
+      bops = &bitmap_ops_avx512;
+    else if (__builtin_cpu_supports("avx2"))
+      bops = &bitmap_ops_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+      bops = &bitmap_ops_sse2;
   }
+
+#endif /* HAVE_BITMAP_SIMD */
+
+  OKF("Using %s bitmap kernels.", bops->name);
 }
 
-#else
+/* What we know about trace_bits, valid until the trace changes. Most execs
+   bring nothing new; classify_trace() spots that while it is at it, which
+   saves has_new_bits() another trip over the map. The checksum is only
+   wanted now and then, but sometimes more than once for the same trace. */
 
-inline void classify_counts(u32* mem) {
-  u32 i = MAP_SIZE >> 2;
+#define TRACE_NEWS_OK 1 /* trace_news is up to date        */
+#define TRACE_SUM_OK  2 /* trace_sum is up to date         */
+#define TRACE_RUNS_OK 4 /* trace_runs is up to date        */
 
-  while (i--) {
-    /* Optimize for sparse bitmaps. */
+static u8  trace_state;
+static u8  trace_news;  /* Trace still has bits in virgin_bits? */
+static u32 trace_sum;   /* Trace checksum                       */
 
-    if (unlikely(*mem)) {
-      u16* mem16 = (u16*)mem;
+/* With dirty_map, the target also flags every block of the map it writes to
+   in trace_bits[map_size..], so the zero parts of a sparse trace need not be
+   looked at. trace_full says the flags don't cover trace_bits at the moment,
+   because something else wrote to it. */
+
+static u8 trace_full = 1;
+
+/* The parts of trace_bits that may hold something, as [start, end) byte
+   offsets, worked out from the flags once per trace. */
+
+static u32 trace_runs[(MAP_SIZE_MAX >> MAP_DIRTY_POW2) / MAP_DIRTY_RATIO][2];
+static u32 trace_run_cnt;
+
+/* One bit for each of the (up to 64) flags at dirty[], so that runs can be
+   found a word at a time instead of a byte at a time; on traces that flag a
+   fair part of the map, going byte by byte is mostly branch misses. */
+
+static u64 dirty_mask(u8* dirty, u32 cnt) {
+  u64 m = 0, w;
+  u32 i;
+
+  if (cnt < 64) {
+    for (i = 0; i < cnt; i++)
+      if (dirty[i]) m |= 1ULL << i;
+
+    return m;
+  }
+
+  for (i = 0; i < 8; i++) {
+    w = *(u64*)(dirty + i * 8);
+
+    if (!w) continue;
 
-      mem16[0] = count_class_lookup16[mem16[0]];
-      mem16[1] = count_class_lookup16[mem16[1]];
+    /* Squash every byte to its lowest bit, then gather those in the top
+       byte of the product. */
+
+    w |= w >> 4;
+    w |= w >> 2;
+    w |= w >> 1;
+    w &= 0x0101010101010101ULL;
+
+    m |= ((w * 0x0102040810204080ULL) >> 56) << (i * 8);
+  }
+
+  return m;
+}
+
+static void find_runs(void) {
+  static u64 masks[MAP_SIZE_MAX >> (MAP_DIRTY_POW2 + 6)];
+
+  u8* dirty = trace_bits + map_size;
+  u32 blocks = map_size >> MAP_DIRTY_POW2, groups = (blocks + 63) >> 6,
+      max_dirty = blocks / MAP_DIRTY_RATIO, cnt = 0, i, n = 0;
+
+  trace_state |= TRACE_RUNS_OK;
+
+  /* Give up on traces that flag too much of the map, where going over all
+     of it is cheaper. */
+
+  for (i = 0; i < groups && !trace_full && cnt <= max_dirty; i++) {
+    masks[i] = dirty_mask(dirty + (i << 6), MIN(blocks - (i << 6), 64));
+    cnt += __builtin_popcountll(masks[i]);
+  }
+
+  for (i = 0; i < groups && !trace_full && cnt <= max_dirty; i++) {
+    u64 m = masks[i];
+
+    while (m) {
+      u32 lo = __builtin_ctzll(m), hi, start, end;
+      u64 gaps = ~m & (~0ULL << lo);
+
+      hi = gaps ? __builtin_ctzll(gaps) : 64;
+      m  = hi < 64 ? m & (~0ULL << hi) : 0;
+
+      start = (i << 6) + lo;
+      end   = (i << 6) + hi;
+
+      /* Kernel calls are not free, so join runs that are close anyway,
+         including those that go on in the next word. */
+
+      if (n && start - trace_runs[n - 1][1] <= MAP_DIRTY_GAP) {
+        trace_runs[n - 1][1] = end;
+      } else {
+        trace_runs[n][0] = start;
+        trace_runs[n][1] = end;
+        n++;
+      }
     }
+  }
 
-    mem++;
+  if (!n) {
+    trace_runs[0][0] = 0;
+    trace_runs[0][1] = blocks;
+    n = 1;
+  }
+
+  for (i = 0; i < n; i++) {
+    trace_runs[i][0] <<= MAP_DIRTY_POW2;
+    trace_runs[i][1] <<= MAP_DIRTY_POW2;
   }
+
+  trace_run_cnt = n;
 }
 
-#endif /* ^WORD_SIZE_64 */
+/* Clear trace_bits before an exec. */
+
+void clear_trace(void) {
+  u8* dirty = trace_bits + map_size;
+  u32 i;
+
+  if (!(trace_state & TRACE_RUNS_OK)) find_runs();
+
+  for (i = 0; i < trace_run_cnt; i++) {
+    u32 start = trace_runs[i][0], len = trace_runs[i][1] - start;
+
+    memset(trace_bits + start, 0, len);
+    memset(dirty + (start >> MAP_DIRTY_POW2), 0, len >> MAP_DIRTY_POW2);
+  }
+
+  /* The runtime and run_target() itself write to the start of the map
+     behind the instrumentation's back, so block 0 always gets looked at. */
+
+  dirty[0] = 1;
+
+  trace_full = !dirty_map;
+  trace_state = 0;
+}
+
+/* Classify the counts in trace_bits. Called on every exec. */
+
+void classify_trace(void) {
+  u32 i;
+
+  if (!(trace_state & TRACE_RUNS_OK)) find_runs();
+
+  trace_news = 0;
+
+  for (i = 0; i < trace_run_cnt; i++) {
+    u32 start = trace_runs[i][0], len = trace_runs[i][1] - start;
+
+    trace_news |= bops->classify(trace_bits + start, virgin_bits + start, len);
+  }
+
+  trace_state |= TRACE_NEWS_OK;
+}
+
+/* Forget about the above, for whoever writes to trace_bits directly. */
+
+void trace_changed(void) {
+  trace_full = 1;
+  trace_state = 0;
+}
+
+/* Checksum of trace_bits, used to tell traces apart. */
+
+u32 trace_cksum(void) {
+  u64 sum = 0;
+  u32 i;
+
+  if (!(trace_state & TRACE_SUM_OK)) {
+    if (!(trace_state & TRACE_RUNS_OK)) find_runs();
+
+    for (i = 0; i < trace_run_cnt; i++)
+      sum += bops->cksum(trace_bits, trace_runs[i][0], trace_runs[i][1]);
+
+    trace_sum = hash_trace_sum(sum);
+    trace_state |= TRACE_SUM_OK;
+  }
+
+  return trace_sum;
+}
+
+u8 has_new_bits(u8* virgin_map) {
+  u8 ret = 0;
+  u32 i;
+
+  /* virgin_bits only ever loses bits, so if classify_trace() saw nothing new,
+     there is nothing new now either. */
+
+  if (virgin_map == virgin_bits) {
+    if ((trace_state & TRACE_NEWS_OK) && !trace_news) return 0;
+
+    trace_news = 0;
+    trace_state |= TRACE_NEWS_OK;
+  }
+
+  if (!(trace_state & TRACE_RUNS_OK)) find_runs();
+
+  for (i = 0; i < trace_run_cnt; i++) {
+    u32 start = trace_runs[i][0], len = trace_runs[i][1] - start;
+    u8  r = bops->has_new(trace_bits + start, virgin_map + start, len);
+
+    if (r > ret) ret = r;
+  }
+
+  if (ret && virgin_map == virgin_bits) bitmap_changed = 1;
+
+  return ret;
+}
+
+/* Tell if has_new_bits(virgin_bits) would find anything, without clearing
+   the bits just yet. */
+
+static u8 any_new_bits(void) {
+  u32 i, j;
+
+  if (trace_state & TRACE_NEWS_OK) return trace_news;
+
+  if (!(trace_state & TRACE_RUNS_OK)) find_runs();
+
+  for (i = 0; i < trace_run_cnt; i++) {
+    u64* cur = (u64*)(trace_bits + trace_runs[i][0]);
+    u64* vir = (u64*)(virgin_bits + trace_runs[i][0]);
+    u32  n   = (trace_runs[i][1] - trace_runs[i][0]) >> 3;
+
+    for (j = 0; j < n; j++)
+      if (cur[j] & vir[j]) return 1;
+  }
+
+  return 0;
+}
+
+/* Clear the bits of the current trace in the host-wide virgin map (see
+   setup_host_virgin()), and say what has_new_bits() would have said about
+   it. Other instances update the map at the same time, so this goes word
+   by word with atomic ANDs; whichever instance clears a bit first is the
+   only one that gets to see it as new. */
+
+u8 claim_host_bits(void) {
+  u8  ret = 0;
+  u32 i, j, k;
+
+  if (!(trace_state & TRACE_RUNS_OK)) find_runs();
+
+  for (i = 0; i < trace_run_cnt; i++) {
+    u64* cur = (u64*)(trace_bits + trace_runs[i][0]);
+    u64* vir = (u64*)(virgin_host + trace_runs[i][0]);
+    u32  n   = (trace_runs[i][1] - trace_runs[i][0]) >> 3;
+
+    for (j = 0; j < n; j++) {
+      u64 c = cur[j], old;
+
+      if (!c || !(c & __atomic_load_n(&vir[j], __ATOMIC_RELAXED))) continue;
+
+      old = __atomic_fetch_and(&vir[j], ~c, __ATOMIC_RELAXED);
+
+      if (!(c & old)) continue;
+
+      if (!ret) ret = 1;
+
+      for (k = 0; k < 64 && ret < 2; k += 8)
+        if (((c >> k) & 0xff) && ((old >> k) & 0xff) == 0xff) ret = 2;
+    }
+  }
+
+  return ret;
+}
+
+/* Tell if the other instances have seen anything we haven't. */
+
+u8 host_ahead(void) {
+  u64* v = (u64*)virgin_bits;
+  u64* h = (u64*)virgin_host;
+  u32  i;
+
+  for (i = 0; i < (map_size >> 3); i++)
+    if (v[i] & ~h[i]) return 1;
+
+  return 0;
+}
+
+u32 count_bytes(u8* mem) {
+  return bops->count_bytes(mem, map_size);
+}
+
+u32 count_non_255_bytes(u8* mem) {
+  return bops->count_non_255(mem, map_size);
+}
+
+static void simplify_trace(u8* mem) {
+  bops->simplify(mem, map_size);
+  if (mem == trace_bits) trace_changed();
+}
 
 /* Compact trace bytes into a smaller bitmap. We effectively just drop the
    count information here. This is called only sporadically, for some
@@ -323,7 +648,7 @@ inline void classify_counts(u32* mem) {
 static void minimize_bits(u8* dst, u8* src) {
   u32 i = 0;
 
-  while (i < MAP_SIZE) {
+  while (i < map_size) {
     if (*(src++)) dst[i >> 3] |= 1 << (i & 7);
     i++;
   }
@@ -346,7 +671,7 @@ void update_bitmap_score(struct queue_entry* q) {
   /* For every byte set in trace_bits[], see if there is a previous winner,
      and how it compares to us. */
 
-  for (i = 0; i < MAP_SIZE; i++)
+  for (i = 0; i < map_size; i++)
 
     if (trace_bits[i]) {
       if (top_rated[i]) {
@@ -365,11 +690,13 @@ void update_bitmap_score(struct queue_entry* q) {
 
       /* Insert ourselves as the new winner. */
 
+      if (top_rated[i] != q && i < cull_from) cull_from = i;
+
       top_rated[i] = q;
       q->tc_ref++;
 
       if (!q->trace_mini) {
-        q->trace_mini = ck_alloc(MAP_SIZE >> 3);
+        q->trace_mini = ck_alloc(map_size >> 3);
         minimize_bits(q->trace_mini, trace_bits);
       }
 
@@ -479,16 +806,29 @@ u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault, Chunk* tree,
   u8 keeping = 0, res;
   cJSON* json;
   cJSON* track_json;
+  Chunk* new_tree;
+  Track* new_track;
+  u8 rebased = 0;
 
   if (fault == crash_mode) {
     /* Keep only if there are new bits in the map, add to queue for
        future fuzzing, etc. */
 
-    if (!(hnb = has_new_bits(virgin_bits))) {
+    if (!any_new_bits()) {
       if (crash_mode) total_crashes++;
       return 0;
     }
 
+    /* With a host-wide map, what another instance found first is left for
+       sync_fuzzers() to bring in, so it has to stay new in virgin_bits. */
+
+    if (len && virgin_host && !syncing_party && !claim_host_bits()) {
+      if (crash_mode) total_crashes++;
+      return 0;
+    }
+
+    hnb = has_new_bits(virgin_bits);
+
     /*Update interesting mutation number*/
     interest_mutation += 1;
 
@@ -523,7 +863,7 @@ u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault, Chunk* tree,
       increase_mutation += 1;
     }
 
-    queue_top->exec_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    queue_top->exec_cksum = trace_cksum();
 
     /* Try to calibrate inline; this also calls update_bitmap_score() when
        successful. */
@@ -537,6 +877,15 @@ u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault, Chunk* tree,
     ck_write(fd, mem, len, fn);
     close(fd);
 
+    /* Structure stages log their edits; shift the parent's intervals
+       accordingly, so that the child starts out with usable structure. */
+
+    if (rebase_structure(tree, track, len, &new_tree, &new_track)) {
+      tree = new_tree;
+      track = new_track;
+      rebased = 1;
+    }
+
     if (tree != NULL) {
       json = tree_to_json(tree);
       format_mem = cJSON_Print(json);
@@ -559,6 +908,16 @@ u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault, Chunk* tree,
       free(format_mem);
     }
 
+    /* Compile the structure image right away, so that fuzz_one() does not
+       have to go through JSON for this entry. */
+
+    if (tree != NULL || track != NULL) write_structure_image(fn, tree, track);
+
+    if (rebased) {
+      free_tree(tree, True);
+      free_track(track);
+    }
+
     keeping = 1;
   }
 
@@ -575,11 +934,7 @@ u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault, Chunk* tree,
       if (unique_hangs >= KEEP_UNIQUE_HANG) return keeping;
 
       if (!dumb_mode) {
-#ifdef WORD_SIZE_64
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+        simplify_trace(trace_bits);
 
         if (!has_new_bits(virgin_tmout)) return keeping;
       }
@@ -634,11 +989,7 @@ u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault, Chunk* tree,
       if (unique_crashes >= KEEP_UNIQUE_CRASH) return keeping;
 
       if (!dumb_mode) {
-#ifdef WORD_SIZE_64
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+        simplify_trace(trace_bits);
 
         if (!has_new_bits(virgin_crash)) return keeping;
       }
@@ -697,6 +1048,9 @@ u8 save_if_interesting_for_reusing(char** argv, void* mem, u32 len, u8 fault, Ch
   u8 keeping = 0, res;
   cJSON* json;
   cJSON* track_json;
+  Chunk* new_tree;
+  Track* new_track;
+  u8 rebased = 0;
 
   // temp_fn = alloc_printf("%s/tmp/id:%06u,%s", out_dir, queued_paths, describe_op(hnb));
   // fd = open(temp_fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
@@ -709,11 +1063,21 @@ u8 save_if_interesting_for_reusing(char** argv, void* mem, u32 len, u8 fault, Ch
     /* Keep only if there are new bits in the map, add to queue for
        future fuzzing, etc. */
 
-    if (!(hnb = has_new_bits(virgin_bits))) {
+    if (!any_new_bits()) {
+      if (crash_mode) total_crashes++;
+      return 0;
+    }
+
+    /* With a host-wide map, what another instance found first is left for
+       sync_fuzzers() to bring in, so it has to stay new in virgin_bits. */
+
+    if (len && virgin_host && !syncing_party && !claim_host_bits()) {
       if (crash_mode) total_crashes++;
       return 0;
     }
 
+    hnb = has_new_bits(virgin_bits);
+
     /*Update interesting mutation number*/
     interest_mutation += 1;
 
@@ -748,7 +1112,7 @@ u8 save_if_interesting_for_reusing(char** argv, void* mem, u32 len, u8 fault, Ch
       increase_mutation += 1;
     }
 
-    queue_top->exec_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    queue_top->exec_cksum = trace_cksum();
 
     /* Try to calibrate inline; this also calls update_bitmap_score() when
        successful. */
@@ -772,6 +1136,14 @@ u8 save_if_interesting_for_reusing(char** argv, void* mem, u32 len, u8 fault, Ch
     close(log_fd);
     ck_free(log_fn);
 
+    /* Length fix-ups resize payloads; rebase as in save_if_interesting(). */
+
+    if (rebase_structure(tree, track, len, &new_tree, &new_track)) {
+      tree = new_tree;
+      track = new_track;
+      rebased = 1;
+    }
+
     if (tree != NULL) {
       json = tree_to_json(tree);
       format_mem = cJSON_Print(json);
@@ -794,6 +1166,16 @@ u8 save_if_interesting_for_reusing(char** argv, void* mem, u32 len, u8 fault, Ch
       free(format_mem);
     }
 
+    /* Compile the structure image right away, so that fuzz_one() does not
+       have to go through JSON for this entry. */
+
+    if (tree != NULL || track != NULL) write_structure_image(fn, tree, track);
+
+    if (rebased) {
+      free_tree(tree, True);
+      free_track(track);
+    }
+
     keeping = 1;
   }
 
@@ -810,11 +1192,7 @@ u8 save_if_interesting_for_reusing(char** argv, void* mem, u32 len, u8 fault, Ch
       if (unique_hangs >= KEEP_UNIQUE_HANG) return keeping;
 
       if (!dumb_mode) {
-#ifdef WORD_SIZE_64
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+        simplify_trace(trace_bits);
 
         if (!has_new_bits(virgin_tmout)) return keeping;
       }
@@ -869,11 +1247,7 @@ u8 save_if_interesting_for_reusing(char** argv, void* mem, u32 len, u8 fault, Ch
       if (unique_crashes >= KEEP_UNIQUE_CRASH) return keeping;
 
       if (!dumb_mode) {
-#ifdef WORD_SIZE_64
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+        simplify_trace(trace_bits);
 
         if (!has_new_bits(virgin_crash)) return keeping;
       }
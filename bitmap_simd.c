@@ -0,0 +1,495 @@
+#include "afl-fuzz.h"
+
+/* SIMD bitmap kernels.
+
+   has_new_bits(), the count classification and friends walk the whole 64 kB
+   map after every exec, even though a typical trace only touches a few
+   hundred bytes of it. The versions below look at 16, 32 or 64 bytes at a
+   time, so skipping the zero parts costs a fraction of what it does with
+   64-bit words, and the rest is done without per-byte table lookups where
+   the instruction set allows. They are compiled for their own target with
+   function attributes, and init_bitmap_ops() picks the best one the CPU
+   supports, falling back to the portable code in bitmap.c. */
+
+#ifdef HAVE_BITMAP_SIMD
+
+#include <immintrin.h>
+
+#define SSE2_FN   __attribute__((target("sse2")))
+#define AVX2_FN   __attribute__((target("avx2,popcnt")))
+#define AVX512_FN __attribute__((target("avx512bw,popcnt")))
+
+/* Add up the checksum terms for the words in mem[i .. i + n). */
+
+static inline u64 sum_words(u8* mem, u32 i, u32 n) {
+
+  u64* w = (u64*)(mem + i);
+  u64 ret = 0;
+  u32 j;
+
+  for (j = 0; j < n / 8; j++)
+    if (w[j]) ret += hash_trace_word(w[j], i / 8 + j);
+
+  return ret;
+
+}
+
+/* SSE2: see if a 64-byte block is all zeros. */
+
+static SSE2_FN inline u8 zero_block_sse2(u8* mem) {
+
+  __m128i c = _mm_or_si128(
+      _mm_or_si128(_mm_loadu_si128((__m128i*)mem),
+                   _mm_loadu_si128((__m128i*)(mem + 16))),
+      _mm_or_si128(_mm_loadu_si128((__m128i*)(mem + 32)),
+                   _mm_loadu_si128((__m128i*)(mem + 48))));
+
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_setzero_si128())) == 0xffff;
+
+}
+
+/* No byte shuffles here, so the non-zero blocks are classified a word at a
+   time with count_class_lookup16[], same as in bitmap.c. */
+
+static SSE2_FN u8 classify_sse2(u8* mem, u8* virgin, u32 len) {
+
+  u64 news = 0;
+  u32 i, j;
+
+  for (i = 0; i < len; i += 64) {
+
+    u64* w = (u64*)(mem + i);
+    u64* v = (u64*)(virgin + i);
+
+    if (zero_block_sse2(mem + i)) continue;
+
+    for (j = 0; j < 8; j++)
+      if (w[j]) {
+        w[j] = classify_word(w[j]);
+        news |= w[j] & v[j];
+      }
+
+  }
+
+  return !!news;
+
+}
+
+static SSE2_FN u64 cksum_sse2(u8* mem, u32 from, u32 to) {
+
+  u64 s = 0;
+  u32 i;
+
+  for (i = from; i < to; i += 64)
+    if (!zero_block_sse2(mem + i)) s += sum_words(mem, i, 64);
+
+  return s;
+
+}
+
+static SSE2_FN u8 has_new_sse2(u8* mem, u8* virgin, u32 len) {
+
+  __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8(-1);
+  u8  ret = 0;
+  u32 i;
+
+  for (i = 0; i < len; i += 16) {
+
+    __m128i c = _mm_loadu_si128((__m128i*)(mem + i)), v;
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(c, zero)) == 0xffff) continue;
+
+    v = _mm_loadu_si128((__m128i*)(virgin + i));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(c, v), zero)) ==
+        0xffff)
+      continue;
+
+    /* Any non-zero byte in mem[] that is still pristine in virgin[]? */
+
+    if (ret < 2) {
+
+      __m128i m = _mm_andnot_si128(_mm_cmpeq_epi8(c, zero),
+                                   _mm_cmpeq_epi8(v, ones));
+
+      ret = _mm_movemask_epi8(m) ? 2 : 1;
+
+    }
+
+    _mm_storeu_si128((__m128i*)(virgin + i), _mm_andnot_si128(c, v));
+
+  }
+
+  return ret;
+
+}
+
+static SSE2_FN u32 count_bytes_sse2(u8* mem, u32 len) {
+
+  __m128i zero = _mm_setzero_si128();
+  u32 ret = 0, i;
+
+  for (i = 0; i < len; i += 16) {
+
+    u32 m = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(mem + i)), zero));
+
+    if (m != 0xffff) ret += 16 - __builtin_popcount(m);
+
+  }
+
+  return ret;
+
+}
+
+static SSE2_FN u32 count_non_255_sse2(u8* mem, u32 len) {
+
+  __m128i ones = _mm_set1_epi8(-1);
+  u32 ret = 0, i;
+
+  for (i = 0; i < len; i += 16) {
+
+    u32 m = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(mem + i)), ones));
+
+    if (m != 0xffff) ret += 16 - __builtin_popcount(m);
+
+  }
+
+  return ret;
+
+}
+
+/* 0x01 for zero bytes, 0x80 for the rest: 0x80 ^ (is_zero & 0x81). */
+
+static SSE2_FN void simplify_sse2(u8* mem, u32 len) {
+
+  __m128i zero = _mm_setzero_si128(), hi = _mm_set1_epi8(0x80),
+          flip = _mm_set1_epi8(0x81);
+  u32 i;
+
+  for (i = 0; i < len; i += 16) {
+
+    __m128i c = _mm_loadu_si128((__m128i*)(mem + i));
+
+    c = _mm_xor_si128(hi, _mm_and_si128(_mm_cmpeq_epi8(c, zero), flip));
+    _mm_storeu_si128((__m128i*)(mem + i), c);
+
+  }
+
+}
+
+const struct bitmap_ops bitmap_ops_sse2 = {
+
+  "sse2", classify_sse2, has_new_sse2, cksum_sse2, count_bytes_sse2,
+  count_non_255_sse2, simplify_sse2
+
+};
+
+/* The hit count classes, split by nibble. Counts below 16 are looked up by
+   their low nibble, everything else by the high one; a shuffle does 16 (or,
+   per 128-bit lane, 32 and 64) such lookups at once. */
+
+#define CLASS_LO  0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16, 16, 16, 16, 16
+#define CLASS_HI  0, 32, 64, 64, 64, 64, 64, 64, \
+                  -128, -128, -128, -128, -128, -128, -128, -128
+
+static AVX2_FN inline __m256i classify_256(__m256i v) {
+
+  __m256i lo_tbl = _mm256_broadcastsi128_si256(_mm_setr_epi8(CLASS_LO)),
+          hi_tbl = _mm256_broadcastsi128_si256(_mm_setr_epi8(CLASS_HI)),
+          nib    = _mm256_set1_epi8(0x0f),
+          lo, hi, hn;
+
+  hn = _mm256_and_si256(_mm256_srli_epi16(v, 4), nib);
+  lo = _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(v, nib));
+  hi = _mm256_shuffle_epi8(hi_tbl, hn);
+
+  return _mm256_or_si256(hi, _mm256_and_si256(lo, _mm256_cmpeq_epi8(
+                                 hn, _mm256_setzero_si256())));
+
+}
+
+static AVX2_FN u8 classify_avx2(u8* mem, u8* virgin, u32 len) {
+
+  __m256i news = _mm256_setzero_si256();
+  u32 i;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m256i a = _mm256_loadu_si256((__m256i*)(mem + i)),
+            b = _mm256_loadu_si256((__m256i*)(mem + i + 32)),
+            ab = _mm256_or_si256(a, b);
+
+    if (_mm256_testz_si256(ab, ab)) continue;
+
+    a = classify_256(a);
+    b = classify_256(b);
+
+    _mm256_storeu_si256((__m256i*)(mem + i), a);
+    _mm256_storeu_si256((__m256i*)(mem + i + 32), b);
+
+    a = _mm256_and_si256(a, _mm256_loadu_si256((__m256i*)(virgin + i)));
+    b = _mm256_and_si256(b, _mm256_loadu_si256((__m256i*)(virgin + i + 32)));
+    news = _mm256_or_si256(news, _mm256_or_si256(a, b));
+
+  }
+
+  return !_mm256_testz_si256(news, news);
+
+}
+
+static AVX2_FN u64 cksum_avx2(u8* mem, u32 from, u32 to) {
+
+  u64 s = 0;
+  u32 i;
+
+  for (i = from; i < to; i += 64) {
+
+    __m256i ab = _mm256_or_si256(_mm256_loadu_si256((__m256i*)(mem + i)),
+                                 _mm256_loadu_si256((__m256i*)(mem + i + 32)));
+
+    if (!_mm256_testz_si256(ab, ab)) s += sum_words(mem, i, 64);
+
+  }
+
+  return s;
+
+}
+
+static AVX2_FN u8 has_new_avx2(u8* mem, u8* virgin, u32 len) {
+
+  __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi8(-1);
+  u8  ret = 0;
+  u32 i;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i c = _mm256_loadu_si256((__m256i*)(mem + i)), v;
+
+    if (_mm256_testz_si256(c, c)) continue;
+
+    v = _mm256_loadu_si256((__m256i*)(virgin + i));
+
+    if (_mm256_testz_si256(c, v)) continue;
+
+    if (ret < 2) {
+
+      __m256i m = _mm256_andnot_si256(_mm256_cmpeq_epi8(c, zero),
+                                      _mm256_cmpeq_epi8(v, ones));
+
+      ret = _mm256_testz_si256(m, m) ? 1 : 2;
+
+    }
+
+    _mm256_storeu_si256((__m256i*)(virgin + i), _mm256_andnot_si256(c, v));
+
+  }
+
+  return ret;
+
+}
+
+static AVX2_FN u32 count_bytes_avx2(u8* mem, u32 len) {
+
+  __m256i zero = _mm256_setzero_si256();
+  u32 ret = 0, i;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i c = _mm256_loadu_si256((__m256i*)(mem + i));
+
+    if (_mm256_testz_si256(c, c)) continue;
+
+    ret += 32 - __builtin_popcount(
+                    (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, zero)));
+
+  }
+
+  return ret;
+
+}
+
+static AVX2_FN u32 count_non_255_avx2(u8* mem, u32 len) {
+
+  __m256i ones = _mm256_set1_epi8(-1);
+  u32 ret = 0, i;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i v = _mm256_loadu_si256((__m256i*)(mem + i));
+
+    if (_mm256_testc_si256(v, ones)) continue;
+
+    ret += 32 - __builtin_popcount(
+                    (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ones)));
+
+  }
+
+  return ret;
+
+}
+
+static AVX2_FN void simplify_avx2(u8* mem, u32 len) {
+
+  __m256i zero = _mm256_setzero_si256(), hi = _mm256_set1_epi8(0x80),
+          flip = _mm256_set1_epi8(0x81);
+  u32 i;
+
+  for (i = 0; i < len; i += 32) {
+
+    __m256i c = _mm256_loadu_si256((__m256i*)(mem + i));
+
+    c = _mm256_xor_si256(hi, _mm256_and_si256(_mm256_cmpeq_epi8(c, zero),
+                                              flip));
+    _mm256_storeu_si256((__m256i*)(mem + i), c);
+
+  }
+
+}
+
+const struct bitmap_ops bitmap_ops_avx2 = {
+
+  "avx2", classify_avx2, has_new_avx2, cksum_avx2, count_bytes_avx2,
+  count_non_255_avx2, simplify_avx2
+
+};
+
+/* AVX-512BW: same as above, but byte compares go straight to mask
+   registers. */
+
+static AVX512_FN inline __m512i classify_512(__m512i v) {
+
+  __m512i lo_tbl = _mm512_broadcast_i32x4(_mm_setr_epi8(CLASS_LO)),
+          hi_tbl = _mm512_broadcast_i32x4(_mm_setr_epi8(CLASS_HI)),
+          nib    = _mm512_set1_epi8(0x0f),
+          lo, hi, hn;
+
+  hn = _mm512_and_si512(_mm512_srli_epi16(v, 4), nib);
+  lo = _mm512_shuffle_epi8(lo_tbl, _mm512_and_si512(v, nib));
+  hi = _mm512_shuffle_epi8(hi_tbl, hn);
+
+  return _mm512_mask_blend_epi8(_mm512_testn_epi8_mask(hn, hn), hi, lo);
+
+}
+
+static AVX512_FN u8 classify_avx512(u8* mem, u8* virgin, u32 len) {
+
+  u8  news = 0;
+  u32 i;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i c = _mm512_loadu_si512(mem + i);
+
+    if (!_mm512_test_epi8_mask(c, c)) continue;
+
+    c = classify_512(c);
+    _mm512_storeu_si512(mem + i, c);
+
+    if (_mm512_test_epi8_mask(c, _mm512_loadu_si512(virgin + i))) news = 1;
+
+  }
+
+  return news;
+
+}
+
+static AVX512_FN u64 cksum_avx512(u8* mem, u32 from, u32 to) {
+
+  u64 s = 0;
+  u32 i;
+
+  for (i = from; i < to; i += 64) {
+
+    __m512i c = _mm512_loadu_si512(mem + i);
+
+    if (_mm512_test_epi8_mask(c, c)) s += sum_words(mem, i, 64);
+
+  }
+
+  return s;
+
+}
+
+static AVX512_FN u8 has_new_avx512(u8* mem, u8* virgin, u32 len) {
+
+  __m512i ones = _mm512_set1_epi8(-1);
+  u8  ret = 0;
+  u32 i;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i c = _mm512_loadu_si512(mem + i), v;
+
+    if (!_mm512_test_epi8_mask(c, c)) continue;
+
+    v = _mm512_loadu_si512(virgin + i);
+
+    if (!_mm512_test_epi8_mask(c, v)) continue;
+
+    if (ret < 2)
+      ret = (_mm512_test_epi8_mask(c, c) & _mm512_cmpeq_epi8_mask(v, ones))
+                ? 2 : 1;
+
+    _mm512_storeu_si512(virgin + i, _mm512_andnot_si512(c, v));
+
+  }
+
+  return ret;
+
+}
+
+static AVX512_FN u32 count_bytes_avx512(u8* mem, u32 len) {
+
+  u32 ret = 0, i;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i c = _mm512_loadu_si512(mem + i);
+
+    ret += __builtin_popcountll(_mm512_test_epi8_mask(c, c));
+
+  }
+
+  return ret;
+
+}
+
+static AVX512_FN u32 count_non_255_avx512(u8* mem, u32 len) {
+
+  __m512i ones = _mm512_set1_epi8(-1);
+  u32 ret = 0, i;
+
+  for (i = 0; i < len; i += 64)
+    ret += __builtin_popcountll(
+        _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(mem + i), ones));
+
+  return ret;
+
+}
+
+static AVX512_FN void simplify_avx512(u8* mem, u32 len) {
+
+  __m512i one = _mm512_set1_epi8(1), hi = _mm512_set1_epi8(0x80);
+  u32 i;
+
+  for (i = 0; i < len; i += 64) {
+
+    __m512i c = _mm512_loadu_si512(mem + i);
+
+    _mm512_storeu_si512(mem + i, _mm512_mask_blend_epi8(
+                                     _mm512_test_epi8_mask(c, c), one, hi));
+
+  }
+
+}
+
+const struct bitmap_ops bitmap_ops_avx512 = {
+
+  "avx512", classify_avx512, has_new_avx512, cksum_avx512, count_bytes_avx512,
+  count_non_255_avx512, simplify_avx512
+
+};
+
+#endif /* HAVE_BITMAP_SIMD */
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 
+#define CHUNK_NONE 0xffffffff  // no chunk / not interned
 
 typedef struct Node {
   uint32_t start;
@@ -35,8 +36,33 @@ typedef struct Chunk {
   struct Chunk *child;
   struct Chunk *parent;
   struct Cons *cons;
+  uint32_t idx;  // dense id assigned by index_structure()
 } Chunk;
 
+/* Where chunk i sits among its siblings (itself included), which are
+   sibs[sib_first .. sib_first + sib_num). */
+typedef struct ChunkNode {
+  uint32_t sib_first;
+  uint32_t sib_num;
+  uint32_t sib_pos;  // position of the chunk among its siblings
+} ChunkNode;
+
+/* Chunks below the root, interned to dense u32 ids in pre-order, so that
+   structure stages never have to look chunks up by their string id, plus
+   flat arrays of the track fields for O(1) random selection. */
+typedef struct ChunkIndex {
+  uint32_t num;
+  struct Chunk **chunks;  // chunks[idx]
+  struct ChunkNode *nodes;
+  uint32_t *sibs;  // sibling lists, each one contiguous
+  uint32_t enum_num;
+  uint32_t length_num;
+  uint32_t offset_num;
+  struct Enum **enums;
+  struct Length **lengths;
+  struct Offset **offsets;
+} ChunkIndex;
+
 typedef struct Scope {
   struct Chunk *chunk;
   uint32_t start;
@@ -49,10 +75,15 @@ typedef struct Enum {
   uint32_t start;
   uint32_t end;
   struct Enum *next;
-  uint32_t cans_num;
-  uint8_t *candidates[];
+  uint32_t chunk_idx;  // chunk with the same id, or CHUNK_NONE
+  uint32_t cans_num;   // candidates as found, then the same byte-reversed
+  uint8_t *cans_data;  // decoded candidate bytes, packed
+  uint32_t cans_off[]; // candidate i is cans_data[cans_off[i], cans_off[i + 1])
 } Enum;
 
+#define CAND_DATA(_e, _i) ((_e)->cans_data + (_e)->cans_off[_i])
+#define CAND_LEN(_e, _i) ((_e)->cans_off[(_i) + 1] - (_e)->cans_off[_i])
+
 typedef struct Length {
   uint8_t *id;
   uint8_t *target_id;
@@ -54,6 +54,15 @@
 
 #define EXEC_TM_ROUND       20
 
+/* Unless -t is given, mutations of each queue entry are held to this many
+   times the entry's own calibrated execution time instead, but to no less
+   than ADAPT_TMOUT_MIN (ms) and no more than the global timeout. Runs that
+   hit this limit are re-run with the global one before they are written
+   off as hangs: */
+
+#define ADAPT_TMOUT_MULT    20
+#define ADAPT_TMOUT_MIN     10
+
 /* 64bit arch MACRO */
 #if (defined (__x86_64__) || defined (__arm64__) || defined (__aarch64__))
 #define WORD_SIZE_64 1
@@ -81,6 +90,33 @@
 
 #define TMOUT_LIMIT         250
 
+/* Maximum number of queue entries keeping their parsed structure and
+   constraint information around between fuzz_one() calls: */
+
+#define STRUCT_CACHE_ENTRIES 256
+
+/* Maximum number of inserts, deletes and swaps recorded for a single
+   structural mutation; longer edit scripts are not replayed on the
+   parent's structure: */
+
+#define STRUCT_EDIT_MAX 512
+
+/* Value pools used by the reusing stage: arena block size, initial number
+   of hash slots (power of two), and the longest values that are also
+   bucketed by length for pool_random_len(): */
+
+#define POOL_ARENA_BLOCK (64 * 1024)
+#define POOL_INIT_SLOTS 1024
+#define POOL_LEN_MAX 8
+
+/* Reusing stage: maximum number of distinct enum-replaced candidates per
+   queue entry, length fix-up rounds executed for each, and the number of
+   candidate files kept around when AFL_REUSING_SPILL is set: */
+
+#define REUSING_CANDIDATES 64
+#define REUSING_ROUNDS 16
+#define REUSING_SPILL_MAX 256
+
 /* Maximum number of unique hangs or crashes to record: */
 
 #define KEEP_UNIQUE_HANG    500
@@ -216,6 +252,13 @@
 
 #define SYNC_INTERVAL       5
 
+/* Shared virgin map (AFL_SHARED_VIRGIN): file magic, and where the map
+   starts in the file - far enough in to keep it aligned for word-sized
+   atomics: */
+
+#define HOST_VIRGIN_MAGIC   0x4e475256 /* "VRGN" */
+#define HOST_VIRGIN_OFF     64
+
 /* Output directory reuse grace period (minutes): */
 
 #define OUTPUT_GRACE        25
@@ -271,9 +314,10 @@
  *                                                         *
  ***********************************************************/
 
-/* Call count interval between reseeding the libc PRNG from /dev/urandom: */
+/* cull_queue() saves its progress this many times over the map, to pick up
+   from there when only the later top_rated[] entries changed: */
 
-#define RESEED_RNG          10000
+#define CULL_SNAPS          16
 
 /* Maximum line length passed from GCC to 'as' and used for parsing
    configuration files: */
@@ -284,6 +328,68 @@
 
 #define SHM_ENV_VAR         "__AFL_SHM_ID"
 
+/* Environment variable used to pass the ID of the testcase SHM region to
+   targets built with __AFL_FUZZ_INIT(). The region is a u32 length followed
+   by up to MAX_FILE bytes of data: */
+
+#define SHM_FUZZ_ENV_VAR    "__AFL_SHM_FUZZ_ID"
+#define SHM_FUZZ_SIZE       (MAX_FILE + sizeof(u32))
+
+/* Fork server "hello" flag set by targets that read testcases from the SHM
+   region; afl-fuzz then appends the testcase length to every fork request: */
+
+#define FS_OPT_SHMEM_FUZZ   0x01000000
+
+/* Persistent-mode targets reading from the testcase SHM region can also
+   take test cases in batches of up to BATCH_MAX, passed in another region
+   (see batch.h), and say so with FS_OPT_BATCH: */
+
+#define SHM_BATCH_ENV_VAR   "__AFL_SHM_BATCH_ID"
+#define FS_OPT_BATCH        0x02000000
+#define BATCH_MAX           16
+
+/* Upper limit on AFL_EXECUTORS, the number of extra fork servers running the
+   test cases queued by structure stages in parallel. Each flush hands out at
+   most BATCH_MAX of them, so there is no point in going any higher: */
+
+#define EXECUTORS_MAX       BATCH_MAX
+
+/* Targets that need a map other than MAP_SIZE bytes set FS_OPT_MAPSIZE in
+   the "hello" message and send the size right after it. afl-fuzz then sets
+   up a map that big and restarts the fork server, telling the target the
+   size of the region it gets in MAP_SIZE_ENV_VAR: */
+
+#define MAP_SIZE_ENV_VAR    "__AFL_MAP_SIZE"
+#define FS_OPT_MAPSIZE      0x04000000
+
+/* Set in the "hello" message when the map holds dense edge IDs, which can't
+   collide (see AFL_DENSE_MAP in afl-clang-fast): */
+
+#define FS_OPT_DENSEMAP     0x08000000
+
+/* The trace region is followed by one "dirty" byte for every
+   2^MAP_DIRTY_POW2 bytes of the map. Targets built with AFL_DIRTY_MAP set
+   them next to the counters they bump, and say so with FS_OPT_DIRTYMAP, so
+   that afl-fuzz only needs to clear and scan those parts of the map: */
+
+#define MAP_DIRTY_POW2      6
+#define MAP_SHM_SIZE(_m)    ((_m) + ((_m) >> MAP_DIRTY_POW2))
+#define FS_OPT_DIRTYMAP     0x10000000
+
+/* Dirty runs this many blocks apart or closer get looked at in one go, and
+   once more than 1/MAP_DIRTY_RATIO of the blocks are flagged, the whole map
+   gets looked at instead. With edges scattered at random, "make bench" has
+   the two break even at about 300 edges in a 64 kB map and 4000 in a 1 MB
+   one, where a quarter of the blocks are flagged: */
+
+#define MAP_DIRTY_GAP       4
+#define MAP_DIRTY_RATIO     4
+
+/* ...and leave MAP_REC_DIRTY in the flags of their __afl_map records, see
+   afl-llvm-rt.o.c: */
+
+#define MAP_REC_DIRTY       1
+
 /* Other less interesting, internal-only variables. */
 
 #define CLANG_ENV_VAR       "__AFL_CLANG_MODE"
@@ -334,6 +440,15 @@
 #define MAP_SIZE_POW2       16
 #define MAP_SIZE            (1 << MAP_SIZE_POW2)
 
+/* afl-clang-fast can be told to use a bigger map with AFL_MAP_SIZE, up to
+   2^MAP_SIZE_POW2_MAX, or one sized to fit the edges of the target with
+   AFL_DENSE_MAP. Such binaries ask afl-fuzz for it in the fork server
+   handshake. Every queue entry may keep a map_size / 8 byte summary of its
+   trace, so think twice before going much higher: */
+
+#define MAP_SIZE_POW2_MAX   20
+#define MAP_SIZE_MAX        (1 << MAP_SIZE_POW2_MAX)
+
 /* Maximum allocator request size (keep well under INT_MAX): */
 
 #define MAX_ALLOC           0x40000000
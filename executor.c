@@ -0,0 +1,798 @@
+#include "afl-fuzz.h"
+
+/* Executor pool.
+
+   A single fork server runs test cases one after another, so a single
+   afl-fuzz instance can keep at most one core busy with the target. With
+   AFL_EXECUTORS=N, N more fork servers are started next to the main one,
+   each with its own trace map and its own input file (or testcase SHM
+   region). Test cases queued by batch_fuzz_stuff() are then handed out
+   to whichever executor goes idle first, and each result is processed as
+   soon as it comes back - against the one virgin_bits, queue and parsed
+   structure, exactly as common_fuzz_stuff() would have - while the other
+   executors keep running. The main fork server stays in charge of
+   everything else, including calibrating the finds - but the pool comes
+   up before the dry run, and calibrates the initial queue, too. */
+
+struct executor {
+  s32 pid;                          /* Fork server PID                    */
+  s32 ctl_fd, st_fd;                /* Control and status pipes           */
+  s32 child;                        /* PID of the fuzzed program          */
+  s32 shm_id;                       /* Trace map                          */
+  u8* trace;
+  s32 fuzz_id;                      /* Testcase SHM region, or -1         */
+  u8* fuzz_buf;
+  u32 fuzz_len;
+  u8* in_file;                      /* Input file...                      */
+  s32 in_fd;                        /* ...and its fd, if fed to stdin     */
+  s32 item;                         /* Test case being run, or -1         */
+  u64 start_us;                     /* When it was started                */
+  u8  timed_out,                    /* Killed for running too long?       */
+      prev_timed_out;               /* ...the time before?                */
+};
+
+static struct executor pool[EXECUTORS_MAX];
+static u32 pool_cnt;
+
+/* Kill all executors. Called from the stop signal handler, too. */
+
+void kill_executors(void) {
+
+  u32 i;
+
+  for (i = 0; i < pool_cnt; i++) {
+    if (pool[i].child > 0) kill(pool[i].child, SIGKILL);
+    if (pool[i].pid > 0) kill(pool[i].pid, SIGKILL);
+  }
+
+}
+
+/* Get rid of the executors' shared memory (atexit handler). */
+
+static void remove_executor_shm(void) {
+
+  u32 i;
+
+  for (i = 0; i < pool_cnt; i++) {
+    shmctl(pool[i].shm_id, IPC_RMID, NULL);
+    if (pool[i].fuzz_id >= 0) shmctl(pool[i].fuzz_id, IPC_RMID, NULL);
+  }
+
+}
+
+/* Copy of argv, with the path detect_file_args() put in place of @@
+   pointing to fn instead. */
+
+static char** executor_argv(char** argv, u8* path, u8* fn) {
+
+  u32 n = 0, i;
+  char** ret;
+
+  while (argv[n]) n++;
+
+  ret = ck_alloc((n + 1) * sizeof(char*));
+
+  for (i = 0; i < n; i++) {
+
+    u8* loc = path ? (u8*)strstr(argv[i], path) : NULL;
+
+    if (loc) {
+      *loc = 0;
+      ret[i] = alloc_printf("%s%s%s", argv[i], fn, loc + strlen(path));
+      *loc = path[0];
+    } else ret[i] = ck_strdup(argv[i]);
+
+  }
+
+  return ret;
+
+}
+
+static void free_argv(char** argv) {
+
+  u32 i;
+
+  for (i = 0; argv[i]; i++) ck_free(argv[i]);
+  ck_free(argv);
+
+}
+
+/* Start the pool. Each executor is brought up by init_forkserver(), with
+   the globals it reads (and the environment the target inherits) pointed
+   at the executor's own trace map and input for the duration. */
+
+void init_executors(char** argv) {
+
+  u8 *cwd, *path = NULL, *env_shm, *env_fuzz = NULL, *env_batch = NULL, *tmp;
+
+  u8* main_trace    = trace_bits;
+  u8* main_fuzz_buf = shm_fuzz_buf;
+  s32 main_out_fd   = out_fd;
+  s32 main_pid      = forksrv_pid;
+  s32 main_ctl_fd   = fsrv_ctl_fd;
+  s32 main_st_fd    = fsrv_st_fd;
+  u8  main_shm_on   = shm_fuzz_on;
+  u8  main_batch_on = batch_on;
+
+  u32 i;
+
+  if (dumb_mode || no_forkserver) {
+    WARNF("AFL_EXECUTORS needs an instrumented target and a fork server.");
+    return;
+  }
+
+  cwd = getcwd(NULL, 0);
+  if (!cwd) PFATAL("getcwd() failed");
+
+  /* Targets reading a fixed file (-f without @@) can't be told apart. */
+
+  if (out_file && !shm_fuzz_on) {
+
+    path = out_file[0] == '/' ? ck_strdup(out_file)
+                              : alloc_printf("%s/%s", cwd, out_file);
+
+    for (i = 0; argv[i] && !strstr(argv[i], path); i++);
+
+    if (!argv[i]) {
+      WARNF("Target reads a fixed file, not starting the executor pool.");
+      ck_free(path);
+      free(cwd);
+      return;
+    }
+
+  }
+
+  ACTF("Starting %u executors...", executors);
+
+  env_shm = ck_strdup(getenv(SHM_ENV_VAR));
+  if (getenv(SHM_FUZZ_ENV_VAR)) env_fuzz = ck_strdup(getenv(SHM_FUZZ_ENV_VAR));
+
+  /* Executors run one test case at a time. */
+
+  if (getenv(SHM_BATCH_ENV_VAR)) {
+    env_batch = ck_strdup(getenv(SHM_BATCH_ENV_VAR));
+    unsetenv(SHM_BATCH_ENV_VAR);
+  }
+
+  /* Nothing but the main fork server may hang on to its pipes. */
+
+  fcntl(fsrv_ctl_fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fsrv_st_fd, F_SETFD, FD_CLOEXEC);
+
+  atexit(remove_executor_shm);
+
+  for (i = 0; i < executors; i++) {
+
+    struct executor* e = &pool[i];
+    char** e_argv;
+
+    e->shm_id  = shmget(IPC_PRIVATE, MAP_SHM_SIZE(map_size),
+                        IPC_CREAT | IPC_EXCL | 0600);
+    e->fuzz_id = -1;
+    e->in_fd   = -1;
+    e->item    = -1;
+
+    if (e->shm_id < 0) PFATAL("shmget() failed");
+
+    pool_cnt++;
+
+    e->trace = shmat(e->shm_id, NULL, 0);
+    if (e->trace == (void*)-1) PFATAL("shmat() failed");
+
+    tmp = alloc_printf("%d", e->shm_id);
+    setenv(SHM_ENV_VAR, tmp, 1);
+    ck_free(tmp);
+
+    if (shm_fuzz_on) {
+
+      u8* map;
+
+      e->fuzz_id =
+          shmget(IPC_PRIVATE, SHM_FUZZ_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+
+      if (e->fuzz_id < 0) PFATAL("shmget() failed");
+
+      map = shmat(e->fuzz_id, NULL, 0);
+      if (map == (void*)-1) PFATAL("shmat() failed");
+
+      e->fuzz_buf = map + sizeof(u32);
+
+      tmp = alloc_printf("%d", e->fuzz_id);
+      setenv(SHM_FUZZ_ENV_VAR, tmp, 1);
+      ck_free(tmp);
+
+    }
+
+    if (file_extension)
+      e->in_file = alloc_printf("%s%s%s/.cur_input_%u.%s",
+                                out_dir[0] == '/' ? "" : (char*)cwd,
+                                out_dir[0] == '/' ? "" : "/", out_dir, i,
+                                file_extension);
+    else
+      e->in_file = alloc_printf("%s%s%s/.cur_input_%u",
+                                out_dir[0] == '/' ? "" : (char*)cwd,
+                                out_dir[0] == '/' ? "" : "/", out_dir, i);
+
+    unlink(e->in_file); /* Ignore errors */
+
+    if (!out_file) {
+      e->in_fd = open(e->in_file, O_RDWR | O_CREAT | O_EXCL, 0600);
+      if (e->in_fd < 0) PFATAL("Unable to create '%s'", e->in_file);
+    }
+
+    e_argv = executor_argv(argv, path, e->in_file);
+
+    trace_bits   = e->trace;
+    shm_fuzz_buf = e->fuzz_buf;
+    out_fd       = e->in_fd;
+    forksrv_pid  = 0;
+
+    init_forkserver(e_argv);
+
+    e->pid    = forksrv_pid;
+    e->ctl_fd = fsrv_ctl_fd;
+    e->st_fd  = fsrv_st_fd;
+
+    fcntl(e->ctl_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(e->st_fd, F_SETFD, FD_CLOEXEC);
+    if (e->in_fd >= 0) fcntl(e->in_fd, F_SETFD, FD_CLOEXEC);
+
+    free_argv(e_argv);
+
+    if (shm_fuzz_on != main_shm_on)
+      FATAL("Executor #%u disagrees with the main fork server on SHM input", i);
+
+  }
+
+  trace_bits   = main_trace;
+  shm_fuzz_buf = main_fuzz_buf;
+  out_fd       = main_out_fd;
+  forksrv_pid  = main_pid;
+  fsrv_ctl_fd  = main_ctl_fd;
+  fsrv_st_fd   = main_st_fd;
+  batch_on     = main_batch_on;
+
+  setenv(SHM_ENV_VAR, env_shm, 1);
+  if (env_fuzz) setenv(SHM_FUZZ_ENV_VAR, env_fuzz, 1);
+  if (env_batch) setenv(SHM_BATCH_ENV_VAR, env_batch, 1);
+
+  ck_free(env_shm);
+  ck_free(env_fuzz);
+  ck_free(env_batch);
+  ck_free(path);
+  free(cwd);
+
+  /* The pool replaces in-target batching. Pending test cases are kept in
+     a batch_shm, which is just plain memory when there is no region. */
+
+  batch_on = 0;
+  if (!batch_shm) batch_shm = ck_alloc(BATCH_SHM_SIZE(map_size));
+
+  pool_on = 1;
+
+  OKF("Structure stages will run on %u executors.", pool_cnt);
+
+}
+
+/* Same as write_to_testcase(), for the executor's own input. */
+
+static void executor_write(struct executor* e, u8* mem, u32 len) {
+
+  s32 fd = e->in_fd;
+
+  if (e->fuzz_buf) {
+    e->fuzz_len = MIN(len, MAX_FILE);
+    memcpy(e->fuzz_buf, mem, e->fuzz_len);
+    return;
+  }
+
+  if (out_file) {
+
+    unlink(e->in_file); /* Ignore errors. */
+
+    fd = open(e->in_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", e->in_file);
+
+  } else lseek(fd, 0, SEEK_SET);
+
+  ck_write(fd, mem, len, e->in_file);
+
+  if (!out_file) {
+    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
+    lseek(fd, 0, SEEK_SET);
+  } else close(fd);
+
+}
+
+/* Have an idle executor start on test case item. */
+
+static void executor_start(struct executor* e, u32 item, u8* mem, u32 len) {
+
+  s32 res, cmd_len = 4;
+  u32 cmd[2];
+
+  executor_write(e, mem, len);
+
+  memset(e->trace, 0, map_size);
+  MEM_BARRIER();
+
+  cmd[0] = e->prev_timed_out;
+
+  if (e->fuzz_buf) {
+    cmd[1]  = e->fuzz_len;
+    cmd_len = 8;
+  }
+
+  if ((res = write(e->ctl_fd, cmd, cmd_len)) != cmd_len) {
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  }
+
+  if ((res = read(e->st_fd, &e->child, 4)) != 4) {
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  }
+
+  if (e->child <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+  e->item      = item;
+  e->timed_out = 0;
+  e->start_us  = get_cur_time_us();
+
+}
+
+/* Collect the status of a finished executor, as run_target() does. */
+
+static u8 executor_finish(struct executor* e) {
+
+  s32 res, status;
+  u64 exec_ms;
+
+  if ((res = read(e->st_fd, &status, 4)) != 4) {
+    if (stop_soon) return FAULT_ERROR;
+    RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+  }
+
+  exec_ms = (get_cur_time_us() - e->start_us) / 1000;
+
+  if (!WIFSTOPPED(status)) e->child = 0;
+
+  e->item           = -1;
+  e->prev_timed_out = e->timed_out;
+
+  total_execs++;
+
+  MEM_BARRIER();
+
+  if (WIFSIGNALED(status) && !stop_soon) {
+
+    kill_signal = WTERMSIG(status);
+
+    if (e->timed_out && kill_signal == SIGKILL) return FAULT_TMOUT;
+
+    return FAULT_CRASH;
+
+  }
+
+  if (uses_asan && WEXITSTATUS(status) == MSAN_ERROR) {
+    kill_signal = 0;
+    return FAULT_CRASH;
+  }
+
+  if (slowest_exec_ms < exec_ms) slowest_exec_ms = exec_ms;
+
+  return FAULT_NONE;
+
+}
+
+/* Sleep until one of the busy executors is done, or the first one runs out
+   of time (tmout ms) and gets killed. Fills in pfd[] and who[] for the busy
+   ones and returns how many there are, or 0 if poll() was interrupted. */
+
+static u32 wait_executors(struct pollfd* pfd, u32* who, u32 tmout) {
+
+  u64 now = get_cur_time_us(), wait_ms = tmout;
+  u32 nfds = 0, i;
+
+  for (i = 0; i < pool_cnt; i++) {
+
+    struct executor* e = &pool[i];
+    u64 end = e->start_us + tmout * 1000ULL;
+
+    if (e->item < 0) continue;
+
+    if (!e->timed_out) {
+
+      if (end <= now) {
+        e->timed_out = 1;
+        kill(e->child, SIGKILL);
+      } else if ((end - now) / 1000 + 1 < wait_ms)
+        wait_ms = (end - now) / 1000 + 1;
+
+    }
+
+    pfd[nfds].fd     = e->st_fd;
+    pfd[nfds].events = POLLIN;
+    who[nfds++]      = i;
+
+  }
+
+  if (poll(pfd, nfds, wait_ms) < 0) {
+    if (errno == EINTR) return 0;
+    PFATAL("poll() failed");
+  }
+
+  return nfds;
+
+}
+
+/* Run the n test cases pending in b on the pool. cur_byte holds the
+   stage_cur_byte of each, and their edit scripts are in the matching
+   edit_save() slots. Returns 1 if it's time to bail out, once the test
+   cases already running are done. */
+
+u8 run_executors(char** argv, struct batch_shm* b, u32 n, s32* cur_byte,
+                 Chunk* tree, Track* track) {
+
+  struct pollfd pfd[EXECUTORS_MAX];
+  u32 who[EXECUTORS_MAX];
+  u32 next = 0, busy = 0, nfds, i;
+  s32 old_byte = stage_cur_byte;
+  u8  ret = 0;
+
+  edit_save(BATCH_MAX);
+
+  while (1) {
+
+    /* Idle executors pick up the next pending test case. */
+
+    for (i = 0; i < pool_cnt && next < n && !ret; i++) {
+
+      if (pool[i].item >= 0) continue;
+
+      executor_start(&pool[i], next, b->data + b->off[next], b->len[next]);
+      next++;
+      busy++;
+
+    }
+
+    if (stop_soon) return 1;
+    if (!busy) break;
+
+    nfds = wait_executors(pfd, who, fuzz_tmout);
+
+    for (i = 0; i < nfds; i++) {
+
+      struct executor* e = &pool[who[i]];
+      u32 item = e->item;
+      u8  fault;
+
+      if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+      fault = executor_finish(e);
+      busy--;
+
+      if (stop_soon) return 1;
+
+      /* When bailing out, only wait for the rest to finish. */
+
+      if (ret) continue;
+
+      memcpy(trace_bits, e->trace, map_size);
+
+      trace_changed();
+      classify_trace();
+
+      /* Keep the executor busy while we look at the results. */
+
+      if (next < n) {
+        executor_start(e, next, b->data + b->off[next], b->len[next]);
+        next++;
+        busy++;
+      }
+
+      stage_cur_byte = cur_byte[item];
+      edit_restore(item);
+
+      total_mutation += 1;
+
+      ret = finish_fuzz_stuff(argv, b->data + b->off[item], b->len[item],
+                              fault, tree, track);
+
+    }
+
+  }
+
+  edit_restore(BATCH_MAX);
+  stage_cur_byte = old_byte;
+
+  return ret;
+
+}
+
+/* Dry run on the pool. Each executor calibrates one queue entry at a time,
+   running it over and over just like calibrate_case() would, and keeps the
+   results to itself: the first trace, the bytes that varied from it, and
+   all the bits that any of the runs hit. calibrate_on_executors() is then
+   called for the entries in queue order, and merges these results into
+   virgin_bits, var_bytes and the top_rated[] entries in that same order -
+   so the outcome doesn't depend on which executor was done first. The pool
+   keeps working on the entries that come next in the meantime. */
+
+struct cal_slot {
+  struct queue_entry* q;            /* Entry being calibrated, or NULL    */
+  u8* mem;                          /* Its contents                       */
+  u8 *first, *var, *all;            /* Traces, see above                  */
+  u32 cksum;                        /* Checksum of the first trace        */
+  u32 runs, cycles;                 /* Runs done, runs wanted             */
+  u64 total_us;                     /* Time spent in the runs             */
+  u8  fault,                        /* Fault that cut the runs short      */
+      aborted,                      /* ...if any                          */
+      var_detected,                 /* Runs disagreed?                    */
+      busy,                         /* Being run by an executor?          */
+      done;                         /* Ready to be merged?                */
+};
+
+static struct cal_slot* cal_slots;
+static u32 cal_slot_cnt, cal_head, cal_loaded;
+static struct queue_entry* cal_next;
+
+/* Fill the free slots with the entries that come next in the queue. */
+
+static void load_cal_slots(void) {
+
+  while (cal_next && cal_loaded < cal_slot_cnt) {
+
+    struct cal_slot* s = &cal_slots[(cal_head + cal_loaded) % cal_slot_cnt];
+    struct queue_entry* q = cal_next;
+    s32 fd;
+
+    /* perform_dry_run() won't ask for these. */
+
+    if (journal_has(q)) {
+      cal_next = q->next;
+      continue;
+    }
+
+    fd = open(q->fname, O_RDONLY);
+    if (fd < 0) PFATAL("Unable to open '%s'", q->fname);
+
+    s->mem = ck_alloc_nozero(q->len);
+
+    if (read(fd, s->mem, q->len) != q->len)
+      FATAL("Short read from '%s'", q->fname);
+
+    close(fd);
+
+    s->q            = q;
+    s->runs         = 0;
+    s->cycles       = fast_cal ? 3 : CAL_CYCLES;
+    s->total_us     = 0;
+    s->fault        = crash_mode;
+    s->aborted      = 0;
+    s->var_detected = 0;
+    s->busy         = 0;
+    s->done         = 0;
+
+    cal_next = q->next;
+    cal_loaded++;
+
+  }
+
+}
+
+/* Look at the trace of one calibration run, as calibrate_case() does. The
+   trace is in trace_bits[]. Returns 1 once the entry is done. */
+
+static u8 cal_slot_run(struct cal_slot* s, u8 fault) {
+
+  u32 cksum, i;
+
+  if (fault != crash_mode) {
+    s->fault   = fault;
+    s->aborted = 1;
+    return 1;
+  }
+
+  if (!dumb_mode && !s->runs && !count_bytes(trace_bits)) {
+    s->fault   = FAULT_NOINST;
+    s->aborted = 1;
+    return 1;
+  }
+
+  cksum = trace_cksum();
+
+  if (!s->runs) {
+
+    s->cksum = cksum;
+    memcpy(s->first, trace_bits, map_size);
+    memcpy(s->all, trace_bits, map_size);
+    memset(s->var, 0, map_size);
+
+  } else if (cksum != s->cksum) {
+
+    for (i = 0; i < map_size; i++) {
+      s->var[i] |= s->first[i] != trace_bits[i];
+      s->all[i] |= trace_bits[i];
+    }
+
+    s->cycles       = CAL_CYCLES_LONG;
+    s->var_detected = 1;
+
+  }
+
+  return ++s->runs == s->cycles;
+
+}
+
+/* Calibrate q, which has to be the next entry in queue order, on the pool.
+   Has the same effect as calibrate_case(argv, q, mem, 0, 1) - save for the
+   exact number of extra runs given to variable entries. */
+
+u8 calibrate_on_executors(struct queue_entry* q) {
+
+  struct pollfd pfd[EXECUTORS_MAX];
+  u32 who[EXECUTORS_MAX];
+  struct cal_slot* s;
+  u32 tmout = exec_tmout, nfds, i, j;
+  u8  new_bits = 0, fault;
+
+  if (resuming_fuzz)
+    tmout = MAX(exec_tmout + CAL_TMOUT_ADD, exec_tmout * CAL_TMOUT_PERC / 100);
+
+  if (!cal_slots) {
+
+    cal_slot_cnt = pool_cnt * 2;
+    cal_slots    = ck_alloc(cal_slot_cnt * sizeof(struct cal_slot));
+
+    for (i = 0; i < cal_slot_cnt; i++) {
+      cal_slots[i].first = ck_alloc_nozero(map_size);
+      cal_slots[i].var   = ck_alloc_nozero(map_size);
+      cal_slots[i].all   = ck_alloc_nozero(map_size);
+    }
+
+    cal_next = q;
+
+  }
+
+  load_cal_slots();
+
+  s = &cal_slots[cal_head];
+
+  if (s->q != q) FATAL("Dry run on the executors got out of order");
+
+  while (!s->done) {
+
+    /* Idle executors start on the next entry nobody has picked up. */
+
+    for (i = 0; i < pool_cnt; i++) {
+
+      if (pool[i].item >= 0) continue;
+
+      for (j = 0; j < cal_loaded; j++) {
+
+        struct cal_slot* n = &cal_slots[(cal_head + j) % cal_slot_cnt];
+
+        if (n->busy || n->done) continue;
+
+        n->busy = 1;
+        executor_start(&pool[i], n - cal_slots, n->mem, n->q->len);
+        break;
+
+      }
+
+    }
+
+    if (stop_soon) return FAULT_ERROR;
+
+    nfds = wait_executors(pfd, who, tmout);
+
+    for (i = 0; i < nfds; i++) {
+
+      struct executor* e = &pool[who[i]];
+      struct cal_slot* n = &cal_slots[e->item];
+
+      if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+      fault = executor_finish(e);
+      n->total_us += get_cur_time_us() - e->start_us;
+
+      if (stop_soon) return FAULT_ERROR;
+
+      memcpy(trace_bits, e->trace, map_size);
+
+      trace_changed();
+      classify_trace();
+
+      /* Stick with the same executor until the entry is done. */
+
+      if (cal_slot_run(n, fault)) {
+        n->busy = 0;
+        n->done = 1;
+      } else executor_start(e, n - cal_slots, n->mem, n->q->len);
+
+    }
+
+  }
+
+  /* Merge the results, following calibrate_case(). */
+
+  fault = s->fault;
+  q->cal_failed++;
+
+  if (s->runs) {
+
+    q->exec_cksum = s->cksum;
+
+    memcpy(trace_bits, s->all, map_size);
+    trace_changed();
+    new_bits = has_new_bits(virgin_bits);
+
+  }
+
+  if (!s->aborted) {
+
+    memcpy(trace_bits, s->first, map_size);
+    trace_changed();
+
+    total_cal_us += s->total_us;
+    total_cal_cycles += s->cycles;
+
+    q->exec_us     = s->total_us / s->cycles;
+    q->bitmap_size = count_bytes(trace_bits);
+    q->handicap    = 0;
+    q->cal_failed  = 0;
+
+    total_bitmap_size += q->bitmap_size;
+    total_bitmap_entries++;
+
+    update_bitmap_score(q);
+
+    if (!dumb_mode && !fault && !new_bits) fault = FAULT_NOBITS;
+
+  }
+
+  if (new_bits == 2 && !q->has_new_cov) {
+    q->has_new_cov = 1;
+    queued_with_cov++;
+  }
+
+  if (s->var_detected) {
+
+    for (i = 0; i < map_size; i++) var_bytes[i] |= s->var[i];
+
+    var_byte_count = count_bytes(var_bytes);
+
+    if (!q->var_behavior) {
+      mark_as_variable(q);
+      queued_variable++;
+    }
+
+  }
+
+  if (!s->aborted) journal_entry(q);
+
+  ck_free(s->mem);
+  s->q = NULL;
+
+  cal_head = (cal_head + 1) % cal_slot_cnt;
+  cal_loaded--;
+
+  /* That was the last one; the memory is better off elsewhere. */
+
+  if (!cal_next && !cal_loaded) {
+
+    for (i = 0; i < cal_slot_cnt; i++) {
+      ck_free(cal_slots[i].first);
+      ck_free(cal_slots[i].var);
+      ck_free(cal_slots[i].all);
+    }
+
+    ck_free(cal_slots);
+    cal_slots = NULL;
+
+  }
+
+  return fault;
+
+}
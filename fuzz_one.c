@@ -182,6 +182,8 @@ u8 fuzz_one(char **argv) {
 
   Track *track = NULL;
 
+  ChunkIndex *chunk_index = NULL;
+
 #ifdef IGNORE_FINDS
 
   /* In IGNORE_FINDS mode, skip any entries that weren't in the
@@ -269,43 +271,27 @@ u8 fuzz_one(char **argv) {
       goto abandon_entry;
     }
   }
-  
-  in_tree = parse_struture_file(queue_cur->fname);
 
-  track = parse_constraint_file(queue_cur->fname, in_buf);
+  /* Mutations of a fast entry that run for much longer than it did are
+     most likely stuck; don't wait the full timeout for them. */
 
-  FILE *fp = fopen("/libpng-fuzzer/value_pool_log.txt", "w");
-  if (fp) {
-    fprintf(fp, "enum_value_set: %u\n", enum_value_set ? enum_value_set->count : 0);
-    fprintf(fp, "length_value_set: %u\n", length_value_set ? length_value_set->count : 0);
-    fprintf(fp, "offset_value_set: %u\n", offset_value_set ? offset_value_set->count : 0);
-    fclose(fp);
-  }
+  fuzz_tmout = exec_tmout;
 
-  fp = fopen("/NestFuzzer/pool_log.txt", "w");
-  if (fp) {
-      fprintf(fp, "Current total: %u\n", length_value_set->count);
-      UniqueValue *iter = length_value_set->head;
-      while (iter) {
-          print_hex(fp, iter->data, iter->length);
-          fprintf(fp, " (len: %u)\n", iter->length);
-          iter = iter->next;
-      }
-      // fprintf(fp, "--------------------\n");
-      fclose(fp);
-  } else {
-      perror("Failed to open log file");
-  }
+  if (adapt_tmout && queue_cur->exec_us)
+    fuzz_tmout = MIN(exec_tmout, MAX(ADAPT_TMOUT_MIN,
+                     queue_cur->exec_us * ADAPT_TMOUT_MULT / 1000));
+  
+  load_structure(queue_cur->fname, in_buf, len, &in_tree, &track, &chunk_index);
 
   if (track != NULL) reusing_stage(argv, in_buf, len, in_tree, track);
 
   if (in_tree != NULL || track != NULL) {
 
-    struct_describing_stage(argv, in_buf, len, in_tree, track);
+    struct_describing_stage(argv, in_buf, len, in_tree, track, chunk_index);
 
-    constraint_aware_stage(argv, in_buf, len, in_tree, track);
+    constraint_aware_stage(argv, in_buf, len, in_tree, track, chunk_index);
 
-    struct_havoc_stage(argv, in_buf, len, in_tree, track);
+    struct_havoc_stage(argv, in_buf, len, in_tree, track, chunk_index);
 
     goto abandon_entry;
   }
@@ -413,7 +399,7 @@ u8 fuzz_one(char **argv) {
       */
 
     if (!dumb_mode && (stage_cur & 7) == 7) {
-      u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+      u32 cksum = trace_cksum();
 
       if (stage_cur == stage_max - 1 && cksum == prev_cksum) {
         /* If at end of file and we are still collecting a string, grab the
@@ -559,7 +545,7 @@ u8 fuzz_one(char **argv) {
           without wasting time on checksums. */
 
       if (!dumb_mode && len >= EFF_MIN_LEN)
-        cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+        cksum = trace_cksum();
       else
         cksum = ~queue_cur->exec_cksum;
 
@@ -1707,13 +1693,7 @@ retry_splicing:
     } while (tid == current_entry);
 
     splicing_with = tid;
-    target = queue;
-
-    while (tid >= 100) {
-      target = target->next_100;
-      tid -= 100;
-    }
-    while (tid--) target = target->next;
+    target = queue_buf[tid];
 
     /* Make sure that the target has a reasonable length. */
 
@@ -1779,6 +1759,7 @@ abandon_entry:
     queue_cur->was_fuzzed = 1;
     pending_not_fuzzed--;
     if (queue_cur->favored) pending_favored--;
+    journal_state(queue_cur);
   }
 
   munmap(orig_in, queue_cur->len);
@@ -1787,9 +1768,8 @@ abandon_entry:
   ck_free(out_buf);
   ck_free(eff_map);
 
-  free_tree(in_tree, True);
-
-  free_track(track);
+  /* in_tree, track and chunk_index stay in the structure cache, see
+     load_structure(). */
 
   return ret_val;
 
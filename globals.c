@@ -6,6 +6,10 @@ u64 save_offset_number = 100;
 u64* cur_mutator = NULL;
 Boolean save_mutator = False;
 
+UniqueSet *enum_value_set,          /* Value pools for reusing_stage()  */
+          *length_value_set,
+          *offset_value_set;
+
 u8 *in_dir, 
     *out_file,     
     *out_dir,      
@@ -16,10 +20,12 @@ u8 *in_dir,
     *doc_path,     
     *target_path,  
     *orig_cmdline,
-    *file_extension;
+    *file_extension,
+    *struct_store;
 
 u32 exec_tmout = EXEC_TIMEOUT;
 u32 hang_tmout = EXEC_TIMEOUT;
+u32 fuzz_tmout = EXEC_TIMEOUT;
 
 u64 mem_limit = MEM_LIMIT;
 
@@ -49,13 +55,15 @@ u8 skip_deterministic,
     bitmap_changed = 1,      
     qemu_mode,               
     skip_requested,          
+    pool_dump_requested,     
     run_over10m,             
     persistent_mode,         
     deferred_mode,           
-    fast_cal;                
+    fast_cal,                
+    adapt_tmout,             
+    reusing_spill;           
 
 s32 out_fd,
-    dev_urandom_fd = -1, 
     dev_null_fd = -1, 
     fsrv_ctl_fd,  
     fsrv_st_fd; 
@@ -66,13 +74,41 @@ s32 forksrv_pid,
 
 u8* trace_bits; 
 
-u8 virgin_bits[MAP_SIZE], 
-    virgin_tmout[MAP_SIZE],      
-    virgin_crash[MAP_SIZE];      
+u32 map_size = MAP_SIZE;
+
+u32 cull_from;
+
+u8 dense_map;
+
+u8 dirty_map;
+
+u8 *virgin_bits, 
+    *virgin_tmout,      
+    *virgin_crash,
+    *virgin_host;
+
+u8* var_bytes; 
+
+s32 shm_id = -1; 
+
+u8 shm_fuzz,   
+    shm_fuzz_on;      
+
+s32 shm_fuzz_id = -1; 
 
-u8 var_bytes[MAP_SIZE]; 
+u8* shm_fuzz_buf; 
 
-s32 shm_id; 
+u32 shm_fuzz_len; 
+
+s32 batch_shm_id = -1; 
+
+struct batch_shm* batch_shm; 
+
+u8 batch_on; 
+
+u32 executors; 
+
+u8 pool_on; 
 
 volatile u8 stop_soon, 
     clear_screen = 1,         
@@ -117,6 +153,9 @@ u64 total_crashes,
 
 u32 subseq_tmouts; 
 
+u64 struct_cache_hits,
+    struct_cache_misses;
+
 u8 *stage_name = "init", 
     *stage_short,               
     *syncing_party;             
@@ -136,7 +175,10 @@ u8 stage_val_type;
 u64 stage_finds[32], 
     stage_cycles[32];       
 
-u32 rand_cnt; 
+u64 rand_seed,
+    rand_state[4];
+
+u8 rand_seed_given;
 
 u64 total_cal_us, 
     total_cal_cycles;    
@@ -156,11 +198,13 @@ FILE* plot_file;
 
 struct queue_entry *queue, 
     *queue_cur,                   /* Current offset within the queue  */
-    *queue_top,                   /* Top of the list                  */
-    *q_prev100;                   /* Previous 100 marker              */
+    *queue_top;                   /* Top of the list                  */
+
+struct queue_entry**
+    queue_buf;
 
-struct queue_entry*
-    top_rated[MAP_SIZE]; 
+struct queue_entry**
+    top_rated; 
 
 struct extra_data* extras; /* Extra tokens to fuzz with        */
 u32 extras_cnt;            /* Total number of tokens read      */
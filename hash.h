@@ -108,4 +108,68 @@ static inline u32 hash32(const void* key, u32 len, u32 seed) {
 
 #endif /* ^__x86_64__ */
 
+/* hash32() only looks at whole words, which is fine for the bitmap but not
+   for short, arbitrary-length keys such as ids or field values. This also
+   folds in the trailing bytes. */
+
+static inline u32 hash_bytes(const void* key, u32 len, u32 seed) {
+
+  const u8* tail = (const u8*)key + (len & ~7);
+  u32 h1 = hash32(key, len, seed), i;
+
+  for (i = 0; i < (len & 7); i++) {
+
+    h1 ^= tail[i];
+    h1 *= 0x01000193;
+
+  }
+
+  h1 ^= h1 >> 15;
+  h1 *= 0x2c1b3c6d;
+  h1 ^= h1 >> 12;
+
+  return h1;
+
+}
+
+/* 64-bit FNV-1a. Nowhere near as fast as hash32(), but trivial to get the
+   same result from elsewhere; isi.py uses it to name entries in the
+   structure store. */
+
+static inline u64 hash_fnv64(const u8* buf, u32 len) {
+
+  u64 h = 0xcbf29ce484222325ULL;
+
+  while (len--) h = (h ^ *buf++) * 0x100000001b3ULL;
+
+  return h;
+
+}
+
+/* Trace checksums are a sum of one term per non-zero 64-bit word, keyed on
+   the word's index. Unlike hash32(), this lets the bitmap code skip over
+   zero words, and add up the terms in whatever order it visits the words. */
+
+static inline u64 hash_trace_word(u64 w, u32 idx) {
+
+  w ^= (u64)(idx + 1) * 0x9e3779b97f4a7c15ULL;
+  w *= 0xff51afd7ed558ccdULL;
+  w ^= w >> 32;
+  w *= 0xc4ceb9fe1a85ec53ULL;
+  w ^= w >> 29;
+
+  return w;
+
+}
+
+static inline u32 hash_trace_sum(u64 sum) {
+
+  sum ^= sum >> 33;
+  sum *= 0xff51afd7ed558ccdULL;
+  sum ^= sum >> 33;
+
+  return sum ^ (sum >> 32);
+
+}
+
 #endif /* !_HAVE_HASH_H */
@@ -2,39 +2,219 @@
 
 /* Get rid of shared memory (atexit handler). */
 
-static void remove_shm(void) { shmctl(shm_id, IPC_RMID, NULL); }
+static void remove_shm(void) {
+  if (shm_id >= 0) shmctl(shm_id, IPC_RMID, NULL);
+  if (shm_fuzz_id >= 0) shmctl(shm_fuzz_id, IPC_RMID, NULL);
+  if (batch_shm_id >= 0) shmctl(batch_shm_id, IPC_RMID, NULL);
+}
 
-/* Configure shared memory and virgin_bits. This is called at startup. */
+/* Set up everything that is map_size bytes long: trace_bits (followed by
+   its dirty flags) and the batch region in shared memory, and virgin_bits
+   and friends. */
 
-void setup_shm(void) {
+static void setup_maps(void) {
   u8* shm_str;
 
-  if (!in_bitmap) memset(virgin_bits, 255, MAP_SIZE);
+  ck_free(virgin_bits);
+  ck_free(virgin_tmout);
+  ck_free(virgin_crash);
+  ck_free(var_bytes);
+  ck_free(top_rated);
 
-  memset(virgin_tmout, 255, MAP_SIZE);
-  memset(virgin_crash, 255, MAP_SIZE);
+  virgin_bits = ck_alloc_nozero(map_size);
+  virgin_tmout = ck_alloc_nozero(map_size);
+  virgin_crash = ck_alloc_nozero(map_size);
+  var_bytes = ck_alloc(map_size);
+  top_rated = ck_alloc(map_size * sizeof(struct queue_entry*));
 
-  shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+  if (in_bitmap)
+    read_bitmap(in_bitmap);
+  else
+    memset(virgin_bits, 255, map_size);
 
-  if (shm_id < 0) PFATAL("shmget() failed");
+  memset(virgin_tmout, 255, map_size);
+  memset(virgin_crash, 255, map_size);
 
-  atexit(remove_shm);
+  shm_id = shmget(IPC_PRIVATE, MAP_SHM_SIZE(map_size),
+                  IPC_CREAT | IPC_EXCL | 0600);
 
-  shm_str = alloc_printf("%d", shm_id);
+  if (shm_id < 0) PFATAL("shmget() failed");
 
   /* If somebody is asking us to fuzz instrumented binaries in dumb mode,
      we don't want them to detect instrumentation, since we won't be sending
      fork server commands. This should be replaced with better auto-detection
      later on, perhaps? */
 
-  if (!dumb_mode) setenv(SHM_ENV_VAR, shm_str, 1);
+  if (!dumb_mode) {
+    shm_str = alloc_printf("%d", shm_id);
+    setenv(SHM_ENV_VAR, shm_str, 1);
+    ck_free(shm_str);
 
-  ck_free(shm_str);
+    shm_str = alloc_printf("%u", map_size);
+    setenv(MAP_SIZE_ENV_VAR, shm_str, 1);
+    ck_free(shm_str);
+  }
 
   trace_bits = shmat(shm_id, NULL, 0);
 
   if (trace_bits == (void*)-1) PFATAL("shmat() failed");
+
+  /* Persistent-mode targets reading testcases from shared memory may also
+     take batches of them. */
+
+  if (shm_fuzz_id >= 0) {
+    batch_shm_id = shmget(IPC_PRIVATE, BATCH_SHM_SIZE(map_size),
+                          IPC_CREAT | IPC_EXCL | 0600);
+
+    if (batch_shm_id < 0) PFATAL("shmget() failed");
+
+    shm_str = alloc_printf("%d", batch_shm_id);
+    setenv(SHM_BATCH_ENV_VAR, shm_str, 1);
+    ck_free(shm_str);
+
+    batch_shm = shmat(batch_shm_id, NULL, 0);
+
+    if (batch_shm == (void*)-1) PFATAL("shmat() failed");
+  }
+}
+
+/* Configure shared memory and virgin_bits. This is called at startup. */
+
+void setup_shm(void) {
+  u8* shm_str;
+
+  atexit(remove_shm);
+
+  /* With AFL_SHM_FUZZ, also offer the target a region to read testcases
+     from. Whether it takes it is only known after the fork server
+     handshake; until then (and for good if it doesn't), testcases are
+     written to out_file or out_fd as usual. */
+
+  if (shm_fuzz && !dumb_mode && !no_forkserver) {
+    u8* map;
+
+    shm_fuzz_id = shmget(IPC_PRIVATE, SHM_FUZZ_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+
+    if (shm_fuzz_id < 0) PFATAL("shmget() failed");
+
+    shm_str = alloc_printf("%d", shm_fuzz_id);
+    setenv(SHM_FUZZ_ENV_VAR, shm_str, 1);
+    ck_free(shm_str);
+
+    map = shmat(shm_fuzz_id, NULL, 0);
+
+    if (map == (void*)-1) PFATAL("shmat() failed");
+
+    shm_fuzz_buf = map + sizeof(u32);
+  }
+
+  /* A bitmap from an earlier run tells how big the map was then; the fork
+     server handshake will tell if the target still agrees. */
+
+  if (in_bitmap) {
+    struct stat st;
+
+    if (stat(in_bitmap, &st)) PFATAL("Unable to access '%s'", in_bitmap);
+
+    if (st.st_size < 64 || st.st_size > MAP_SIZE_MAX || st.st_size % 64)
+      FATAL("'%s' is not a valid bitmap", in_bitmap);
+
+    map_size = st.st_size;
+  }
+
+  setup_maps();
+}
+
+/* Switch to a map of a different size, as asked for by the target in the
+   fork server handshake. Nothing has been run yet, so the maps can simply
+   start over. */
+
+void resize_map(u32 size) {
+  shmdt(trace_bits);
+  shmctl(shm_id, IPC_RMID, NULL);
+
+  if (batch_shm_id >= 0) {
+    shmdt(batch_shm);
+    shmctl(batch_shm_id, IPC_RMID, NULL);
+  }
+
+  map_size = size;
+  setup_maps();
+}
+
+/* With AFL_SHARED_VIRGIN, the instances syncing through sync_dir also
+   share a virgin map, kept in sync_dir/.virgin_bits and mapped by all of
+   them. The header ties the map to the target binary and map size; the map
+   starts over when it was made for something else, or when the -M instance
+   starts a new session, so that nothing the last campaign covered gets in
+   the way of this one. Called once the map size is settled and the dry run
+   is done, so what the initial test cases cover is merged in here. Later
+   on, save_if_interesting() claims the bits of each new find. */
+
+struct host_virgin_header {
+  u32 magic, map_size;
+  u64 bin_size, bin_mtime;
+};
+
+void setup_host_virgin(void) {
+  u8* fn = alloc_printf("%s/.virgin_bits", sync_dir);
+  struct host_virgin_header h, old;
+  struct stat st;
+  u64 *hv, *v;
+  u8* mem;
+  u32 i;
+  s32 fd;
+
+  memset(&h, 0, sizeof(h));
+
+  h.magic    = HOST_VIRGIN_MAGIC;
+  h.map_size = map_size;
+
+  if (!stat(target_path, &st)) {
+    h.bin_size  = st.st_size;
+    h.bin_mtime = st.st_mtime;
+  }
+
+  fd = open(fn, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  if (flock(fd, LOCK_EX)) PFATAL("flock() failed");
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  memset(&old, 0, sizeof(old));
+
+  if (st.st_size == HOST_VIRGIN_OFF + map_size)
+    ck_read(fd, &old, sizeof(old), fn);
+  else if (ftruncate(fd, HOST_VIRGIN_OFF + map_size))
+    PFATAL("ftruncate() failed");
+
+  mem = mmap(0, HOST_VIRGIN_OFF + map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+             fd, 0);
+  if (mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", fn);
+
+  if (memcmp(&old, &h, sizeof(h)) || (force_deterministic && !in_place_resume)) {
+    if (old.magic && memcmp(&old, &h, sizeof(h)))
+      WARNF("The shared virgin map was made for another target, starting over.");
+
+    memset(mem + HOST_VIRGIN_OFF, 255, map_size);
+    memcpy(mem, &h, sizeof(h));
+  }
+
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  virgin_host = mem + HOST_VIRGIN_OFF;
+
+  hv = (u64*)virgin_host;
+  v  = (u64*)virgin_bits;
+
+  for (i = 0; i < (map_size >> 3); i++)
+    if (~v[i] & hv[i]) __atomic_fetch_and(&hv[i], v[i], __ATOMIC_RELAXED);
+
+  OKF("Sharing the virgin map through '%s'.", fn);
+  ck_free(fn);
 }
+
 /* Load postprocessor, if available. */
 
 void setup_post(void) {
@@ -117,11 +297,16 @@ void read_testcases(void) {
       free(nl[i]);
       continue;
     }
-    /* skip .track file */
+    /* skip .log file */
     if (file_type != NULL && strcmp(file_type, ".log") == 0) {
       free(nl[i]);
       continue;
     }
+    /* skip compiled structure image */
+    if (file_type != NULL && strcmp(file_type, ".simg") == 0) {
+      free(nl[i]);
+      continue;
+    }
 
     struct stat st;
 
@@ -400,6 +585,13 @@ void bind_to_free_cpu(void) {
     return;
   }
 
+  /* Executors inherit the binding, which would defeat their purpose. */
+
+  if (executors) {
+    WARNF("Not binding to a CPU core (AFL_EXECUTORS set).");
+    return;
+  }
+
   d = opendir("/proc");
 
   if (!d) {
@@ -515,6 +707,14 @@ static void nuke_resume_dir(void) {
   if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
   ck_free(fn);
 
+  fn = alloc_printf("%s/_resume/.state/value_pools", out_dir);
+  if (delete_files(fn, "pool_")) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/_resume/.state/journal", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
   fn = alloc_printf("%s/_resume/.state", out_dir);
   if (rmdir(fn) && errno != ENOENT) goto dir_cleanup_failed;
   ck_free(fn);
@@ -536,6 +736,7 @@ dir_cleanup_failed:
 static void maybe_delete_out_dir(void) {
   FILE* f;
   u8* fn = alloc_printf("%s/fuzzer_stats", out_dir);
+  u32 i;
 
   /* See if the output directory is locked. If yes, bail out. If not,
      create a lock that will persist for the lifetime of the process
@@ -647,6 +848,18 @@ static void maybe_delete_out_dir(void) {
   if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
   ck_free(fn);
 
+  fn = alloc_printf("%s/queue/.state/value_pools", out_dir);
+  if (delete_files(fn, "pool_")) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/journal", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/reusing", out_dir);
+  if (delete_files(fn, "cand_")) goto dir_cleanup_failed;
+  ck_free(fn);
+
   /* Then, get rid of the .state subdirectory itself (should be empty by now)
      and everything matching <out_dir>/queue/id:*. */
 
@@ -736,6 +949,18 @@ static void maybe_delete_out_dir(void) {
   if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
   ck_free(fn);
 
+  for (i = 0; i < EXECUTORS_MAX; i++) {
+
+    if (file_extension)
+      fn = alloc_printf("%s/.cur_input_%u.%s", out_dir, i, file_extension);
+    else
+      fn = alloc_printf("%s/.cur_input_%u", out_dir, i);
+
+    if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+    ck_free(fn);
+
+  }
+
   fn = alloc_printf("%s/fuzz_bitmap", out_dir);
   if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
   ck_free(fn);
@@ -750,6 +975,14 @@ static void maybe_delete_out_dir(void) {
   if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
   ck_free(fn);
 
+  fn = alloc_printf("%s/value_pools.txt", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/dump_pools", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
   OKF("Output dir cleanup successful.");
 
   /* Wow... is that all? If yes, celebrate! */
@@ -804,13 +1037,6 @@ void setup_dirs_fds(void) {
 #endif /* !__sun */
   }
 
-  tmp = alloc_printf("/NestFuzzer/tmp/queue");
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
-  ck_free(tmp);
-  tmp = alloc_printf("/NestFuzzer/tmp/structure");
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
-  ck_free(tmp);
-
   /* Queue directory for any starting & discovered paths. */
 
   tmp = alloc_printf("%s/queue", out_dir);
@@ -849,6 +1075,20 @@ void setup_dirs_fds(void) {
   if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
+  /* Value pools of the reusing stage. */
+
+  tmp = alloc_printf("%s/queue/.state/value_pools/", out_dir);
+  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  ck_free(tmp);
+
+  /* Reusing stage candidates, only written out for debugging. */
+
+  if (reusing_spill) {
+    tmp = alloc_printf("%s/reusing", out_dir);
+    if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+    ck_free(tmp);
+  }
+
   /* Sync directory for keeping track of cooperating fuzzers. */
 
   if (sync_id) {
@@ -877,9 +1117,6 @@ void setup_dirs_fds(void) {
   dev_null_fd = open("/dev/null", O_RDWR);
   if (dev_null_fd < 0) PFATAL("Unable to open /dev/null");
 
-  dev_urandom_fd = open("/dev/urandom", O_RDONLY);
-  if (dev_urandom_fd < 0) PFATAL("Unable to open /dev/urandom");
-
   /* Gnuplot output file. */
 
   tmp = alloc_printf("%s/plot_data", out_dir);
@@ -1115,9 +1352,7 @@ void pivot_inputs(void) {
       src_str = strchr(rsl + 3, ':');
 
       if (src_str && sscanf(src_str + 1, "%06u", &src_id) == 1) {
-        struct queue_entry* s = queue;
-        while (src_id-- && s) s = s->next;
-        if (s) q->depth = s->depth + 1;
+        if (src_id < queued_paths) q->depth = queue_buf[src_id]->depth + 1;
 
         if (max_depth < q->depth) max_depth = q->depth;
       }
@@ -1146,6 +1381,20 @@ void pivot_inputs(void) {
     /* Pivot to the new queue entry. */
 
     link_or_copy(q->fname, nfn);
+
+    /* Carry the structure image over, too, so that it doesn't need to be
+       compiled again. */
+
+    {
+      u8* img = alloc_printf("%s.simg", q->fname);
+      u8* nimg = alloc_printf("%s.simg", nfn);
+
+      if (!access(img, F_OK)) link_or_copy(img, nimg);
+
+      ck_free(img);
+      ck_free(nimg);
+    }
+
     ck_free(q->fname);
     q->fname = nfn;
 
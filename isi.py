@@ -22,6 +22,8 @@ isi_track = defult_track
 
 global log_file
 
+store = None
+
 def parse_args():
     p = argparse.ArgumentParser()
     p.add_argument("-f", dest="input",
@@ -32,6 +34,9 @@ def parse_args():
     p.add_argument("-t", dest="timeout",
                    help="Timeout for structure inference", type=int, required=True)
     p.add_argument("-l", dest="log_file", help="Log file", required=True)
+    p.add_argument("-s", dest="store",
+                   help="Structure store shared with afl-fuzz (AFL_STRUCT_STORE)",
+                   required=False)
     return p.parse_args()
 
 
@@ -263,7 +268,36 @@ def adjust_structure(json_path, track_path):
     except:
         return False
 
+def store_key(input):
+    # Same as store_base() in structure_image.c: 64-bit FNV-1a of the
+    # contents, and the length.
+    with open(input, "rb") as f:
+        data = f.read()
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & 0xffffffffffffffff
+    return os.path.join(store, "%016x-%u" % (h, len(data)))
+
+def in_store(input):
+    key = store_key(input)
+    return os.path.exists(key + ".json") or os.path.exists(key + ".track")
+
+def publish(input):
+    # Copy to a temporary name first, so that afl-fuzz never sees half a file.
+    key = store_key(input)
+    for suffix in (".json", ".track"):
+        src = input + suffix
+        dst = key + suffix
+        if os.path.exists(src) and not os.path.exists(dst):
+            tmp = "%s.%d.tmp" % (dst, os.getpid())
+            shutil.copy(src, tmp)
+            os.replace(tmp, dst)
+
 def infer_strcuture(input, cmd, timeout):
+    if store and in_store(input):
+        log("Infer file: " + input + " \n" + "Found in store\n")
+        return False
+
     set_isi_path(input)
     shell = gen_cmd(cmd, timeout, input)
     print("###Infer " + input + "###")
@@ -278,6 +312,8 @@ def infer_strcuture(input, cmd, timeout):
     log(msg)
     if json_legal:
         save_result(input)
+        if store:
+            publish(input)
     
     return json_legal
 
@@ -294,7 +330,7 @@ def handle_fuzzer_out(output, cmd, timeout):
     while True:
         seeds = os.listdir(fuzzer_queue)
         for seed in seeds:
-            if seed == ".state" or "json" in seed or "track" in seed:
+            if seed == ".state" or "json" in seed or "track" in seed or "simg" in seed:
                 continue
             if processed.count(seed):
                 continue
@@ -317,8 +353,12 @@ def handle_fuzzer_out(output, cmd, timeout):
 
 def main():
     global log_file
+    global store
     args = parse_args()
     log_file = args.log_file
+    store = args.store
+    if store and not os.path.exists(store):
+        os.makedirs(store)
     if not args.fuzzer and not args.input:
         print("set -f or -o")
         exit()
@@ -293,7 +293,7 @@ def handle_fuzzer_out(output, cmd, timeout):
     while True:
         seeds = os.listdir(fuzzer_queue)
         for seed in seeds:
-            if seed == ".state" or "json" in seed or "track" in seed:
+            if seed == ".state" or "json" in seed or "track" in seed or "simg" in seed:
                 continue
             
             input_path = os.path.join(infer_dir, seed)
@@ -0,0 +1,395 @@
+#include "afl-fuzz.h"
+
+/* Queue journal.
+
+   Resuming a session used to mean calibrating every entry of the old queue
+   all over again, CAL_CYCLES runs apiece, just to learn what the previous
+   session already knew. The journal keeps that around: an append-only file
+   in queue/.state/ with a record for every entry that gets calibrated or
+   trimmed - length, speed, checksum, flags and the classified trace, with
+   the non-zero bytes packed as (offset << 8 | value) words - and a shorter
+   one, without the trace, once an entry is done being fuzzed. Whenever
+   calibration has turned up more variable bytes, the offsets of all of
+   them go in as well, ahead of the next record.
+
+   On resume, the dry run looks up the last records for each entry by its
+   position in the queue, and as long as the name and length still match,
+   takes the trace and numbers from there instead of running it. Each record
+   also carries a stamp of the entry's structure files, and the fuzzing
+   state is only carried over if they are still the same. The whole journal
+   is dropped if the target binary or the map size has changed. Value pools
+   have their own append-only files, see value_pool.c. */
+
+#define JOURNAL_MAGIC   0x4e524a51 /* "QJRN" */
+#define JOURNAL_VERSION 2
+
+#define JOURNAL_ENTRY   1          /* Calibration results and trace     */
+#define JOURNAL_STATE   2          /* Flags only                        */
+#define JOURNAL_VAR     3          /* All of var_bytes[], as offsets    */
+
+struct journal_header {
+  u32 magic, version, map_size, pad;
+  u64 bin_size, bin_mtime;         /* Target the traces came from       */
+};
+
+struct journal_rec {
+  u32 type, size,                  /* Size includes the trace words     */
+      id, name_hash, len,
+      bitmap_size, exec_cksum, trace_cnt,
+      struct_stamp, pad0;          /* See structure_stamp()             */
+  u64 exec_us, handicap;
+  u8  was_fuzzed, passed_det, was_inferred, var_behavior, has_new_cov,
+      pad[3];
+};
+
+static s32 journal_fd = -1;
+static u8* journal_fn;
+static u32 journal_var_cnt;        /* var_byte_count as last written    */
+
+/* The previous session's journal, and its last records for each entry. */
+
+static u8* old_mem;
+static u64 old_len;
+static u32 old_cnt;
+static struct journal_rec **old_entry, **old_state, *old_var;
+
+static u32 name_hash(struct queue_entry* q) {
+
+  u8* fn = strrchr(q->fname, '/') + 1;
+
+  return hash_bytes(fn, strlen(fn), HASH_CONST);
+
+}
+
+static void fill_header(struct journal_header* h) {
+
+  struct stat st;
+
+  memset(h, 0, sizeof(struct journal_header));
+
+  h->magic    = JOURNAL_MAGIC;
+  h->version  = JOURNAL_VERSION;
+  h->map_size = map_size;
+
+  if (!stat(target_path, &st)) {
+    h->bin_size  = st.st_size;
+    h->bin_mtime = st.st_mtime;
+  }
+
+}
+
+static void journal_write(struct queue_entry* q, u32 type) {
+
+  static u8* buf;
+  struct journal_rec* r;
+  u8* map = trace_bits;
+  u32 cnt = 0, size, i;
+
+  if (dumb_mode) return;
+
+  if (journal_fd < 0) {
+
+    struct journal_header h;
+
+    journal_fn = alloc_printf("%s/queue/.state/journal", out_dir);
+    journal_fd = open(journal_fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+    if (journal_fd < 0) PFATAL("Unable to create '%s'", journal_fn);
+
+    fcntl(journal_fd, F_SETFD, FD_CLOEXEC);
+
+    fill_header(&h);
+    ck_write(journal_fd, &h, sizeof(h), journal_fn);
+
+  }
+
+  /* New variable bytes go in first, in a record of their own. */
+
+  if (type != JOURNAL_VAR && var_byte_count != journal_var_cnt) {
+    journal_write(NULL, JOURNAL_VAR);
+    journal_var_cnt = var_byte_count;
+  }
+
+  if (type == JOURNAL_VAR) map = var_bytes;
+
+  if (type != JOURNAL_STATE) cnt = count_bytes(map);
+
+  size = (sizeof(struct journal_rec) + cnt * sizeof(u32) + 7) & ~7;
+  buf  = ck_realloc_block(buf, size);
+  r    = (struct journal_rec*)buf;
+
+  memset(r, 0, size);
+
+  r->type      = type;
+  r->size      = size;
+  r->trace_cnt = cnt;
+
+  if (q) {
+
+    r->id           = q->id;
+    r->name_hash    = name_hash(q);
+    r->len          = q->len;
+    r->bitmap_size  = q->bitmap_size;
+    r->exec_cksum   = q->exec_cksum;
+    r->struct_stamp = structure_stamp(q->fname);
+    r->exec_us      = q->exec_us;
+    r->handicap     = q->handicap;
+    r->was_fuzzed   = q->was_fuzzed;
+    r->passed_det   = q->passed_det;
+    r->was_inferred = q->was_inferred;
+    r->var_behavior = q->var_behavior;
+    r->has_new_cov  = q->has_new_cov;
+
+  }
+
+  if (cnt) {
+
+    u32* w = (u32*)(r + 1);
+
+    for (i = 0; i < map_size; i++)
+      if (map[i]) *w++ = i << 8 | map[i];
+
+  }
+
+  ck_write(journal_fd, buf, size, journal_fn);
+
+}
+
+/* Record the calibration results for q, along with the trace in
+   trace_bits[]. */
+
+void journal_entry(struct queue_entry* q) {
+
+  journal_write(q, JOURNAL_ENTRY);
+
+}
+
+/* Record the flags of q, once it's done being fuzzed. */
+
+void journal_state(struct queue_entry* q) {
+
+  journal_write(q, JOURNAL_STATE);
+
+}
+
+/* Map the journal of the session being resumed, if there is one. This has
+   to happen before pivot_inputs() cleans up _resume/. A truncated tail, as
+   left by a crash mid-write, is simply dropped. */
+
+void read_journal(void) {
+
+  struct stat st;
+  u8 *fn, *ptr, *end;
+  s32 fd;
+
+  fn = alloc_printf("%s/.state/journal", in_dir);
+  fd = open(fn, O_RDONLY);
+
+  if (fd < 0) {
+    ck_free(fn);
+    return;
+  }
+
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  if (st.st_size < sizeof(struct journal_header)) {
+    close(fd);
+    ck_free(fn);
+    return;
+  }
+
+  old_mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (old_mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", fn);
+  close(fd);
+
+  old_len = st.st_size;
+
+  ptr = old_mem + sizeof(struct journal_header);
+  end = old_mem + old_len;
+
+  while (end - ptr >= sizeof(struct journal_rec)) {
+
+    struct journal_rec* r = (struct journal_rec*)ptr;
+
+    if (r->size < sizeof(struct journal_rec) || r->size > end - ptr ||
+        r->trace_cnt > (r->size - sizeof(struct journal_rec)) / sizeof(u32))
+      break;
+
+    if (r->id >= old_cnt) {
+
+      u32 n = MAX(r->id + 1, old_cnt * 2);
+
+      old_entry = ck_realloc(old_entry, n * sizeof(struct journal_rec*));
+      old_state = ck_realloc(old_state, n * sizeof(struct journal_rec*));
+
+      memset(old_entry + old_cnt, 0, (n - old_cnt) * sizeof(struct journal_rec*));
+      memset(old_state + old_cnt, 0, (n - old_cnt) * sizeof(struct journal_rec*));
+
+      old_cnt = n;
+
+    }
+
+    if (r->type == JOURNAL_ENTRY)
+      old_entry[r->id] = r;
+    else if (r->type == JOURNAL_STATE)
+      old_state[r->id] = r;
+    else if (r->type == JOURNAL_VAR)
+      old_var = r;
+
+    ptr += r->size;
+
+  }
+
+  ck_free(fn);
+
+}
+
+/* See if the journal we found is still good for this target. The map size
+   is only settled by the fork server handshake, so start it if needed. If
+   it is, take the variable bytes from there, too. */
+
+void check_journal(char** argv) {
+
+  struct journal_header h;
+  u32* w;
+  u32 i;
+
+  if (!old_mem) return;
+
+  if (dumb_mode != 1 && !no_forkserver && !forksrv_pid) init_forkserver(argv);
+
+  fill_header(&h);
+
+  if (dumb_mode || crash_mode || memcmp(old_mem, &h, sizeof(h))) {
+
+    if (!dumb_mode && !crash_mode)
+      WARNF("Not using the old queue journal, the target has changed.");
+
+    drop_old_journal();
+    return;
+
+  }
+
+  if (!old_var) return;
+
+  w = (u32*)(old_var + 1);
+
+  for (i = 0; i < old_var->trace_cnt; i++)
+    if ((w[i] >> 8) < map_size) var_bytes[w[i] >> 8] = 1;
+
+  var_byte_count = count_bytes(var_bytes);
+
+}
+
+void drop_old_journal(void) {
+
+  if (!old_mem) return;
+
+  munmap(old_mem, old_len);
+  ck_free(old_entry);
+  ck_free(old_state);
+
+  old_mem   = NULL;
+  old_entry = old_state = NULL;
+  old_var   = NULL;
+  old_cnt   = 0;
+
+}
+
+static struct journal_rec* old_record(struct journal_rec** recs,
+                                      struct queue_entry* q) {
+
+  struct journal_rec* r;
+
+  if (!old_mem || q->id >= old_cnt || !(r = recs[q->id])) return NULL;
+  if (r->len != q->len || r->name_hash != name_hash(q)) return NULL;
+
+  return r;
+
+}
+
+/* Can the dry run skip q? */
+
+u8 journal_has(struct queue_entry* q) {
+
+  return !!old_record(old_entry, q);
+
+}
+
+/* Take q's calibration results from the journal, with the same effect on
+   virgin_bits, top_rated[] and the stats as calibrate_case(), and carry the
+   record over to the new journal. Returns 0 if there's nothing on q. */
+
+u8 journal_restore(struct queue_entry* q, u8* fault) {
+
+  struct journal_rec *r = old_record(old_entry, q), *f;
+  u32* w;
+  u32 i;
+  u8 new_bits, same_struct;
+
+  if (!r) return 0;
+
+  /* The flags come from whichever record is newer. The target never sees
+     the structure files, so the trace holds regardless; but if isi.py has
+     been at them since, the entry is due for another round of fuzzing. */
+
+  f = old_record(old_state, q);
+  if (!f || f < r) f = r;
+
+  same_struct = f->struct_stamp == structure_stamp(q->fname);
+
+  memset(trace_bits, 0, map_size);
+
+  w = (u32*)(r + 1);
+
+  for (i = 0; i < r->trace_cnt; i++)
+    if ((w[i] >> 8) < map_size) trace_bits[w[i] >> 8] = w[i];
+
+  trace_changed();
+
+  q->exec_us     = r->exec_us;
+  q->bitmap_size = r->bitmap_size;
+  q->exec_cksum  = r->exec_cksum;
+  q->handicap    = r->handicap;
+  q->cal_failed  = 0;
+
+  new_bits = has_new_bits(virgin_bits);
+
+  total_cal_us += q->exec_us;
+  total_cal_cycles++;
+
+  total_bitmap_size += q->bitmap_size;
+  total_bitmap_entries++;
+
+  update_bitmap_score(q);
+
+  if (new_bits == 2 && !q->has_new_cov) {
+    q->has_new_cov = 1;
+    queued_with_cov++;
+  }
+
+  if (f->var_behavior && !q->var_behavior) {
+    mark_as_variable(q);
+    queued_variable++;
+  }
+
+  if (same_struct) {
+
+    if (f->passed_det && !q->passed_det) mark_as_det_done(q);
+
+    if (f->was_fuzzed && !q->was_fuzzed) {
+      q->was_fuzzed = 1;
+      pending_not_fuzzed--;
+    }
+
+    q->was_inferred = f->was_inferred;
+
+  }
+
+  journal_entry(q);
+
+  *fault = new_bits ? FAULT_NONE : FAULT_NOBITS;
+
+  return 1;
+
+}
@@ -272,6 +272,24 @@ static void edit_params(u32 argc, char** argv) {
 #endif /* ^__APPLE__ */
     "_I(); } while (0)";
 
+  /* Shared-memory testcases: __AFL_FUZZ_INIT() goes at file scope, and
+     tells the runtime to accept the region offered by afl-fuzz. */
+
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_INIT()="
+    "int __afl_sharedmem_fuzzing = 1; "
+    "extern unsigned int *__afl_fuzz_len; "
+    "extern unsigned char *__afl_fuzz_ptr; "
+    "unsigned char __afl_fuzz_alt[" STRINGIFY(MAX_FILE) "]; "
+    "unsigned char *__afl_fuzz_alt_ptr = __afl_fuzz_alt;";
+
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_TESTCASE_BUF="
+    "(__afl_fuzz_ptr ? __afl_fuzz_ptr : __afl_fuzz_alt_ptr)";
+
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_TESTCASE_LEN="
+    "(__afl_fuzz_ptr ? *__afl_fuzz_len : "
+    "(*__afl_fuzz_len = read(0, __afl_fuzz_alt_ptr, " STRINGIFY(MAX_FILE)
+    ")) == 0xffffffff ? 0 : *__afl_fuzz_len)";
+
   if (x_set) {
     cc_params[cc_par_cnt++] = "-x";
     cc_params[cc_par_cnt++] = "none";
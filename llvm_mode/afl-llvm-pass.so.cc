@@ -38,12 +38,16 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <string>
+
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 using namespace llvm;
 
@@ -100,6 +104,24 @@ bool AFLCoverage::runOnModule(Module &M) {
 
   }
 
+  /* Decide map size. Either way, the module leaves a record in the __afl_map
+     section for the runtime to lay out the map; see __afl_map_layout(). */
+
+  char* map_size_str = getenv("AFL_MAP_SIZE");
+  unsigned int map_size = MAP_SIZE;
+  bool dense = !!getenv("AFL_DENSE_MAP"), dirty = !!getenv("AFL_DIRTY_MAP");
+
+  if (map_size_str) {
+
+    if (dense) FATAL("AFL_MAP_SIZE and AFL_DENSE_MAP are mutually exclusive");
+
+    if (sscanf(map_size_str, "%u", &map_size) != 1 || map_size < MAP_SIZE ||
+        map_size > MAP_SIZE_MAX || (map_size & (map_size - 1)))
+      FATAL("Bad value of AFL_MAP_SIZE (must be a power of two between "
+            "%u and %u)", MAP_SIZE, MAP_SIZE_MAX);
+
+  }
+
   /* Get globals for the SHM region and the previous location. Note that
      __afl_prev_loc is thread-local. */
 
@@ -111,6 +133,34 @@ bool AFLCoverage::runOnModule(Module &M) {
       M, Int32Ty, false, GlobalValue::ExternalLinkage, 0, "__afl_prev_loc",
       0, GlobalVariable::GeneralDynamicTLSModel, 0, false);
 
+  /* With AFL_DIRTY_MAP, every counter update also flags its block of the
+     map, so that afl-fuzz can leave the rest of it alone. */
+
+  GlobalVariable *AFLDirtyPtr = NULL;
+
+  if (dirty)
+    AFLDirtyPtr =
+        new GlobalVariable(M, PointerType::get(Int8Ty, 0), false,
+                           GlobalValue::ExternalLinkage, 0, "__afl_dirty_ptr");
+
+  /* In dense mode, IDs are handed out in order, on top of a base that the
+     runtime picks for every module. With critical edges split, a counter per
+     block tells apart all the edges, too. */
+
+  GlobalVariable *AFLMapBase = NULL;
+
+  if (dense) {
+
+    AFLMapBase = new GlobalVariable(M, Int32Ty, false,
+                                    GlobalValue::InternalLinkage,
+                                    ConstantInt::get(Int32Ty, 0),
+                                    "__afl_map_base");
+
+    for (auto &F : M)
+      if (!F.isDeclaration()) SplitAllCriticalEdges(F);
+
+  }
+
   /* Instrument all the things! */
 
   int inst_blocks = 0;
@@ -123,24 +173,40 @@ bool AFLCoverage::runOnModule(Module &M) {
 
       if (AFL_R(100) >= inst_ratio) continue;
 
-      /* Make up cur_loc */
+      /* Load SHM pointer */
 
-      unsigned int cur_loc = AFL_R(MAP_SIZE);
+      LoadInst *MapPtr = IRB.CreateLoad(AFLMapPtr);
+      MapPtr->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
-      ConstantInt *CurLoc = ConstantInt::get(Int32Ty, cur_loc);
+      Value *MapIdx;
+      unsigned int cur_loc = 0;
 
-      /* Load prev_loc */
+      if (dense) {
 
-      LoadInst *PrevLoc = IRB.CreateLoad(AFLPrevLoc);
-      PrevLoc->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
-      Value *PrevLocCasted = IRB.CreateZExt(PrevLoc, IRB.getInt32Ty());
+        LoadInst *Base = IRB.CreateLoad(AFLMapBase);
+        Base->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+        MapIdx = IRB.CreateAdd(Base, ConstantInt::get(Int32Ty, inst_blocks));
 
-      /* Load SHM pointer */
+      } else {
 
-      LoadInst *MapPtr = IRB.CreateLoad(AFLMapPtr);
-      MapPtr->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
-      Value *MapPtrIdx =
-          IRB.CreateGEP(MapPtr, IRB.CreateXor(PrevLocCasted, CurLoc));
+        /* Make up cur_loc */
+
+        cur_loc = AFL_R(map_size);
+
+        ConstantInt *CurLoc = ConstantInt::get(Int32Ty, cur_loc);
+
+        /* Load prev_loc */
+
+        LoadInst *PrevLoc = IRB.CreateLoad(AFLPrevLoc);
+        PrevLoc->setMetadata(M.getMDKindID("nosanitize"),
+                             MDNode::get(C, None));
+        Value *PrevLocCasted = IRB.CreateZExt(PrevLoc, IRB.getInt32Ty());
+
+        MapIdx = IRB.CreateXor(PrevLocCasted, CurLoc);
+
+      }
+
+      Value *MapPtrIdx = IRB.CreateGEP(MapPtr, MapIdx);
 
       /* Update bitmap */
 
@@ -150,25 +216,67 @@ bool AFLCoverage::runOnModule(Module &M) {
       IRB.CreateStore(Incr, MapPtrIdx)
           ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
+      if (dirty) {
+
+        LoadInst *DirtyPtr = IRB.CreateLoad(AFLDirtyPtr);
+        DirtyPtr->setMetadata(M.getMDKindID("nosanitize"),
+                              MDNode::get(C, None));
+        Value *DirtyIdx = IRB.CreateGEP(
+            DirtyPtr, IRB.CreateLShr(MapIdx, MAP_DIRTY_POW2));
+        IRB.CreateStore(ConstantInt::get(Int8Ty, 1), DirtyIdx)
+            ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+      }
+
       /* Set prev_loc to cur_loc >> 1 */
 
-      StoreInst *Store =
-          IRB.CreateStore(ConstantInt::get(Int32Ty, cur_loc >> 1), AFLPrevLoc);
-      Store->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+      if (!dense) {
+
+        StoreInst *Store = IRB.CreateStore(
+            ConstantInt::get(Int32Ty, cur_loc >> 1), AFLPrevLoc);
+        Store->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+      }
 
       inst_blocks++;
 
     }
 
+  if (dense && (unsigned int)inst_blocks > MAP_SIZE_MAX)
+    FATAL("Too many edges for a %u-byte map, try without AFL_DENSE_MAP",
+          MAP_SIZE_MAX);
+
+  /* Leave the record: the base and the number of IDs in dense mode, or just
+     the map size otherwise, and the flags. */
+
+  PointerType *Int32PtrTy = PointerType::get(Int32Ty, 0);
+  StructType *MapRecTy = StructType::get(C, {Int32PtrTy, Int32Ty, Int32Ty});
+
+  Constant *MapRecBase = ConstantPointerNull::get(Int32PtrTy);
+  if (dense) MapRecBase = AFLMapBase;
+
+  Constant *MapRecSize =
+      ConstantInt::get(Int32Ty, dense ? inst_blocks : map_size);
+  Constant *MapRecFlags = ConstantInt::get(Int32Ty, dirty ? MAP_REC_DIRTY : 0);
+
+  GlobalVariable *MapRec = new GlobalVariable(
+      M, MapRecTy, true, GlobalValue::InternalLinkage,
+      ConstantStruct::get(MapRecTy, {MapRecBase, MapRecSize, MapRecFlags}),
+      "__afl_map_rec");
+
+  MapRec->setSection("__afl_map");
+  appendToUsed(M, {MapRec});
+
   /* Say something nice. */
 
   if (!be_quiet) {
 
     if (!inst_blocks) WARNF("No instrumentation targets found.");
-    else OKF("Instrumented %u locations (%s mode, ratio %u%%).",
+    else OKF("Instrumented %u locations (%s mode, ratio %u%%, %s map).",
              inst_blocks, getenv("AFL_HARDEN") ? "hardened" :
              ((getenv("AFL_USE_ASAN") || getenv("AFL_USE_MSAN")) ?
-              "ASAN/MSAN" : "non-hardened"), inst_ratio);
+              "ASAN/MSAN" : "non-hardened"), inst_ratio,
+             dense ? "dense" : std::to_string(map_size).c_str());
 
   }
 
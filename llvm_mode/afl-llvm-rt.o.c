@@ -29,6 +29,7 @@
 #include "../android-ashmem.h"
 #include "../config.h"
 #include "../types.h"
+#include "../batch.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -57,30 +58,147 @@
    is used for instrumentation output before __afl_map_shm() has a chance to run.
    It will end up as .comm, so it shouldn't be too wasteful. */
 
-u8  __afl_area_initial[MAP_SIZE];
+u8  __afl_area_initial[MAP_SIZE_MAX];
 u8* __afl_area_ptr = __afl_area_initial;
 
+/* Dirty flags for the blocks of the map, kept by AFL_DIRTY_MAP modules. Under
+   afl-fuzz, they live right after the map in the same region. */
+
+u8  __afl_dirty_initial[MAP_SIZE_MAX >> MAP_DIRTY_POW2];
+u8* __afl_dirty_ptr = __afl_dirty_initial;
+
 __thread u32 __afl_prev_loc;
 
 
+/* Every module built by afl-llvm-pass leaves a record in the __afl_map
+   section. Modules with hashed block IDs give the size of the map they were
+   built for, and no base. Modules with dense edge IDs (AFL_DENSE_MAP) give
+   the number of IDs they use and the address of their base, which
+   __afl_map_layout() fills in so that every module gets a range of its own,
+   past the hashed part. The resulting size is reported to afl-fuzz in the
+   fork server handshake. Flags say how the module writes to the map. */
+
+struct afl_map_rec {
+  u32* base;
+  u32  size;
+  u32  flags;
+};
+
+extern struct afl_map_rec __start___afl_map[] __attribute__((weak));
+extern struct afl_map_rec __stop___afl_map[] __attribute__((weak));
+
+static u32 __afl_map_size = MAP_SIZE;
+static u8  __afl_map_dense, __afl_map_dirty, __afl_dirty_on;
+
+/* Size of the region we were given, if it's too small for the map. */
+
+static u32 __afl_map_short;
+
+
 /* Running in persistent mode? */
 
 static u8 is_persistent;
 
 
+/* Shared-memory testcase delivery. Targets opt in with __AFL_FUZZ_INIT(),
+   which defines __afl_sharedmem_fuzzing, and read the input through
+   __AFL_FUZZ_TESTCASE_BUF and __AFL_FUZZ_TESTCASE_LEN. Outside of afl-fuzz,
+   __afl_fuzz_ptr stays NULL and the macros fall back to reading stdin into
+   a buffer of their own, with the length stored in __afl_fuzz_len_local. */
+
+__attribute__((weak)) int __afl_sharedmem_fuzzing;
+
+u8*  __afl_fuzz_ptr;
+static u32 __afl_fuzz_len_local;
+u32* __afl_fuzz_len = &__afl_fuzz_len_local;
+
+
+/* Batches of test cases, for persistent mode with shared-memory testcases;
+   see __afl_persistent_loop(). */
+
+static struct batch_shm* __afl_batch;
+
+
+/* Work out the map size, and hand out dense ID ranges. Until this runs, all
+   dense modules write from a base of 0, which is harmless. */
+
+static void __afl_map_layout(void) {
+
+  struct afl_map_rec *r, *first = __start___afl_map, *last = __stop___afl_map;
+  u32 hashed = 0, total;
+
+  /* Dirty flags are only any good if every module keeps them. Alignment may
+     leave empty records in between, which don't count. */
+
+  __afl_map_dirty = first < last;
+
+  for (r = first; r < last; r++) {
+
+    if (!r->size) continue;
+
+    if (!r->base && r->size > hashed) hashed = r->size;
+    if (!(r->flags & MAP_REC_DIRTY)) __afl_map_dirty = 0;
+
+  }
+
+  /* Byte 0 is set on startup to keep afl-fuzz happy, so a purely dense map
+     starts one byte in. */
+
+  total = hashed ? hashed : 1;
+
+  for (r = first; r < last; r++) {
+
+    if (!r->base) continue;
+
+    if (r->size > MAP_SIZE_MAX - total) {
+
+      fprintf(stderr, "[-] Too many edges for a %u-byte map, rebuild without "
+              "AFL_DENSE_MAP.\n", MAP_SIZE_MAX);
+      _exit(1);
+
+    }
+
+    *r->base = total;
+    total += r->size;
+    __afl_map_dense = 1;
+
+  }
+
+  if (__afl_map_dense) __afl_map_size = (total + 63) & ~63;
+  else if (hashed) __afl_map_size = hashed;
+
+}
+
+
 /* SHM setup. */
 
 static void __afl_map_shm(void) {
 
   u8 *id_str = getenv(SHM_ENV_VAR);
 
+  __afl_map_layout();
+
   /* If we're running under AFL, attach to the appropriate region, replacing the
      early-stage __afl_area_initial region that is needed to allow some really
      hacky .init code to work correctly in projects such as OpenSSL. */
 
   if (id_str) {
 
-    u32 shm_id = atoi(id_str);
+    u8* size_str = getenv(MAP_SIZE_ENV_VAR);
+    u32 shm_id = atoi(id_str), shm_size = MAP_SIZE;
+
+    /* Older afl-fuzz builds and the other tools don't say how big the region
+       is, so assume the default. If it's too small, stay on the initial area
+       and let the handshake ask for a bigger one. */
+
+    if (size_str) shm_size = atoi(size_str);
+
+    if (shm_size < __afl_map_size) {
+
+      __afl_map_short = shm_size;
+      return;
+
+    }
 
     __afl_area_ptr = shmat(shm_id, NULL, 0);
 
@@ -93,6 +211,40 @@ static void __afl_map_shm(void) {
 
     __afl_area_ptr[0] = 1;
 
+    /* Only afl-fuzz builds that tell us the size leave room for the dirty
+       flags. If the size isn't the one we want, the handshake will get us
+       another region anyway. */
+
+    if (size_str && shm_size == __afl_map_size && __afl_map_dirty) {
+
+      __afl_dirty_ptr = __afl_area_ptr + shm_size;
+      __afl_dirty_on  = 1;
+
+    }
+
+  }
+
+  id_str = getenv(SHM_FUZZ_ENV_VAR);
+
+  if (id_str && __afl_sharedmem_fuzzing) {
+
+    u8* map = shmat(atoi(id_str), NULL, 0);
+
+    if (map == (void *)-1) _exit(1);
+
+    __afl_fuzz_len = (u32*)map;
+    __afl_fuzz_ptr = map + sizeof(u32);
+
+    id_str = getenv(SHM_BATCH_ENV_VAR);
+
+    if (id_str && is_persistent) {
+
+      __afl_batch = shmat(atoi(id_str), NULL, 0);
+
+      if (__afl_batch == (void *)-1) _exit(1);
+
+    }
+
   }
 
 }
@@ -102,7 +254,7 @@ static void __afl_map_shm(void) {
 
 static void __afl_start_forkserver(void) {
 
-  static u8 tmp[4];
+  u32 hello = 0;
   s32 child_pid;
 
   u8  child_stopped = 0;
@@ -110,7 +262,32 @@ static void __afl_start_forkserver(void) {
   /* Phone home and tell the parent that we're OK. If parent isn't there,
      assume we're not running in forkserver mode and just execute program. */
 
-  if (write(FORKSRV_FD + 1, tmp, 4) != 4) return;
+  if (__afl_fuzz_ptr) hello |= FS_OPT_SHMEM_FUZZ;
+  if (__afl_batch) hello |= FS_OPT_BATCH;
+  if (__afl_map_size != MAP_SIZE) hello |= FS_OPT_MAPSIZE;
+  if (__afl_map_dense) hello |= FS_OPT_DENSEMAP;
+  if (__afl_dirty_on) hello |= FS_OPT_DIRTYMAP;
+
+  if (write(FORKSRV_FD + 1, &hello, 4) != 4) {
+
+    /* No fork server on the other end, so nobody is going to resize the
+       map for us. Better to say so than to run without coverage. */
+
+    if (__afl_map_short) {
+
+      fprintf(stderr, "[-] This binary needs a %u-byte coverage map, but the "
+              "caller only provides %u bytes.\n", __afl_map_size,
+              __afl_map_short);
+      _exit(1);
+
+    }
+
+    return;
+
+  }
+
+  if ((hello & FS_OPT_MAPSIZE) &&
+      write(FORKSRV_FD + 1, &__afl_map_size, 4) != 4) _exit(1);
 
   while (1) {
 
@@ -121,6 +298,11 @@ static void __afl_start_forkserver(void) {
 
     if (read(FORKSRV_FD, &was_killed, 4) != 4) _exit(1);
 
+    /* With testcases in shared memory, the length follows. It goes right
+       into the region, so that a stopped persistent child sees it, too. */
+
+    if (__afl_fuzz_ptr && read(FORKSRV_FD, __afl_fuzz_len, 4) != 4) _exit(1);
+
     /* If we stopped the child in persistent mode, but there was a race
        condition and afl-fuzz already issued SIGKILL, write off the old
        process. */
@@ -195,7 +377,7 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 
     if (is_persistent) {
 
-      memset(__afl_area_ptr, 0, MAP_SIZE);
+      memset(__afl_area_ptr, 0, __afl_map_size);
       __afl_area_ptr[0] = 1;
       __afl_prev_loc = 0;
     }
@@ -210,6 +392,29 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 
     if (--cycle_cnt) {
 
+      /* In the middle of a batch, go on with the next test case right
+         away. The trace of the one just done is set aside for afl-fuzz. */
+
+      if (__afl_batch && __afl_batch->pos + 1 < __afl_batch->cnt) {
+
+        struct batch_shm* b = __afl_batch;
+
+        memcpy(b->trace + b->pos * __afl_map_size, __afl_area_ptr,
+               __afl_map_size);
+        memset(__afl_area_ptr, 0, __afl_map_size);
+
+        b->pos++;
+        b->start_us = batch_clock_us();
+        memcpy(__afl_fuzz_ptr, b->data + b->off[b->pos], b->len[b->pos]);
+        *__afl_fuzz_len = b->len[b->pos];
+
+        __afl_area_ptr[0] = 1;
+        __afl_prev_loc = 0;
+
+        return 1;
+
+      }
+
       raise(SIGSTOP);
 
       __afl_area_ptr[0] = 1;
@@ -15,6 +15,15 @@ static void write_with_gap(void* mem, u32 len, u32 skip_at, u32 skip_len) {
   s32 fd = out_fd;
   u32 tail_len = len - skip_at - skip_len;
 
+  if (shm_fuzz_on) {
+    shm_fuzz_len = MIN(skip_at, MAX_FILE);
+    memcpy(shm_fuzz_buf, mem, shm_fuzz_len);
+    tail_len = MIN(tail_len, MAX_FILE - shm_fuzz_len);
+    memcpy(shm_fuzz_buf + shm_fuzz_len, mem + skip_at + skip_len, tail_len);
+    shm_fuzz_len += tail_len;
+    return;
+  }
+
   if (out_file) {
     unlink(out_file); /* Ignore errors. */
 
@@ -42,7 +51,7 @@ static void write_with_gap(void* mem, u32 len, u32 skip_at, u32 skip_len) {
 
 u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
                          u32 handicap, u8 from_queue) {
-  static u8 first_trace[MAP_SIZE];
+  static u8* first_trace;
 
   u8 fault = 0, new_bits = 0, var_detected = 0, hnb = 0,
      first_run = (q->exec_cksum == 0);
@@ -71,8 +80,12 @@ u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
 
   if (dumb_mode != 1 && !no_forkserver && !forksrv_pid) init_forkserver(argv);
 
+  /* The handshake settles map_size, so allocate this only now. */
+
+  if (!first_trace) first_trace = ck_alloc(map_size);
+
   if (q->exec_cksum) {
-    memcpy(first_trace, trace_bits, MAP_SIZE);
+    memcpy(first_trace, trace_bits, map_size);
     hnb = has_new_bits(virgin_bits);
     if (hnb > new_bits) new_bits = hnb;
   }
@@ -99,7 +112,7 @@ u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
       goto abort_calibration;
     }
 
-    cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    cksum = trace_cksum();
 
     if (q->exec_cksum != cksum) {
       hnb = has_new_bits(virgin_bits);
@@ -108,7 +121,7 @@ u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
       if (q->exec_cksum) {
         u32 i;
 
-        for (i = 0; i < MAP_SIZE; i++) {
+        for (i = 0; i < map_size; i++) {
           if (!var_bytes[i] && first_trace[i] != trace_bits[i]) {
             var_bytes[i] = 1;
             stage_max = CAL_CYCLES_LONG;
@@ -119,7 +132,7 @@ u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
 
       } else {
         q->exec_cksum = cksum;
-        memcpy(first_trace, trace_bits, MAP_SIZE);
+        memcpy(first_trace, trace_bits, map_size);
       }
     }
   }
@@ -166,6 +179,9 @@ abort_calibration:
     }
   }
 
+  if (!stop_soon && (fault == crash_mode || fault == FAULT_NOBITS))
+    journal_entry(q);
+
   stage_name = old_sn;
   stage_cur = old_sc;
   stage_max = old_sm;
@@ -184,7 +200,7 @@ file size, to keep the stage short and sweet. */
 u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf,
                     Chunk *tree) {
   static u8 tmp[64];
-  static u8 clean_trace[MAP_SIZE];
+  static u8* clean_trace;
 
   u8 needs_write = 0, fault = 0;
   u32 trim_exec = 0;
@@ -197,6 +213,8 @@ u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf,
 
   if (q->len < 5) return 0;
 
+  if (!clean_trace) clean_trace = ck_alloc(map_size);
+
   stage_name = tmp;
   bytes_trim_in += q->len;
 
@@ -230,7 +248,7 @@ u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf,
 
       /* Note that we don't keep track of crashes or hangs here; maybe TODO? */
 
-      cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+      cksum = trace_cksum();
 
       /* If the deletion had no impact on the trace, make it permanent. This
          isn't perfect for variable-path inputs, but we're just making a
@@ -251,7 +269,7 @@ u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf,
 
         if (!needs_write) {
           needs_write = 1;
-          memcpy(clean_trace, trace_bits, MAP_SIZE);
+          memcpy(clean_trace, trace_bits, map_size);
         }
 
       } else
@@ -282,8 +300,10 @@ u8 trim_case(char** argv, struct queue_entry* q, u8* in_buf,
     ck_write(fd, in_buf, q->len, q->fname);
     close(fd);
 
-    memcpy(trace_bits, clean_trace, MAP_SIZE);
+    memcpy(trace_bits, clean_trace, map_size);
+    trace_changed();
     update_bitmap_score(q);
+    journal_entry(q);
   }
 
 abort_trimming:
@@ -70,54 +70,100 @@ void mark_as_redundant(struct queue_entry* q, u8 state) {
    goes over top_rated[] entries, and then sequentially grabs winners for
    previously-unseen bytes (temp_v) and marks them as favored, at least
    until the next run. The favored entries are given more air time during
-   all fuzzing steps. */
+   all fuzzing steps.
+
+   A pick only depends on the top_rated[] entries up to its own byte, so
+   the ones below cull_from (the first byte with a new winner) still stand.
+   temp_v is saved CULL_SNAPS times along the way, and the pass picks up
+   from the last save before cull_from. The favored flags and redundancy
+   marks are only updated for the entries that were picked or dropped and
+   for the ones new to the queue, so the cost follows the number of
+   changes rather than the size of the queue. */
+
+struct cull_pick {
+  u32 slot;                         /* Byte the entry was picked for      */
+  struct queue_entry* q;
+};
+
+static struct cull_pick* cull_picks;
+static u32 cull_pick_cnt, cull_seen;
 
 void cull_queue(void) {
-  struct queue_entry* q;
-  static u8 temp_v[MAP_SIZE >> 3];
-  u32 i;
+  static u8 *temp_v, *temp_saved;
+  static struct queue_entry** dropped;
+  u32 bytes = map_size >> 3, step = (map_size + CULL_SNAPS - 1) / CULL_SNAPS;
+  u32 drop_cnt = 0, i;
 
   if (dumb_mode || !score_changed) return;
 
   score_changed = 0;
 
-  memset(temp_v, 255, MAP_SIZE >> 3);
+  if (!temp_v) {
+    temp_v = ck_alloc_nozero(bytes);
+    temp_saved = ck_alloc_nozero(bytes * CULL_SNAPS);
+    memset(temp_saved, 255, bytes);
+  }
 
-  queued_favored = 0;
-  pending_favored = 0;
+  if (cull_from < map_size) {
+    u32 from = cull_from / step * step;
 
-  q = queue;
+    /* Drop the picks made from there on... */
 
-  while (q) {
-    q->favored = 0;
-    q = q->next;
-  }
+    while (cull_pick_cnt && cull_picks[cull_pick_cnt - 1].slot >= from) {
+      struct queue_entry* q = cull_picks[--cull_pick_cnt].q;
 
-  /* Let's see if anything in the bitmap isn't captured in temp_v.
-     If yes, and if it has a top_rated[] contender, let's use it. */
+      q->favored = 0;
 
-  for (i = 0; i < MAP_SIZE; i++)
-    if (top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
-      u32 j = MAP_SIZE >> 3;
+      dropped = ck_realloc_block(dropped,
+                                 (drop_cnt + 1) * sizeof(struct queue_entry*));
+      dropped[drop_cnt++] = q;
+    }
 
-      /* Remove all bits belonging to the current entry from temp_v. */
+    memcpy(temp_v, temp_saved + from / step * bytes, bytes);
 
-      while (j--)
-        if (top_rated[i]->trace_mini[j])
-          temp_v[j] &= ~top_rated[i]->trace_mini[j];
+    /* ...and see if anything in the bitmap isn't captured in temp_v. If yes,
+       and if it has a top_rated[] contender, let's use it. */
 
-      top_rated[i]->favored = 1;
-      queued_favored++;
+    for (i = from; i < map_size; i++) {
+      struct queue_entry* q = top_rated[i];
 
-      if (!top_rated[i]->was_fuzzed) pending_favored++;
-    }
+      if (!(i % step)) memcpy(temp_saved + i / step * bytes, temp_v, bytes);
 
-  q = queue;
+      if (q && (temp_v[i >> 3] & (1 << (i & 7)))) {
+        u64 *v = (u64*)temp_v, *m = (u64*)q->trace_mini;
+        u32 j;
 
-  while (q) {
-    mark_as_redundant(q, !q->favored);
-    q = q->next;
+        /* Remove all bits belonging to the current entry from temp_v. Only
+           the bytes from here on will be looked at again - by this pass, or
+           by the ones picking up from the saves - so that's all it takes. */
+
+        for (j = i >> 6; j < bytes >> 3; j++) v[j] &= ~m[j];
+
+        q->favored = 1;
+
+        cull_picks = ck_realloc_block(
+            cull_picks, (cull_pick_cnt + 1) * sizeof(struct cull_pick));
+        cull_picks[cull_pick_cnt].slot = i;
+        cull_picks[cull_pick_cnt++].q  = q;
+
+        mark_as_redundant(q, 0);
+      }
+    }
+
+    cull_from = map_size;
   }
+
+  for (i = 0; i < drop_cnt; i++)
+    mark_as_redundant(dropped[i], !dropped[i]->favored);
+
+  for (; cull_seen < queued_paths; cull_seen++)
+    mark_as_redundant(queue_buf[cull_seen], !queue_buf[cull_seen]->favored);
+
+  queued_favored = cull_pick_cnt;
+  pending_favored = 0;
+
+  for (i = 0; i < cull_pick_cnt; i++)
+    if (!cull_picks[i].q->was_fuzzed) pending_favored++;
 }
 
 /* Append new test case to the queue. */
@@ -143,17 +189,20 @@ void add_to_queue(u8* fname, u8* format_file, u8* track_file, u32 len, u8 passed
     queue_top = q;
 
   } else
-    q_prev100 = queue = queue_top = q;
+    queue = queue_top = q;
 
-  queued_paths++;
+  /* Double the index whenever it fills up. */
+
+  if (!(queued_paths & (queued_paths - 1)))
+    queue_buf = ck_realloc(queue_buf, MAX(queued_paths * 2, 1) *
+                                          sizeof(struct queue_entry*));
+
+  q->id = queued_paths;
+  queue_buf[queued_paths++] = q;
   pending_not_fuzzed++;
 
   cycles_wo_finds = 0;
 
-  if (!(queued_paths % 100)) {
-    q_prev100->next_100 = q;
-    q_prev100 = q;
-  }
   last_path_time = get_cur_time();
 }
 
@@ -176,186 +225,13 @@ void destroy_queue(void) {
       ck_free(q->my_mutators);
     }
     ck_free(q->trace_mini);
+    free_tree(q->tree_cache, True);
+    free_track(q->track_cache);
+    free_chunk_index(q->index_cache);
     ck_free(q);
     q = n;
   }
-}
-
-/* Grab interesting test cases from other fuzzers. */
-
-void sync_fuzzers(char** argv) {
-  DIR* sd;
-  struct dirent* sd_ent;
-  u32 sync_cnt = 0;
-
-  sd = opendir(sync_dir);
-  if (!sd) PFATAL("Unable to open '%s'", sync_dir);
-
-  stage_max = stage_cur = 0;
-  cur_depth = 0;
-
-  /* Look at the entries created for every other fuzzer in the sync directory.
-   */
-
-  while ((sd_ent = readdir(sd))) {
-    static u8 stage_tmp[128];
-
-    DIR* qd;
-    struct dirent* qd_ent;
-    u8 *qd_path, *qd_synced_path;
-    u32 min_accept = 0, next_min_accept;
-
-    s32 id_fd;
-
-    u8* file_type;
-
-    /* Skip dot files and our own output directory. */
-
-    if (sd_ent->d_name[0] == '.' || !strcmp(sync_id, sd_ent->d_name)) continue;
-
-    /* Skip anything that doesn't have a queue/ subdirectory. */
-
-    qd_path = alloc_printf("%s/%s/queue", sync_dir, sd_ent->d_name);
-
-    if (!(qd = opendir(qd_path))) {
-      ck_free(qd_path);
-      continue;
-    }
-
-    /* Retrieve the ID of the last seen test case. */
-
-    qd_synced_path = alloc_printf("%s/.synced/%s", out_dir, sd_ent->d_name);
-
-    id_fd = open(qd_synced_path, O_RDWR | O_CREAT, 0600);
-
-    if (id_fd < 0) PFATAL("Unable to create '%s'", qd_synced_path);
-
-    if (read(id_fd, &min_accept, sizeof(u32)) > 0) lseek(id_fd, 0, SEEK_SET);
-
-    next_min_accept = min_accept;
-
-    /* Show stats */
-
-    sprintf(stage_tmp, "sync %u", ++sync_cnt);
-    stage_name = stage_tmp;
-    stage_cur = 0;
-    stage_max = 0;
-
-    /* For every file queued by this fuzzer, parse ID and see if we have looked
-       at it before; exec a test case if not. */
-
-    while ((qd_ent = readdir(qd))) {
-      u8 *path, *format_path, *track_path;
-      s32 fd;
-      struct stat st;
-      Chunk *tree;
-      Track *track;
-
-      if (qd_ent->d_name[0] == '.' ||
-          sscanf(qd_ent->d_name, CASE_PREFIX "%06u", &syncing_case) != 1 ||
-          syncing_case < min_accept)
-        continue;
-
-      /* Skip .json file */
-      file_type = strrchr(qd_ent->d_name, '.');
-      if (file_type != NULL && strcmp(file_type, ".json") == 0) {
-        continue;
-      }
-      
-      /* Skip .track file */
-      if (file_type != NULL && strcmp(file_type, ".track") == 0) {
-        continue;
-      }
-
-      /* Skip .log file */
-      if (file_type != NULL && strcmp(file_type, ".log") == 0) {
-        continue;
-      }
-
-      /* OK, sounds like a new one. Let's give it a try. */
-
-      if (syncing_case >= next_min_accept) next_min_accept = syncing_case + 1;
-
-      path = alloc_printf("%s/%s", qd_path, qd_ent->d_name);
-
-      format_path = alloc_printf("%s/%s.json", qd_path, qd_ent->d_name);
-
-      track_path = alloc_printf("%s/%s.track", qd_path, qd_ent->d_name);
-
-      /* Allow this to fail in case the other fuzzer is resuming or so... */
-
-      fd = open(path, O_RDONLY);
-
-      if (fd < 0) {
-        ck_free(path);
-        ck_free(format_path);
-        ck_free(track_path);
-        continue;
-      }
-
-      // format_fd = open(format_path, O_RDONLY);
-      // if (format_fd < 0) {
-      //   ck_free(path);
-      //   ck_free(format_path);
-      //   continue;
-      // }
-
-      // track_fd = open(track_path, O_RDONLY);
-      // if(track_fd < 0) {
-      //   ck_free(track_path);
-      // }
-
-      if (fstat(fd, &st)) PFATAL("fstat() failed");
-
-      /* Ignore zero-sized or oversized files. */
-
-      if (st.st_size && st.st_size <= MAX_FILE) {
-        u8 fault;
-        u8* mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-
-        if (mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", path);
-        tree = parse_struture_file(format_path);
-
-        track = parse_constraint_file(track_path, mem);
-
-        /* See what happens. We rely on save_if_interesting() to catch major
-           errors and save the test case. */
-
-        write_to_testcase(mem, st.st_size);
-
-        fault = run_target(argv, exec_tmout);
-
-        if (stop_soon) return;
-
-        syncing_party = sd_ent->d_name;
-        queued_imported +=
-            save_if_interesting(argv, mem, st.st_size, fault, tree, track);
-        syncing_party = 0;
-
-        munmap(mem, st.st_size);
-        free_tree(tree, True);
-
-        if (!(stage_cur++ % stats_update_freq)) {
-          show_stats();
-        }
-      }
-
-      ck_free(path);
-      ck_free(format_path);
-      ck_free(track_path);
-      close(fd);
-      // close(format_fd);
-      // close(track_fd);
-    }
-
-    ck_write(id_fd, &next_min_accept, sizeof(u32), qd_synced_path);
-
-    close(id_fd);
-    closedir(qd);
-    ck_free(qd_path);
-    ck_free(qd_synced_path);
-  }
 
-  closedir(sd);
+  ck_free(queue_buf);
 }
 
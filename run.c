@@ -7,7 +7,7 @@ static void check_map_coverage(void) {
 
   if (count_bytes(trace_bits) < 100) return;
 
-  for (i = (1 << (MAP_SIZE_POW2 - 1)); i < MAP_SIZE; i++)
+  for (i = map_size >> 1; i < map_size; i++)
     if (trace_bits[i]) return;
 
   WARNF("Recompile binary with newer version of afl to improve coverage!");
@@ -18,9 +18,11 @@ static void check_map_coverage(void) {
 
 void perform_dry_run(char** argv) {
   struct queue_entry* q = queue;
-  u32 cal_failures = 0;
+  u32 cal_failures = 0, restored = 0;
   u8* skip_crashes = getenv("AFL_SKIP_CRASHES");
 
+  check_journal(argv);
+
   while (q) {
     u8* use_mem;
     u8 res;
@@ -28,20 +30,35 @@ void perform_dry_run(char** argv) {
 
     u8* fn = strrchr(q->fname, '/') + 1;
 
+    /* Entries the last session already calibrated don't need to run. */
+
+    if (journal_restore(q, &res)) {
+      if (q == queue) check_map_coverage();
+      if (res == FAULT_NOBITS) useless_at_start++;
+
+      restored++;
+      q = q->next;
+      continue;
+    }
+
     ACTF("Attempting dry run with '%s'...", fn);
 
-    fd = open(q->fname, O_RDONLY);
-    if (fd < 0) PFATAL("Unable to open '%s'", q->fname);
+    if (pool_on) {
+      res = calibrate_on_executors(q);
+    } else {
+      fd = open(q->fname, O_RDONLY);
+      if (fd < 0) PFATAL("Unable to open '%s'", q->fname);
 
-    use_mem = ck_alloc_nozero(q->len);
+      use_mem = ck_alloc_nozero(q->len);
 
-    if (read(fd, use_mem, q->len) != q->len)
-      FATAL("Short read from '%s'", q->fname);
+      if (read(fd, use_mem, q->len) != q->len)
+        FATAL("Short read from '%s'", q->fname);
 
-    close(fd);
+      close(fd);
 
-    res = calibrate_case(argv, q, use_mem, 0, 1);
-    ck_free(use_mem);
+      res = calibrate_case(argv, q, use_mem, 0, 1);
+      ck_free(use_mem);
+    }
 
     if (stop_soon) return;
 
@@ -231,6 +248,11 @@ void perform_dry_run(char** argv) {
       WARNF(cLRD "High percentage of rejected test cases, check settings!");
   }
 
+  if (restored)
+    OKF("Took %u calibration results from the queue journal.", restored);
+
+  drop_old_journal();
+
   OKF("All test cases processed.");
 }
 
@@ -242,8 +264,78 @@ void perform_dry_run(char** argv) {
    cloning a stopped child. So, we just execute once, and then send commands
    through a pipe. The other part of this logic is in afl-as.h. */
 
+/* Wait for the fork server to report back on fd, for at most timeout_us.
+   Returns 0 if it didn't. Polling the status pipe itself takes the place
+   of arming a process-wide timer around a blocking read(), and saves the
+   two setitimer() calls per execution; on Linux, ppoll() also has the
+   deadline down to the microsecond. */
+
+static u8 wait_for_status(s32 fd, u64 timeout_us) {
+
+  struct pollfd pfd;
+  u64 end_us = get_cur_time_us() + timeout_us, now;
+  s32 res;
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+
+  while (1) {
+
+#ifdef __linux__
+
+    struct timespec ts;
+
+    ts.tv_sec  = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+
+    res = ppoll(&pfd, 1, &ts, NULL);
+
+#else
+
+    res = poll(&pfd, 1, (timeout_us + 999) / 1000);
+
+#endif /* ^__linux__ */
+
+    if (res > 0) return 1;
+    if (res < 0 && errno != EINTR) PFATAL("poll() failed");
+
+    /* Interrupted by a signal; let the caller's read() sort it out if it
+       was the stop signal. */
+
+    if (stop_soon) return 1;
+
+    now = get_cur_time_us();
+    if (now >= end_us) return 0;
+
+    timeout_us = end_us - now;
+
+  }
+
+}
+
+/* The same for a batch (see flush_batch()), but with the timeout applying
+   to each test case in it: the target notes when it moves on to the next
+   one, and the deadline moves along with it. */
+
+static u8 wait_for_batch(s32 fd, u64 timeout_us) {
+
+  volatile u64* start = &batch_shm->start_us;
+  u64 end_us, now;
+
+  while (1) {
+
+    end_us = *start + timeout_us;
+    now    = batch_clock_us();
+
+    if (now < end_us && wait_for_status(fd, end_us - now)) return 1;
+
+    if (*start + timeout_us == end_us) return 0;
+
+  }
+
+}
+
 void init_forkserver(char** argv) {
-  static struct itimerval it;
   int st_pipe[2], ctl_pipe[2];
   int status;
   s32 rlen;
@@ -320,7 +412,6 @@ void init_forkserver(char** argv) {
 
     close(out_dir_fd);
     close(dev_null_fd);
-    close(dev_urandom_fd);
     close(fileno(plot_file));
 
     /* This should improve performance a bit, since it stops the linker from
@@ -365,23 +456,67 @@ void init_forkserver(char** argv) {
 
   /* Wait for the fork server to come up, but don't wait too long. */
 
-  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
-  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
-
-  setitimer(ITIMER_REAL, &it, NULL);
+  if (!wait_for_status(fsrv_st_fd, exec_tmout * FORK_WAIT_MULT * 1000ULL)) {
+    child_timed_out = 1;
+    kill(forksrv_pid, SIGKILL);
+  }
 
   rlen = read(fsrv_st_fd, &status, 4);
 
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 0;
-
-  setitimer(ITIMER_REAL, &it, NULL);
-
   /* If we have a four-byte "hello" message from the server, we're all set.
      Otherwise, try to figure out what went wrong. */
 
   if (rlen == 4) {
+    u32 need = MAP_SIZE;
+
     OKF("All right - fork server is up.");
+
+    if ((status & FS_OPT_MAPSIZE) && read(fsrv_st_fd, &need, 4) != 4)
+      FATAL("Fork server handshake failed");
+
+    /* Binaries built for a map of another size get one, and a fresh fork
+       server that knows about it. */
+
+    if (need != map_size) {
+      if (need < 64 || need > MAP_SIZE_MAX || need % 64)
+        FATAL("Target wants a %u-byte map, which is not supported", need);
+
+      if (total_execs)
+        FATAL("Target switched from a %u-byte map to %u bytes", map_size, need);
+
+      ACTF("Target wants a %u-byte map, restarting the fork server...", need);
+
+      kill(forksrv_pid, SIGKILL);
+      if (waitpid(forksrv_pid, NULL, 0) <= 0) PFATAL("waitpid() failed");
+
+      close(fsrv_ctl_fd);
+      close(fsrv_st_fd);
+
+      resize_map(need);
+      init_forkserver(argv);
+      return;
+    }
+
+    dense_map = !!(status & FS_OPT_DENSEMAP);
+    dirty_map = !!(status & FS_OPT_DIRTYMAP);
+
+    if (dirty_map)
+      OKF("Target flags the parts of the map it writes to.");
+
+    if (shm_fuzz_buf) {
+      if (status & FS_OPT_SHMEM_FUZZ) {
+        shm_fuzz_on = 1;
+        OKF("Target reads testcases from shared memory.");
+
+        if (status & FS_OPT_BATCH) {
+          batch_on = 1;
+          OKF("Structure stages will run in batches of up to %u.", BATCH_MAX);
+        }
+
+      } else
+        WARNF("Target not built with __AFL_FUZZ_INIT(), using files.");
+    }
+
     return;
   }
 
@@ -549,16 +684,17 @@ u8 run_target(char** argv, u32 timeout) {
   static u32 prev_timed_out = 0;
   static u64 exec_ms = 0;
 
+  u64 start_us = 0;
   int status = 0;
   u32 tb4;
 
   child_timed_out = 0;
 
-  /* After this memset, trace_bits[] are effectively volatile, so we
-     must prevent any earlier operations from venturing into that
+  /* After this, trace_bits[] are effectively volatile, so we must
+     prevent any earlier operations from venturing into that
      territory. */
 
-  memset(trace_bits, 0, MAP_SIZE);
+  clear_trace();
   MEM_BARRIER();
 
   /* If we're running in "dumb" mode, we can't rely on the fork server
@@ -612,7 +748,6 @@ u8 run_target(char** argv, u32 timeout) {
 
       close(dev_null_fd);
       close(out_dir_fd);
-      close(dev_urandom_fd);
       close(fileno(plot_file));
 
       /* Set sane defaults for ASAN if nothing else specified. */
@@ -638,12 +773,21 @@ u8 run_target(char** argv, u32 timeout) {
     }
 
   } else {
-    s32 res;
+    s32 res, cmd_len = 4;
+    u32 cmd[2];
 
     /* In non-dumb mode, we have the fork server up and running, so simply
-       tell it to have at it, and then read back PID. */
+       tell it to have at it, and then read back PID. Targets reading from
+       the testcase SHM region also get the length of the testcase. */
+
+    cmd[0] = prev_timed_out;
 
-    if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4) {
+    if (shm_fuzz_on) {
+      cmd[1] = shm_fuzz_len;
+      cmd_len = 8;
+    }
+
+    if ((res = write(fsrv_ctl_fd, cmd, cmd_len)) != cmd_len) {
       if (stop_soon) return 0;
       RPFATAL(res, "Unable to request new process from fork server (OOM?)");
     }
@@ -654,40 +798,56 @@ u8 run_target(char** argv, u32 timeout) {
     }
 
     if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+    start_us = get_cur_time_us();
   }
 
   /* Configure timeout, as requested by user, then wait for child to terminate.
-   */
+     Without a fork server, that's left to SIGALRM; the handler simply kills
+     the child_pid and sets child_timed_out. */
 
-  it.it_value.tv_sec = (timeout / 1000);
-  it.it_value.tv_usec = (timeout % 1000) * 1000;
-
-  setitimer(ITIMER_REAL, &it, NULL);
+  if (dumb_mode == 1 || no_forkserver) {
+    it.it_value.tv_sec = (timeout / 1000);
+    it.it_value.tv_usec = (timeout % 1000) * 1000;
 
-  /* The SIGALRM handler simply kills the child_pid and sets child_timed_out. */
+    setitimer(ITIMER_REAL, &it, NULL);
 
-  if (dumb_mode == 1 || no_forkserver) {
     if (waitpid(child_pid, &status, 0) <= 0) PFATAL("waitpid() failed");
 
+    getitimer(ITIMER_REAL, &it);
+    exec_ms =
+        (u64)timeout - (it.it_value.tv_sec * 1000 + it.it_value.tv_usec / 1000);
+
+    it.it_value.tv_sec = 0;
+    it.it_value.tv_usec = 0;
+
+    setitimer(ITIMER_REAL, &it, NULL);
+
   } else {
     s32 res;
+    u64 timeout_us = timeout * 1000ULL;
+
+    if (!(batch_shm && batch_shm->cnt
+              ? wait_for_batch(fsrv_st_fd, timeout_us)
+              : wait_for_status(fsrv_st_fd, timeout_us))) {
+      child_timed_out = 1;
+      kill(child_pid, SIGKILL);
+    }
 
     if ((res = read(fsrv_st_fd, &status, 4)) != 4) {
       if (stop_soon) return 0;
       RPFATAL(res, "Unable to communicate with fork server (OOM?)");
     }
-  }
-
-  if (!WIFSTOPPED(status)) child_pid = 0;
 
-  getitimer(ITIMER_REAL, &it);
-  exec_ms =
-      (u64)timeout - (it.it_value.tv_sec * 1000 + it.it_value.tv_usec / 1000);
+    /* For a batch, only the last test case counts. */
 
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 0;
+    if (batch_shm && batch_shm->cnt)
+      exec_ms = (batch_clock_us() - batch_shm->start_us) / 1000;
+    else
+      exec_ms = (get_cur_time_us() - start_us) / 1000;
+  }
 
-  setitimer(ITIMER_REAL, &it, NULL);
+  if (!WIFSTOPPED(status)) child_pid = 0;
 
   total_execs++;
 
@@ -699,11 +859,7 @@ u8 run_target(char** argv, u32 timeout) {
 
   tb4 = *(u32*)trace_bits;
 
-#ifdef WORD_SIZE_64
-  classify_counts((u64*)trace_bits);
-#else
-  classify_counts((u32*)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+  classify_trace();
 
   prev_timed_out = child_timed_out;
 
@@ -737,23 +893,29 @@ u8 run_target(char** argv, u32 timeout) {
   return FAULT_NONE;
 }
 
-/* Write a modified test case, run program, process results. Handle
-   error conditions, returning 1 if it's time to bail out. This is
-   a helper function for fuzz_one(). */
+/* A run that only hit the adaptive timeout of the current entry may just
+   be slow. Give it the full exec_tmout before it counts as a hang, and go
+   on with the results of that run instead. */
 
-u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len, Chunk* tree, Track *track) {
-  u8 fault;
+static u8 confirm_tmout(char** argv, u8* mem, u32 len, u8 fault) {
 
-  total_mutation += 1;
-  
-  if (post_handler) {
-    out_buf = post_handler(out_buf, &len);
-    if (!out_buf || !len) return 0;
-  }
+  if (fault != FAULT_TMOUT || fuzz_tmout >= exec_tmout) return fault;
 
-  write_to_testcase(out_buf, len);
+  write_to_testcase(mem, len);
+
+  return run_target(argv, exec_tmout);
+
+}
+
+/* Process the results of running out_buf, once trace_bits hold its trace.
+   Returns 1 if it's time to bail out. */
+
+u8 finish_fuzz_stuff(char** argv, u8* out_buf, u32 len, u8 fault, Chunk* tree,
+                     Track* track) {
 
-  fault = run_target(argv, exec_tmout);
+  if (syncing_party) return import_case(argv, out_buf, len, fault);
+
+  fault = confirm_tmout(argv, out_buf, len, fault);
 
   if (stop_soon) return 1;
 
@@ -785,6 +947,154 @@ u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len, Chunk* tree, Track *trac
   return 0;
 }
 
+/* Write a modified test case, run program, process results. Handle
+   error conditions, returning 1 if it's time to bail out. This is
+   a helper function for fuzz_one(). */
+
+u8 common_fuzz_stuff(char** argv, u8* out_buf, u32 len, Chunk* tree, Track *track) {
+  u8 fault;
+
+  total_mutation += 1;
+  
+  if (post_handler) {
+    out_buf = post_handler(out_buf, &len);
+    if (!out_buf || !len) return 0;
+  }
+
+  write_to_testcase(out_buf, len);
+
+  fault = run_target(argv, fuzz_tmout);
+
+  if (stop_soon) return 1;
+
+  return finish_fuzz_stuff(argv, out_buf, len, fault, tree, track);
+}
+
+/* Batched execution for persistent-mode targets that support it. Structure
+   stages queue test cases with batch_fuzz_stuff() instead of running them
+   one by one; they are copied straight into the batch SHM region, and run
+   with a single fork server round trip once BATCH_MAX are pending, when
+   the next one does not fit, or when the stage calls flush_batch(). The
+   edit script and stage position of each are kept, so that results are
+   processed exactly as common_fuzz_stuff() would have. With an executor
+   pool, pending test cases go to the pool instead (see executor.c). */
+
+static u32    batch_cnt;                   /* Test cases pending         */
+static s32    batch_byte[BATCH_MAX];       /* stage_cur_byte of each     */
+static Chunk* batch_tree;                  /* Structure of their parent  */
+static Track* batch_track;
+
+u8 flush_batch(char** argv) {
+
+  struct batch_shm* b = batch_shm;
+  u32 n = batch_cnt, done, i;
+  s32 old_byte = stage_cur_byte;
+  u8  fault, ret = 0;
+
+  if (!n) return 0;
+
+  batch_cnt = 0;
+
+  if (pool_on)
+    return run_executors(argv, b, n, batch_byte, batch_tree, batch_track);
+
+  b->cnt = n;
+  b->pos = 0;
+  b->start_us = batch_clock_us();
+
+  write_to_testcase(b->data, b->len[0]);
+
+  fault = run_target(argv, fuzz_tmout);
+
+  /* The target ran test cases up to pos; all but the last one have their
+     traces in the batch region. Anything after a crash, hang, or early
+     exit (with the __AFL_LOOP() count exhausted) is left to run on its
+     own, together with the test case that crashed or hung. */
+
+  done = MIN(b->pos, n - 1);
+  b->cnt = 0;
+
+  if (stop_soon) return 1;
+
+  total_execs += done;
+
+  /* Calibrating new finds clobbers trace_bits, so keep the last trace. */
+
+  if (fault == FAULT_NONE) memcpy(b->trace + done * map_size, trace_bits, map_size);
+
+  edit_save(BATCH_MAX);
+
+  for (i = 0; i < n; i++) {
+
+    u8* mem = b->data + b->off[i];
+
+    stage_cur_byte = batch_byte[i];
+    edit_restore(i);
+
+    if (i < done || (i == done && fault == FAULT_NONE)) {
+
+      total_mutation += 1;
+
+      memcpy(trace_bits, b->trace + i * map_size, map_size);
+
+      trace_changed();
+      if (i < done) classify_trace();
+
+      ret = finish_fuzz_stuff(argv, mem, b->len[i], FAULT_NONE, batch_tree,
+                              batch_track);
+
+    } else
+
+      ret = common_fuzz_stuff(argv, mem, b->len[i], batch_tree, batch_track);
+
+    if (ret) break;
+
+  }
+
+  edit_restore(BATCH_MAX);
+  stage_cur_byte = old_byte;
+
+  return ret;
+
+}
+
+u8 batch_fuzz_stuff(char** argv, u8* out_buf, u32 len, Chunk* tree,
+                    Track* track) {
+
+  struct batch_shm* b = batch_shm;
+  u32 off = 0;
+
+  if (!(batch_on || pool_on) || post_handler || len > MAX_FILE)
+    return flush_batch(argv) ||
+           common_fuzz_stuff(argv, out_buf, len, tree, track);
+
+  if (batch_cnt) {
+
+    off = b->off[batch_cnt - 1] + b->len[batch_cnt - 1];
+
+    if (tree != batch_tree || track != batch_track || off + len > MAX_FILE) {
+      if (flush_batch(argv)) return 1;
+      off = 0;
+    }
+
+  }
+
+  memcpy(b->data + off, out_buf, len);
+
+  b->off[batch_cnt] = off;
+  b->len[batch_cnt] = len;
+  batch_byte[batch_cnt] = stage_cur_byte;
+  edit_save(batch_cnt);
+
+  batch_tree  = tree;
+  batch_track = track;
+
+  if (++batch_cnt == BATCH_MAX) return flush_batch(argv);
+
+  return 0;
+
+}
+
 u8 common_fuzz_stuff_for_reusing(char** argv, u8* out_buf, u32 len, Chunk* tree, Track *track) {
   u8 fault;
 
@@ -797,7 +1107,11 @@ u8 common_fuzz_stuff_for_reusing(char** argv, u8* out_buf, u32 len, Chunk* tree,
 
   write_to_testcase(out_buf, len);
 
-  fault = run_target(argv, exec_tmout);
+  fault = run_target(argv, fuzz_tmout);
+
+  if (stop_soon) return 1;
+
+  fault = confirm_tmout(argv, out_buf, len, fault);
 
   if (stop_soon) return 1;
 
@@ -7,12 +7,18 @@ static void handle_stop_sig(int sig) {
 
   if (child_pid > 0) kill(child_pid, SIGKILL);
   if (forksrv_pid > 0) kill(forksrv_pid, SIGKILL);
+
+  kill_executors();
 }
 
 /* Handle skip request (SIGUSR1). */
 
 static void handle_skipreq(int sig) { skip_requested = 1; }
 
+/* Handle value pool dump request (SIGUSR2). */
+
+static void handle_pool_dump(int sig) { pool_dump_requested = 1; }
+
 /* Handle timeout (SIGALRM). */
 
 static void handle_timeout(int sig) {
@@ -65,6 +71,11 @@ void setup_signal_handlers(void) {
   sa.sa_handler = handle_skipreq;
   sigaction(SIGUSR1, &sa, NULL);
 
+  /* SIGUSR2: dump value pools */
+
+  sa.sa_handler = handle_pool_dump;
+  sigaction(SIGUSR2, &sa, NULL);
+
   /* Things we don't care about. */
 
   sa.sa_handler = SIG_IGN;
@@ -1,5 +1,24 @@
 #include "afl-fuzz.h"
 
+#include <math.h>
+
+/* Estimate what share of the edges seen so far landed on a map byte that
+   another edge had already claimed. With n edges hashed at random into m
+   bytes, about m * (1 - e^(-n/m)) bytes are taken, so going backwards from
+   the number of taken bytes gives n, and n minus that number collided.
+   Dense maps have no collisions to speak of. */
+
+static double map_collisions(double bitmap_cvg) {
+  double taken = bitmap_cvg / 100, edges;
+
+  if (dense_map || taken <= 0) return 0;
+  if (taken >= 1) return 100;
+
+  edges = -log(1 - taken);
+
+  return (1 - taken / edges) * 100;
+}
+
 /* Update stats file for unattended monitoring. */
 
 void write_stats_file(double bitmap_cvg, double stability, double eps) {
@@ -51,6 +70,8 @@ void write_stats_file(double bitmap_cvg, double stability, double eps) {
           "variable_paths    : %u\n"
           "stability         : %0.02f%%\n"
           "bitmap_cvg        : %0.02f%%\n"
+          "map_size          : %u\n"
+          "map_collisions    : %0.02f%%\n"
           "unique_crashes    : %llu\n"
           "unique_hangs      : %llu\n"
           "last_path         : %llu\n"
@@ -63,12 +84,17 @@ void write_stats_file(double bitmap_cvg, double stability, double eps) {
           "\n"
           "target_mode       : %s%s%s%s%s%s%s\n"
           "command_line      : %s\n"
-          "slowest_exec_ms   : %llu\n",
+          "slowest_exec_ms   : %llu\n"
+          "struct_cache_hit  : %llu\n"
+          "struct_cache_miss : %llu\n"
+          "executors         : %u\n"
+          "rand_seed         : %llu\n",
           start_time / 1000, get_cur_time() / 1000, getpid(),
           queue_cycle ? (queue_cycle - 1) : 0, total_execs, eps, queued_paths,
           queued_favored, queued_discovered, queued_imported, max_depth,
           current_entry, pending_favored, pending_not_fuzzed, queued_variable,
-          stability, bitmap_cvg, unique_crashes, unique_hangs,
+          stability, bitmap_cvg, map_size, map_collisions(bitmap_cvg),
+          unique_crashes, unique_hangs,
           last_path_time / 1000, last_crash_time / 1000, last_hang_time / 1000,
           total_execs - last_crash_execs, exec_tmout, use_banner,
           qemu_mode ? "qemu " : "", dumb_mode ? " dumb " : "",
@@ -79,7 +105,10 @@ void write_stats_file(double bitmap_cvg, double stability, double eps) {
            persistent_mode || deferred_mode)
               ? ""
               : "default",
-          orig_cmdline, slowest_exec_ms);
+          orig_cmdline, slowest_exec_ms, struct_cache_hits,
+          struct_cache_misses, pool_on ? executors : 0, rand_seed);
+
+  write_pool_stats(f);
   /* ignore errors */
 
   /* Get rss value from the children
@@ -149,7 +178,7 @@ static void check_term_size(void) {
   if (ioctl(1, TIOCGWINSZ, &ws)) return;
 
   if (ws.ws_row == 0 && ws.ws_col == 0) return;
-  if (ws.ws_row < 25 || ws.ws_col < 80) term_too_small = 1;
+  if (ws.ws_row < 28 || ws.ws_col < 80) term_too_small = 1;
 }
 
 
@@ -206,7 +235,7 @@ void show_stats(void) {
   /* Do some bitmap stats. */
 
   t_bytes = count_non_255_bytes(virgin_bits);
-  t_byte_ratio = ((double)t_bytes * 100) / MAP_SIZE;
+  t_byte_ratio = ((double)t_bytes * 100) / map_size;
 
   if (t_bytes)
     stab_ratio = 100 - ((double)var_byte_count) * 100 / t_bytes;
@@ -219,9 +248,15 @@ void show_stats(void) {
     last_stats_ms = cur_ms;
     write_stats_file(t_byte_ratio, stab_ratio, avg_exec);
     save_auto();
+    save_value_pools();
+    maybe_dump_value_pools(1);
     write_bitmap();
   }
 
+  /* SIGUSR2 asks for a value pool dump. */
+
+  if (pool_dump_requested) maybe_dump_value_pools(0);
+
   /* Every now and then, write plot data. */
 
   if (cur_ms - last_plot_ms > PLOT_UPDATE_SEC * 1000) {
@@ -243,7 +278,7 @@ void show_stats(void) {
 
   /* Compute some mildly useful bitmap stats. */
 
-  t_bits = (MAP_SIZE << 3) - count_bits(virgin_bits);
+  t_bits = (map_size << 3) - count_bits(virgin_bits);
 
   /* Now, for the visuals... */
 
@@ -259,7 +294,7 @@ void show_stats(void) {
   if (term_too_small) {
     SAYF(cBRI
          "Your terminal is too small to display the UI.\n"
-         "Please resize terminal window to at least 80x25.\n" cRST);
+         "Please resize terminal window to at least 80x28.\n" cRST);
 
     return;
   }
@@ -377,10 +412,12 @@ void show_stats(void) {
   SAYF(bV bSTOP "  now processing : " cRST "%-17s " bSTG bV bSTOP, tmp);
 
   sprintf(tmp, "%0.02f%% / %0.02f%%",
-          ((double)queue_cur->bitmap_size) * 100 / MAP_SIZE, t_byte_ratio);
+          ((double)queue_cur->bitmap_size) * 100 / map_size, t_byte_ratio);
 
   SAYF("    map density : %s%-21s " bSTG bV "\n",
-       t_byte_ratio > 70 ? cLRD : ((t_bytes < 200 && !dumb_mode) ? cPIN : cRST),
+       (t_byte_ratio > 70 && !dense_map)
+           ? cLRD
+           : ((t_bytes < 200 && !dumb_mode) ? cPIN : cRST),
        tmp);
 
   sprintf(tmp, "%s (%0.02f%%)", DI(cur_skipped_paths),
@@ -392,6 +429,19 @@ void show_stats(void) {
 
   SAYF(bSTOP " count coverage : " cRST "%-21s " bSTG bV "\n", tmp);
 
+  /* Estimated hash collisions get their own line, next to the map size. A
+     quarter or more of the edges sharing bytes means the map is too small
+     for this target. */
+
+  if (dense_map)
+    sprintf(tmp, "none (%s dense)", DMS(map_size));
+  else
+    sprintf(tmp, "%0.02f%% (%s map)", map_collisions(t_byte_ratio),
+            DMS(map_size));
+
+  SAYF(bV "%37s" bSTG bV bSTOP "     collisions : %s%-21s " bSTG bV "\n", "",
+       map_collisions(t_byte_ratio) >= 25 ? cLRD : cRST, tmp);
+
   SAYF(bVR bH bSTOP cCYA " stage progress " bSTG bH20 bX bH bSTOP cCYA
                          " findings in depth " bSTG bH20 bVL "\n");
 
@@ -711,6 +761,12 @@ void show_init_stats(void) {
     ACTF("No -t option specified, so I'll use exec timeout of %u ms.",
          exec_tmout);
 
+    if (!getenv("AFL_NO_ADAPTIVE_TMOUT")) {
+      adapt_tmout = 1;
+      ACTF("Mutations will be held to %ux the speed of their parent (at least "
+           "%u ms).", ADAPT_TMOUT_MULT, ADAPT_TMOUT_MIN);
+    }
+
     timeout_given = 1;
 
   } else if (timeout_given == 3) {
@@ -723,6 +779,8 @@ void show_init_stats(void) {
   if (dumb_mode && !getenv("AFL_HANG_TMOUT"))
     hang_tmout = MIN(EXEC_TIMEOUT, exec_tmout * 2 + 100);
 
+  fuzz_tmout = exec_tmout;
+
   OKF("All set and ready to roll!");
 }
 
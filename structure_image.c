@@ -0,0 +1,880 @@
+#include "afl-fuzz.h"
+
+/* Compiled structure images.
+
+   The per-seed .json/.track files are convenient for isi.py, but going
+   through cJSON on every fuzz_one() call is expensive for seeds with
+   thousands of chunks and enums. A structure image (.simg) is a flat,
+   position-independent dump of the same information: a pre-order chunk
+   array, enum / length / offset tables, a string pool for ids and a data
+   pool with candidate bytes already decoded from hex. It is written next
+   to the .json file it was compiled from, mapped with a single mmap() and
+   turned back into the usual Chunk / Track objects without any parsing.
+
+   Images are only a cache: the header records size, inode and mtime (to
+   the nanosecond) of the sources, and a stale or damaged image is silently
+   recompiled.
+
+   On top of that, the materialized objects are kept on the queue entry
+   itself, in a small LRU shared by the whole queue, so that favored
+   entries picked over and over again skip even that step. */
+
+#define SIMG_MAGIC     0x474d4953 /* "SIMG" */
+#define SIMG_VERSION   2
+#define SIMG_NONE      0xffffffff
+
+#define SIMG_HAS_TREE  1
+#define SIMG_HAS_TRACK 2
+
+/* Size, inode and mtime in nanoseconds of the .json / .track pair for a
+   queue entry. isi.py can rewrite a file within the same second and at the
+   same size, so whole seconds are not enough. */
+
+struct simg_src {
+  u64 json_mtime, json_size, json_ino,
+      track_mtime, track_size, track_ino;
+};
+
+struct simg_header {
+  u32 magic, version, flags, total_len;
+
+  struct simg_src src;             /* Sources this image was built from */
+
+  u32 chunk_cnt, chunk_off,
+      enum_cnt, enum_off,
+      cand_cnt, cand_off,
+      length_cnt, length_off,
+      offset_cnt, offset_off,
+      str_len, str_off,
+      data_len, data_off;
+};
+
+struct simg_chunk {
+  u32 start, end, id,              /* id is an offset into string pool  */
+      parent, child, next;         /* Chunk indices or SIMG_NONE        */
+};
+
+struct simg_enum {
+  u32 start, end, id,
+      cand_first, cand_num;        /* Range in the candidate table      */
+};
+
+struct simg_cand {
+  u32 off, len;                    /* Decoded bytes in the data pool    */
+};
+
+struct simg_length {
+  u32 start, end, target_start, target_end, id, target_id;
+};
+
+struct simg_offset {
+  u32 start, end, target_start, target_end, id, target_id, abs;
+};
+
+/* Growable section used while compiling. */
+
+struct simg_sect {
+  u8* buf;
+  u32 len;
+};
+
+static void* sect_grab(struct simg_sect* s, u32 size) {
+
+  s->buf = ck_realloc_block(s->buf, s->len + size);
+  s->len += size;
+  return s->buf + s->len - size;
+
+}
+
+static u32 sect_put(struct simg_sect* s, void* data, u32 size) {
+
+  u32 off = s->len;
+  if (size) memcpy(sect_grab(s, size), data, size);
+  return off;
+
+}
+
+static u32 sect_str(struct simg_sect* s, u8* str) {
+
+  if (!str) str = (u8*)"";
+  return sect_put(s, str, strlen((char*)str) + 1);
+
+}
+
+/* Dump chunk siblings and their subtrees in pre-order. Returns the index
+   of the first sibling. */
+
+static u32 compile_chunks(struct simg_sect* chunks, struct simg_sect* strs,
+                          Chunk* head, u32 parent) {
+
+  u32 first = SIMG_NONE, prev = SIMG_NONE;
+
+  while (head) {
+
+    u32 idx = chunks->len / sizeof(struct simg_chunk);
+    struct simg_chunk* c = sect_grab(chunks, sizeof(struct simg_chunk));
+    u32 child;
+
+    c->start  = head->start;
+    c->end    = head->end;
+    c->id     = sect_str(strs, head->id);
+    c->parent = parent;
+    c->child  = SIMG_NONE;
+    c->next   = SIMG_NONE;
+
+    if (prev != SIMG_NONE)
+      ((struct simg_chunk*)chunks->buf)[prev].next = idx;
+    else
+      first = idx;
+
+    child = compile_chunks(chunks, strs, head->child, idx);
+    ((struct simg_chunk*)chunks->buf)[idx].child = child;
+
+    prev = idx;
+    head = head->next;
+
+  }
+
+  return first;
+
+}
+
+static void stat_source(u8* path, u64* mtime, u64* size, u64* ino) {
+
+  struct stat st;
+
+  if (stat(path, &st)) {
+    *mtime = *size = *ino = 0;
+    return;
+  }
+
+  *mtime = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+  *size  = st.st_size;
+  *ino   = st.st_ino;
+
+}
+
+/* Returns 0 if neither <base>.json nor <base>.track exist. */
+
+static u8 stat_sources(u8* base, struct simg_src* src) {
+
+  u8* path;
+
+  path = alloc_printf("%s.json", base);
+  stat_source(path, &src->json_mtime, &src->json_size, &src->json_ino);
+  ck_free(path);
+
+  path = alloc_printf("%s.track", base);
+  stat_source(path, &src->track_mtime, &src->track_size, &src->track_ino);
+  ck_free(path);
+
+  return src->json_mtime || src->track_mtime;
+
+}
+
+/* Compile tree and track into <base>.simg, recording the state of
+   <base>.json and <base>.track. Failures are not fatal; the image is just
+   a cache and will be rebuilt next time. */
+
+void write_structure_image(u8* base, Chunk* tree, Track* track) {
+
+  struct simg_sect chunks = {0}, enums = {0}, cands = {0}, lengths = {0},
+                   offsets = {0}, strs = {0}, data = {0};
+  struct simg_header h;
+  u8 *fn, *tmp;
+  s32 fd;
+  u32 off;
+
+  memset(&h, 0, sizeof(h));
+
+  h.magic   = SIMG_MAGIC;
+  h.version = SIMG_VERSION;
+
+  if (tree) {
+
+    h.flags |= SIMG_HAS_TREE;
+    compile_chunks(&chunks, &strs, tree, SIMG_NONE);
+
+  }
+
+  if (track) {
+
+    Enum*   e = track->enums;
+    Length* l = track->lengths;
+    Offset* o = track->offsets;
+
+    h.flags |= SIMG_HAS_TRACK;
+
+    while (e) {
+
+      struct simg_enum* se = sect_grab(&enums, sizeof(struct simg_enum));
+      u32 i, num = e->cans_num / 2;
+
+      se->start      = e->start;
+      se->end        = e->end;
+      se->id         = sect_str(&strs, e->id);
+      se->cand_first = cands.len / sizeof(struct simg_cand);
+      se->cand_num   = num;
+
+      /* Only the original byte order is stored, reversed copies are
+         rebuilt on load. */
+
+      for (i = 0; i < num; i++) {
+
+        struct simg_cand* sc = sect_grab(&cands, sizeof(struct simg_cand));
+
+        sc->off = sect_put(&data, CAND_DATA(e, i), CAND_LEN(e, i));
+        sc->len = CAND_LEN(e, i);
+
+      }
+
+      e = e->next;
+
+    }
+
+    while (l) {
+
+      struct simg_length* sl = sect_grab(&lengths, sizeof(struct simg_length));
+
+      sl->start        = l->start;
+      sl->end          = l->end;
+      sl->target_start = l->target_start;
+      sl->target_end   = l->target_end;
+      sl->id           = sect_str(&strs, l->id);
+      sl->target_id    = sect_str(&strs, l->target_id);
+
+      l = l->next;
+
+    }
+
+    while (o) {
+
+      struct simg_offset* so = sect_grab(&offsets, sizeof(struct simg_offset));
+
+      so->start        = o->start;
+      so->end          = o->end;
+      so->target_start = o->target_start;
+      so->target_end   = o->target_end;
+      so->id           = sect_str(&strs, o->id);
+      so->target_id    = sect_str(&strs, o->target_id);
+      so->abs          = o->abs;
+
+      o = o->next;
+
+    }
+
+  }
+
+  h.chunk_cnt  = chunks.len / sizeof(struct simg_chunk);
+  h.enum_cnt   = enums.len / sizeof(struct simg_enum);
+  h.cand_cnt   = cands.len / sizeof(struct simg_cand);
+  h.length_cnt = lengths.len / sizeof(struct simg_length);
+  h.offset_cnt = offsets.len / sizeof(struct simg_offset);
+  h.str_len    = strs.len;
+  h.data_len   = data.len;
+
+  /* All tables consist of u32 fields, so keeping the variable-sized pools
+     at the end is enough to keep everything aligned. */
+
+  off = sizeof(h);
+  h.chunk_off  = off; off += chunks.len;
+  h.enum_off   = off; off += enums.len;
+  h.cand_off   = off; off += cands.len;
+  h.length_off = off; off += lengths.len;
+  h.offset_off = off; off += offsets.len;
+  h.str_off    = off; off += strs.len;
+  h.data_off   = off; off += data.len;
+  h.total_len  = off;
+
+  stat_sources(base, &h.src);
+
+  fn  = alloc_printf("%s.simg", base);
+  tmp = alloc_printf("%s.simg.%u.tmp", base, getpid());
+
+  unlink(tmp); /* Ignore errors */
+
+  fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+  if (fd >= 0) {
+
+    u8 ok = write(fd, &h, sizeof(h)) == sizeof(h) &&
+            write(fd, chunks.buf, chunks.len) == chunks.len &&
+            write(fd, enums.buf, enums.len) == enums.len &&
+            write(fd, cands.buf, cands.len) == cands.len &&
+            write(fd, lengths.buf, lengths.len) == lengths.len &&
+            write(fd, offsets.buf, offsets.len) == offsets.len &&
+            write(fd, strs.buf, strs.len) == strs.len &&
+            write(fd, data.buf, data.len) == data.len;
+
+    close(fd);
+
+    if (!ok || rename(tmp, fn)) unlink(tmp);
+
+  }
+
+  ck_free(fn);
+  ck_free(tmp);
+
+  ck_free(chunks.buf);
+  ck_free(enums.buf);
+  ck_free(cands.buf);
+  ck_free(lengths.buf);
+  ck_free(offsets.buf);
+  ck_free(strs.buf);
+  ck_free(data.buf);
+
+}
+
+/* Sanity checks, so that a truncated or foreign file never turns into an
+   out-of-bounds read. */
+
+static u8 image_ok(struct simg_header* h, u64 file_len) {
+
+  u32 i;
+  u8  ok = 1, *ref = NULL;
+  struct simg_chunk* c;
+
+  if (file_len < sizeof(*h) || h->magic != SIMG_MAGIC ||
+      h->version != SIMG_VERSION || h->total_len != file_len)
+    return 0;
+
+#define SECT_OK(_off, _len) \
+  ((u64)(_off) >= sizeof(*h) && (u64)(_off) + (u64)(_len) <= file_len)
+
+  if (!SECT_OK(h->chunk_off, (u64)h->chunk_cnt * sizeof(struct simg_chunk)) ||
+      !SECT_OK(h->enum_off, (u64)h->enum_cnt * sizeof(struct simg_enum)) ||
+      !SECT_OK(h->cand_off, (u64)h->cand_cnt * sizeof(struct simg_cand)) ||
+      !SECT_OK(h->length_off,
+               (u64)h->length_cnt * sizeof(struct simg_length)) ||
+      !SECT_OK(h->offset_off,
+               (u64)h->offset_cnt * sizeof(struct simg_offset)) ||
+      !SECT_OK(h->str_off, h->str_len) || !SECT_OK(h->data_off, h->data_len))
+    return 0;
+
+#undef SECT_OK
+
+  /* Every table entry carries an id, so anything non-empty must come with
+     a NUL-terminated string pool. */
+
+  if (h->chunk_cnt || h->enum_cnt || h->length_cnt || h->offset_cnt) {
+
+    if (!h->str_len || ((u8*)h)[h->str_off + h->str_len - 1]) return 0;
+
+  }
+
+  c = (struct simg_chunk*)((u8*)h + h->chunk_off);
+
+  /* The chunks are stored in preorder, so every one but the first is
+     somebody's child or next exactly once. A node linked twice would end
+     up freed twice by free_tree(), one never linked would leak. */
+
+  if (h->chunk_cnt) ref = ck_alloc(h->chunk_cnt);
+
+  for (i = 0; i < h->chunk_cnt && ok; i++) {
+
+    if (c[i].id >= h->str_len) ok = 0;
+    if (c[i].parent != SIMG_NONE && c[i].parent >= i) ok = 0;
+    if (c[i].child != SIMG_NONE && c[i].child != i + 1) ok = 0;
+    if (c[i].next != SIMG_NONE && (c[i].next <= i ||
+                                   c[i].next >= h->chunk_cnt))
+      ok = 0;
+
+    if (!ok) break;
+
+    if (c[i].child != SIMG_NONE && ref[c[i].child]++) ok = 0;
+    if (c[i].next != SIMG_NONE && ref[c[i].next]++) ok = 0;
+
+  }
+
+  for (i = 1; i < h->chunk_cnt && ok; i++)
+    if (!ref[i]) ok = 0;
+
+  ck_free(ref);
+
+  return ok;
+
+}
+
+static u8* image_str(struct simg_header* h, u32 off) {
+
+  if (off >= h->str_len) off = h->str_len - 1;
+  return ck_strdup((u8*)h + h->str_off + off);
+
+}
+
+static Chunk* image_to_tree(struct simg_header* h) {
+
+  struct simg_chunk* c = (struct simg_chunk*)((u8*)h + h->chunk_off);
+  Chunk** nodes;
+  Chunk*  head;
+  u32 i;
+
+  if (!h->chunk_cnt) return NULL;
+
+  nodes = ck_alloc(h->chunk_cnt * sizeof(Chunk*));
+
+  for (i = 0; i < h->chunk_cnt; i++) {
+
+    nodes[i] = ck_alloc(sizeof(Chunk));
+    nodes[i]->start = c[i].start;
+    nodes[i]->end   = c[i].end;
+    nodes[i]->id    = image_str(h, c[i].id);
+
+  }
+
+  /* Indices were validated by image_ok(): child / next only point forward
+     and each node is linked from exactly one place, so a single pass is
+     enough to build a proper tree. */
+
+  for (i = 0; i < h->chunk_cnt; i++) {
+
+    if (c[i].parent != SIMG_NONE) nodes[i]->parent = nodes[c[i].parent];
+
+    if (c[i].child != SIMG_NONE) nodes[i]->child = nodes[c[i].child];
+
+    if (c[i].next != SIMG_NONE) {
+      nodes[i]->next = nodes[c[i].next];
+      nodes[c[i].next]->prev = nodes[i];
+    }
+
+  }
+
+  head = nodes[0];
+  ck_free(nodes);
+
+  return head;
+
+}
+
+static void add_pool_value(UniqueSet* set, u8* in_buf, u32 len, u32 start,
+                           u32 end) {
+
+  if (start >= end || end > len) return;
+  set->insert(set, in_buf + start, end - start);
+
+}
+
+static Track* image_to_track(struct simg_header* h, u8* in_buf, u32 len) {
+
+  struct simg_enum*   se = (struct simg_enum*)((u8*)h + h->enum_off);
+  struct simg_cand*   sc = (struct simg_cand*)((u8*)h + h->cand_off);
+  struct simg_length* sl = (struct simg_length*)((u8*)h + h->length_off);
+  struct simg_offset* so = (struct simg_offset*)((u8*)h + h->offset_off);
+  u8* data = (u8*)h + h->data_off;
+
+  Track*  track = ck_alloc(sizeof(Track));
+  Enum*   enum_top = NULL;
+  Length* length_top = NULL;
+  Offset* offset_top = NULL;
+  u32 i, j;
+
+  for (i = 0; i < h->enum_cnt; i++) {
+
+    u32 num = se[i].cand_num;
+    u64 data_len = 0;
+    Enum* e;
+
+    /* An enum with nothing to pick from would only trip up the stages. */
+
+    if (!num || (u64)se[i].cand_first + num > h->cand_cnt) continue;
+
+    for (j = 0; j < num; j++) {
+
+      struct simg_cand* cand = &sc[se[i].cand_first + j];
+
+      if ((u64)cand->off + cand->len <= h->data_len) data_len += cand->len;
+
+    }
+
+    e = alloc_enum(num, data_len);
+
+    e->start = se[i].start;
+    e->end   = se[i].end;
+    e->id    = image_str(h, se[i].id);
+
+    for (j = 0; j < num; j++) {
+
+      struct simg_cand* cand = &sc[se[i].cand_first + j];
+      u32 clen = cand->len;
+
+      if ((u64)cand->off + clen > h->data_len) clen = 0;
+
+      memcpy(enum_candidate(e, j, clen), data + cand->off, clen);
+
+    }
+
+    mirror_candidates(e);
+
+    if (enum_top)
+      enum_top->next = e;
+    else
+      track->enums = e;
+
+    enum_top = e;
+    track->enum_number++;
+
+  }
+
+  for (i = 0; i < h->length_cnt; i++) {
+
+    Length* l = ck_alloc(sizeof(Length));
+
+    l->start        = sl[i].start;
+    l->end          = sl[i].end;
+    l->target_start = sl[i].target_start;
+    l->target_end   = sl[i].target_end;
+    l->id           = image_str(h, sl[i].id);
+    l->target_id    = image_str(h, sl[i].target_id);
+
+    if (length_top)
+      length_top->next = l;
+    else
+      track->lengths = l;
+
+    length_top = l;
+    track->length_number++;
+
+    add_pool_value(length_value_set, in_buf, len, l->start, l->end);
+
+  }
+
+  for (i = 0; i < h->offset_cnt; i++) {
+
+    Offset* o = ck_alloc(sizeof(Offset));
+
+    o->start        = so[i].start;
+    o->end          = so[i].end;
+    o->target_start = so[i].target_start;
+    o->target_end   = so[i].target_end;
+    o->id           = image_str(h, so[i].id);
+    o->target_id    = image_str(h, so[i].target_id);
+    o->abs          = so[i].abs;
+
+    if (offset_top)
+      offset_top->next = o;
+    else
+      track->offsets = o;
+
+    offset_top = o;
+    track->offset_number++;
+
+    add_pool_value(offset_value_set, in_buf, len, o->start, o->end);
+
+  }
+
+  return track;
+
+}
+
+/* Try to load <base>.simg. Returns 0 if there is no usable, up-to-date
+   image, in which case the caller should fall back to JSON. */
+
+static u8 load_structure_image(u8* base, struct simg_src* src, u8* in_buf,
+                               u32 len, Chunk** tree, Track** track) {
+
+  struct simg_header* h;
+  struct stat st;
+  u8* fn;
+  s32 fd;
+
+  fn = alloc_printf("%s.simg", base);
+  fd = open(fn, O_RDONLY);
+  ck_free(fn);
+
+  if (fd < 0) return 0;
+
+  if (fstat(fd, &st) || st.st_size < sizeof(struct simg_header)) {
+    close(fd);
+    return 0;
+  }
+
+  h = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (h == MAP_FAILED) return 0;
+
+  if (!image_ok(h, st.st_size) || memcmp(&h->src, src, sizeof(*src))) {
+
+    munmap(h, st.st_size);
+    return 0;
+
+  }
+
+  *tree  = (h->flags & SIMG_HAS_TREE) ? image_to_tree(h) : NULL;
+  *track = (h->flags & SIMG_HAS_TRACK) ? image_to_track(h, in_buf, len) : NULL;
+
+  munmap(h, st.st_size);
+  return 1;
+
+}
+
+/* LRU of queue entries holding materialized structures. Entries without
+   any structure are remembered too, but do not take a slot. */
+
+static struct queue_entry *lru_head, *lru_tail;
+static u32 lru_cnt;
+
+static void lru_unlink(struct queue_entry* q) {
+
+  if (q->lru_prev) q->lru_prev->lru_next = q->lru_next;
+  else lru_head = q->lru_next;
+
+  if (q->lru_next) q->lru_next->lru_prev = q->lru_prev;
+  else lru_tail = q->lru_prev;
+
+  q->lru_prev = q->lru_next = NULL;
+  lru_cnt--;
+
+}
+
+static void lru_push(struct queue_entry* q) {
+
+  q->lru_prev = NULL;
+  q->lru_next = lru_head;
+
+  if (lru_head) lru_head->lru_prev = q;
+  else lru_tail = q;
+
+  lru_head = q;
+  lru_cnt++;
+
+}
+
+static void drop_cached_structure(struct queue_entry* q) {
+
+  if (!q->struct_cached) return;
+
+  if (q->tree_cache || q->track_cache) lru_unlink(q);
+
+  free_tree(q->tree_cache, True);
+  free_track(q->track_cache);
+  free_chunk_index(q->index_cache);
+
+  q->tree_cache    = NULL;
+  q->track_cache   = NULL;
+  q->index_cache   = NULL;
+  q->struct_cached = 0;
+
+}
+
+static void cache_structure(struct queue_entry* q, Chunk* tree, Track* track,
+                            ChunkIndex* index, u32 stamp) {
+
+  q->tree_cache    = tree;
+  q->track_cache   = track;
+  q->index_cache   = index;
+  q->struct_stamp  = stamp;
+  q->struct_cached = 1;
+
+  if (!tree && !track) return;
+
+  lru_push(q);
+
+  while (lru_cnt > STRUCT_CACHE_ENTRIES && lru_tail != q)
+    drop_cached_structure(lru_tail);
+
+}
+
+/* Parse <base>.json and <base>.track, for when there is no usable image. */
+
+static void parse_sources(u8* base, struct simg_src* src, u8* in_buf,
+                          Chunk** tree, Track** track) {
+
+  cJSON* json;
+  u8* fn;
+
+  *tree  = NULL;
+  *track = NULL;
+
+  if (src->json_mtime) {
+
+    fn = alloc_printf("%s.json", base);
+    json = get_json(fn);
+    ck_free(fn);
+
+    if (json) {
+      *tree = json_to_tree(json);
+      cJSON_Delete(json);
+    }
+
+  }
+
+  if (src->track_mtime) {
+
+    fn = alloc_printf("%s.track", base);
+    *track = json_to_track(get_json(fn), in_buf);
+    ck_free(fn);
+
+  }
+
+}
+
+/* Structure store.
+
+   isi.py infers structure for one output directory at a time, so with
+   several instances on a host, every seed they have in common used to be
+   inferred once per instance. With AFL_STRUCT_STORE pointing to a shared
+   directory, sources inferred by any instance - or by isi.py -s - also go
+   there, named after a hash of the test case contents, and every instance
+   looks there before falling back to the guessed structure in queue/. The
+   image gets compiled next to them by whoever needs it first, and is then
+   just mmap()ed by everyone else. */
+
+static u8* store_base(u8* in_buf, u32 len) {
+
+  return alloc_printf("%s/%016llx-%u", struct_store, hash_fnv64(in_buf, len),
+                      len);
+
+}
+
+/* Copy the sources at base to the store, unless they are there already.
+   Each file shows up in one piece, through rename(). */
+
+static void publish_structure(u8* base, u8* key) {
+
+  static const char* sfx[] = { ".json", ".track" };
+  u8 *src, *dst, *tmp;
+  u32 i;
+
+  for (i = 0; i < 2; i++) {
+
+    src = alloc_printf("%s%s", base, sfx[i]);
+    dst = alloc_printf("%s%s", key, sfx[i]);
+
+    if (!access(src, F_OK) && access(dst, F_OK)) {
+
+      tmp = alloc_printf("%s.%u.tmp", dst, getpid());
+
+      unlink(tmp); /* Ignore errors */
+      link_or_copy(src, tmp);
+      if (rename(tmp, dst)) unlink(tmp);
+
+      ck_free(tmp);
+
+    }
+
+    ck_free(src);
+    ck_free(dst);
+
+  }
+
+}
+
+/* Stamp of the .json / .track files in structure/ and queue/ for a queue
+   entry, for the queue journal to tell if they changed. The .simg is left
+   out, since it only ever follows from these. */
+
+u32 structure_stamp(u8* path) {
+
+  u8* file_name = basename((char*)path);
+  struct simg_src src[2];
+  u8* base;
+
+  memset(src, 0, sizeof(src));
+
+  base = alloc_printf("%s/structure/%s", out_dir, file_name);
+  stat_sources(base, &src[0]);
+  ck_free(base);
+
+  base = alloc_printf("%s/queue/%s", out_dir, file_name);
+  stat_sources(base, &src[1]);
+  ck_free(base);
+
+  return hash32(src, sizeof(src), HASH_CONST);
+
+}
+
+/* Load structure information for a queue entry, preferring the compiled
+   image and compiling it from .json / .track when needed. Sets
+   queue_cur->was_inferred the same way get_structure_json() does, and
+   interns chunk ids into *index. The returned objects belong to the cache
+   and must not be freed by the caller. */
+
+void load_structure(u8* path, u8* in_buf, u32 len, Chunk** tree,
+                    Track** track, ChunkIndex** index) {
+
+  u8* file_name = basename((char*)path);
+  u8* base = alloc_printf("%s/structure/%s", out_dir, file_name);
+  u8* key = NULL;
+  struct simg_src src;
+  u8 inferred;
+  u32 stamp;
+
+  memset(&src, 0, sizeof(src));
+
+  inferred = stat_sources(base, &src);
+
+  if (struct_store) {
+
+    key = store_base(in_buf, len);
+
+    if (!inferred && stat_sources(key, &src)) {
+      ck_free(base);
+      base = key;
+      key = NULL;
+      inferred = 1;
+    }
+
+  }
+
+  if (!inferred) {
+
+    ck_free(base);
+    base = alloc_printf("%s/queue/%s", out_dir, file_name);
+    stat_sources(base, &src);
+
+  }
+
+  queue_cur->was_inferred = inferred;
+
+  /* Re-inference by isi.py changes the stat() data of the sources, or moves
+     them from queue/ to structure/, and so invalidates the cached copy. */
+
+  stamp = hash32(&src, sizeof(src), HASH_CONST + inferred);
+
+  if (queue_cur->struct_cached && queue_cur->struct_stamp == stamp) {
+
+    struct_cache_hits++;
+
+    *tree  = queue_cur->tree_cache;
+    *track = queue_cur->track_cache;
+    *index = queue_cur->index_cache;
+
+    if (*tree || *track) {
+      lru_unlink(queue_cur);
+      lru_push(queue_cur);
+    }
+
+    ck_free(base);
+    ck_free(key);
+    return;
+
+  }
+
+  struct_cache_misses++;
+
+  drop_cached_structure(queue_cur);
+
+  /* Inferred right here; let the other instances have it, too. */
+
+  if (key && inferred) publish_structure(base, key);
+
+  if (!load_structure_image(base, &src, in_buf, len, tree, track)) {
+
+    parse_sources(base, &src, in_buf, tree, track);
+
+    if (*tree || *track) write_structure_image(base, *tree, *track);
+
+  }
+
+  /* Chunk ids are interned once here; the stages only ever deal with
+     dense indices. */
+
+  *index = (*tree || *track) ? index_structure(*tree, *track) : NULL;
+
+  cache_structure(queue_cur, *tree, *track, *index, stamp);
+
+  ck_free(base);
+  ck_free(key);
+
+}
@@ -3,56 +3,6 @@
 #include <string.h>
 #define max3(x, y, z) ((x) > (y) ? ((x) > (z) ? (x) : (z)) : ((y) > (z) ? (y) : (z)))
 
-bool contains(UniqueSet *set, u8 *data, u32 length) {
-  UniqueValue *cur = set->head;
-  while (cur) {
-    if (cur->length == length && memcmp(cur->data, data, length) == 0) {
-      return true;
-    }
-    cur = cur->next;
-  }
-  return false;
-}
-
-// Helper: hex string 출력용
-void print_hex(FILE *fp, unsigned char *data, unsigned int len) {
-    for (unsigned int i = 0; i < len; i++) {
-        fprintf(fp, "%02x", data[i]);
-    }
-}
-
-void insert(UniqueSet *set, u8 *data, u32 length) {
-  if (set->contains(set, data, length)) return;
-
-  UniqueValue *new_val = ck_alloc(sizeof(UniqueValue));
-  new_val->data = ck_alloc(length);
-  memcpy(new_val->data, data, length);
-  new_val->length = length;
-  new_val->next = set->head;
-  set->head = new_val;
-  set->count++;
-}
-
-void init_value_sets() {
-  enum_value_set = ck_alloc(sizeof(UniqueSet));
-  enum_value_set->head = NULL;
-  enum_value_set->insert = insert;
-  enum_value_set->contains = contains;
-  enum_value_set->count = 0;
-
-  length_value_set = ck_alloc(sizeof(UniqueSet));
-  length_value_set->head = NULL;
-  length_value_set->insert = insert;
-  length_value_set->contains = contains;
-  length_value_set->count = 0;
-
-  offset_value_set = ck_alloc(sizeof(UniqueSet));
-  offset_value_set->head = NULL;
-  offset_value_set->insert = insert;
-  offset_value_set->contains = contains;
-  offset_value_set->count = 0;
-}
-
 int32_t get_json_start(const cJSON *chunk) {
   if (cJSON_HasObjectItem(chunk, "start")) {
     return cJSON_GetObjectItemCaseSensitive(chunk, "start")->valueint;
@@ -89,7 +39,7 @@ Chunk *get_tree(cJSON *cjson_head) {
       iter = iter->next;
     }
     root->end = end;
-    root->id = "root";
+    root->id = ck_strdup("root");
     root->cons = NULL;
     root->parent = root->next = root->prev = NULL;
   } else {
@@ -135,50 +85,84 @@ uint8_t *itoh(uint32_t num) {
   return buff;
 }
 
-uint8_t *candidate_reverse(char *str) {
-  uint8_t *delim, *part, *candi, *buffer[1024], *tmp;
-  int32_t num, i;
-  delim = ", ";
-  part = strtok(str, delim);
-  num = 0;
-  while (part != NULL) {
-    buffer[num] = part;
-    num++;
-    part = strtok(NULL, delim);
-  }
-  candi = NULL;
-  if (num > 0) {
-    candi = alloc_printf("%s", buffer[num - 1]);
-    for (i = num - 2; i >= 0; i--) {
-      tmp = candi;
-      candi = alloc_printf("%s, %s", tmp, buffer[i]);
-      ck_free(tmp);
-    }
-  }
-  ck_free(str);
-  return candi;
-}
-
-uint8_t *parse_candidate(uint8_t *str, u32 *len) {
-  uint8_t *delim, *part, *candi, c, buffer[1024];
-  uint32_t num, i;
-  delim = ", ";
-  u8 *tmp = alloc_printf("%s", str);
-  part = strtok(tmp, delim);
-  i = 0;
-  while (part != NULL) {
-    num = htoi(part);
-    c = num;
-    buffer[i] = c;
-    i++;
-    part = strtok(NULL, delim);
-  }
-  candi = ck_alloc(i + 1);
-  *len = i;
-  memcpy(candi, buffer, i);
-  candi[i] = '\0';
-  ck_free(tmp);
-  return candi;
+/* Decode a "AB, CD, ..." candidate string into out, returning the number
+   of bytes. With out == NULL, only counts them. */
+u32 decode_candidate(u8 *str, u8 *out) {
+  u32 n = 0;
+  if (!str) {
+    return 0;
+  }
+  while (*str) {
+    if (!isalnum(*str)) {
+      str++;
+      continue;
+    }
+    if (out) {
+      out[n] = htoi(str);
+    }
+    n++;
+    while (isalnum(*str)) {
+      str++;
+    }
+  }
+  return n;
+}
+
+/* The reverse, for track_to_json(). */
+u8 *candidate_to_hex(u8 *bytes, u32 len) {
+  static const u8 hex[] = "0123456789ABCDEF";
+  u8 *ret, *p;
+  u32 i;
+  ret = p = ck_alloc(len ? len * 4 - 1 : 1);
+  for (i = 0; i < len; i++) {
+    if (i) {
+      *p++ = ',';
+      *p++ = ' ';
+    }
+    *p++ = hex[bytes[i] >> 4];
+    *p++ = hex[bytes[i] & 15];
+  }
+  return ret;
+}
+
+/* Enums keep their candidates decoded, in a single block together with
+   the enum itself. alloc_enum() makes room for num candidates of
+   data_len bytes in total; fill them in order with enum_candidate(), then
+   mirror_candidates() appends the byte-reversed copies. */
+Enum *alloc_enum(u32 num, u32 data_len) {
+  Enum *e = ck_alloc(sizeof(Enum) + (num * 2 + 1) * sizeof(u32) +
+                     data_len * 2);
+  e->cans_num = num * 2;
+  e->cans_data = (u8 *)&e->cans_off[num * 2 + 1];
+  e->chunk_idx = CHUNK_NONE;
+  return e;
+}
+
+u8 *enum_candidate(Enum *e, u32 i, u32 len) {
+  e->cans_off[i + 1] = e->cans_off[i] + len;
+  return CAND_DATA(e, i);
+}
+
+void mirror_candidates(Enum *e) {
+  u32 i, j, num = e->cans_num / 2;
+  for (i = 0; i < num; i++) {
+    u32 len = CAND_LEN(e, i);
+    u8 *src = CAND_DATA(e, i), *dst = enum_candidate(e, num + i, len);
+    for (j = 0; j < len; j++) {
+      dst[j] = src[len - 1 - j];
+    }
+  }
+}
+
+Enum *dup_enum(Enum *e) {
+  u32 size = sizeof(Enum) + (e->cans_num + 1) * sizeof(u32) +
+             e->cans_off[e->cans_num];
+  Enum *ret = ck_alloc(size);
+  memcpy(ret, e, size);
+  ret->cans_data = (u8 *)&ret->cans_off[e->cans_num + 1];
+  ret->id = ck_strdup(e->id);
+  ret->next = NULL;
+  return ret;
 }
 
 cJSON *tree_to_json(Chunk *chunk_head) {
@@ -216,7 +200,10 @@ cJSON *track_to_json(Track *track) {
     cJSON *can_json = cJSON_CreateObject();
     for (u32 i = 0; i < enum_iter->cans_num / 2; i++) {
       u8 *cand_id = alloc_printf("%d", i);
-      cJSON_AddStringToObject(can_json, cand_id, enum_iter->candidates[i]);
+      u8 *cand_hex = candidate_to_hex(CAND_DATA(enum_iter, i),
+                                      CAND_LEN(enum_iter, i));
+      cJSON_AddStringToObject(can_json, cand_id, cand_hex);
+      ck_free(cand_hex);
       ck_free(cand_id);
     }
     cJSON_AddItemToObject(cjson, "candidates", can_json);
@@ -263,15 +250,184 @@ cJSON *track_to_json(Track *track) {
   return json_head;
 }
 
-void tree_add_map(Chunk *head, HashMap map) {
-  Chunk *iter = head;
-  while (iter != NULL) {
-    map->put(map, iter->id, iter);
-    if (iter->child != NULL) {
-      tree_add_map(iter->child, map);
+static u32 count_chunks(Chunk *head) {
+  u32 num = 0;
+  while (head != NULL) {
+    num += 1 + count_chunks(head->child);
+    head = head->next;
+  }
+  return num;
+}
+
+/* Sibling lists are laid out in sibs[] in the order they are first
+   entered, so every list is a contiguous range. */
+static void intern_chunks(Chunk *head, ChunkIndex *index, u32 *sib_cnt) {
+  Chunk *iter;
+  u32 first = *sib_cnt, num = 0, pos = 0;
+  for (iter = head; iter != NULL; iter = iter->next) {
+    num++;
+  }
+  *sib_cnt += num;
+  for (iter = head; iter != NULL; iter = iter->next) {
+    u32 i = index->num++;
+    ChunkNode *node = &index->nodes[i];
+    iter->idx = i;
+    index->chunks[i] = iter;
+    node->sib_first = first;
+    node->sib_num = num;
+    node->sib_pos = pos;
+    index->sibs[first + pos++] = i;
+    intern_chunks(iter->child, index, sib_cnt);
+  }
+}
+
+static void index_track(Track *track, ChunkIndex *index) {
+  Enum *enum_iter;
+  Length *len_iter;
+  Offset *off_iter;
+  u32 i;
+  if (track == NULL) {
+    return;
+  }
+  for (enum_iter = track->enums; enum_iter; enum_iter = enum_iter->next) {
+    index->enum_num++;
+  }
+  for (len_iter = track->lengths; len_iter; len_iter = len_iter->next) {
+    index->length_num++;
+  }
+  for (off_iter = track->offsets; off_iter; off_iter = off_iter->next) {
+    index->offset_num++;
+  }
+  index->enums = ck_alloc(index->enum_num * sizeof(Enum *));
+  index->lengths = ck_alloc(index->length_num * sizeof(Length *));
+  index->offsets = ck_alloc(index->offset_num * sizeof(Offset *));
+  for (i = 0, enum_iter = track->enums; enum_iter; enum_iter = enum_iter->next) {
+    index->enums[i++] = enum_iter;
+  }
+  for (i = 0, len_iter = track->lengths; len_iter; len_iter = len_iter->next) {
+    index->lengths[i++] = len_iter;
+  }
+  for (i = 0, off_iter = track->offsets; off_iter; off_iter = off_iter->next) {
+    index->offsets[i++] = off_iter;
+  }
+}
+
+/* Intern chunk ids below the root and resolve enum ids to chunk indices.
+   The string ids are only looked at here, through a throwaway
+   open-addressing table; if an id shows up twice, the later chunk wins. */
+ChunkIndex *index_structure(Chunk *tree, Track *track) {
+  ChunkIndex *index = ck_alloc(sizeof(ChunkIndex));
+  u32 *slots, mask, num, i, h, sib_cnt = 0;
+  Enum *enum_iter;
+
+  index_track(track, index);
+
+  num = tree ? count_chunks(tree->child) : 0;
+  if (num == 0) {
+    for (enum_iter = track ? track->enums : NULL; enum_iter;
+         enum_iter = enum_iter->next) {
+      enum_iter->chunk_idx = CHUNK_NONE;
     }
-    iter = iter->next;
+    return index;
+  }
+
+  index->chunks = ck_alloc(num * sizeof(Chunk *));
+  index->nodes = ck_alloc(num * sizeof(ChunkNode));
+  index->sibs = ck_alloc(num * sizeof(u32));
+  intern_chunks(tree->child, index, &sib_cnt);
+
+  for (mask = 1; mask < num * 2; mask <<= 1);
+  slots = ck_alloc(mask * sizeof(u32));
+  memset(slots, 0xff, mask * sizeof(u32));
+  mask--;
+
+  for (i = 0; i < num; i++) {
+    u8 *id = index->chunks[i]->id;
+    h = hash_bytes(id, strlen(id), HASH_CONST) & mask;
+    while (slots[h] != CHUNK_NONE &&
+           strcmp(index->chunks[slots[h]]->id, id)) {
+      h = (h + 1) & mask;
+    }
+    slots[h] = i;
+  }
+
+  for (enum_iter = track ? track->enums : NULL; enum_iter;
+       enum_iter = enum_iter->next) {
+    h = hash_bytes(enum_iter->id, strlen(enum_iter->id), HASH_CONST) & mask;
+    while (slots[h] != CHUNK_NONE &&
+           strcmp(index->chunks[slots[h]]->id, enum_iter->id)) {
+      h = (h + 1) & mask;
+    }
+    enum_iter->chunk_idx = slots[h];
+  }
+
+  ck_free(slots);
+  return index;
+}
+
+void free_chunk_index(ChunkIndex *index) {
+  if (index == NULL) {
+    return;
+  }
+  ck_free(index->chunks);
+  ck_free(index->nodes);
+  ck_free(index->sibs);
+  ck_free(index->enums);
+  ck_free(index->lengths);
+  ck_free(index->offsets);
+  ck_free(index);
+}
+
+static u8 is_interned(ChunkIndex *index, Chunk *chunk) {
+  return chunk->idx < index->num && index->chunks[chunk->idx] == chunk;
+}
+
+/* Same distribution as get_random_chunk(head), i.e. uniform over head and
+   the siblings following it, in O(1) for interned chunks. */
+Chunk *index_random_chunk(ChunkIndex *index, Chunk *head) {
+  ChunkNode *node;
+  if (head == NULL) {
+    return NULL;
+  }
+  if (!is_interned(index, head)) {
+    return get_random_chunk(head);
+  }
+  node = &index->nodes[head->idx];
+  return index->chunks[index->sibs[node->sib_first + node->sib_pos +
+                                   UR(node->sib_num - node->sib_pos)]];
+}
+
+/* Uniform over all siblings of chunk, itself included. */
+Chunk *index_random_sibling(ChunkIndex *index, Chunk *chunk) {
+  ChunkNode *node;
+  if (chunk == NULL) {
+    return NULL;
+  }
+  if (!is_interned(index, chunk)) {
+    return get_random_chunk(chunk->parent ? chunk->parent->child : chunk);
+  }
+  node = &index->nodes[chunk->idx];
+  return index->chunks[index->sibs[node->sib_first + UR(node->sib_num)]];
+}
+
+Enum *index_random_enum(ChunkIndex *index) {
+  return index->enum_num ? index->enums[UR(index->enum_num)] : NULL;
+}
+
+Length *index_random_length(ChunkIndex *index) {
+  return index->length_num ? index->lengths[UR(index->length_num)] : NULL;
+}
+
+Offset *index_random_offset(ChunkIndex *index) {
+  return index->offset_num ? index->offsets[UR(index->offset_num)] : NULL;
+}
+
+static Chunk *enum_chunk(Enum *enum_field, ChunkIndex *index) {
+  if (enum_field->chunk_idx == CHUNK_NONE ||
+      enum_field->chunk_idx >= index->num) {
+    return NULL;
   }
+  return index->chunks[enum_field->chunk_idx];
 }
 
 void free_tree(Chunk *head, Boolean recurse) {
@@ -299,11 +455,7 @@ void free_tree(Chunk *head, Boolean recurse) {
 }
 
 void free_enum(Enum *node) {
-  u32 i;
   ck_free(node->id);
-  for (i = 0; i < node->cans_num; i++) {
-    ck_free(node->candidates[i]);
-  }
   ck_free(node);
 }
 
@@ -535,29 +687,6 @@ cJSON *get_structure_json(const u8 *path, const u8 *suffix) {
   return NULL;
 }
 
-cJSON *get_structure_json_for_reusing(const u8 *path, const u8 *suffix) {
-  cJSON *cjson_head;
-  struct stat st;
-  u8 *file_name = basename((char *)path);
-  u8 *structure_file = alloc_printf("/NestFuzzer/tmp/structure/%s%s", file_name, suffix);
-  if (!lstat(structure_file, &st)) {
-    cjson_head = get_json(structure_file);
-    ck_free(structure_file);
-    // queue_cur->was_inferred = 1;
-    return cjson_head;
-  }
-  ck_free(structure_file);
-  structure_file = alloc_printf("/NestFuzzer/tmp/queue/%s%s", file_name, suffix);
-  if (!lstat(structure_file, &st)) {
-    cjson_head = get_json(structure_file);
-    ck_free(structure_file);
-    // queue_cur->was_inferred = 0;
-    return cjson_head;
-  }
-  ck_free(structure_file);
-  return NULL;
-}
-
 Chunk *json_to_tree(cJSON *cjson_head) {
   uint32_t chunk_num = cJSON_GetArraySize(cjson_head);
   Chunk *head, *top, *iter;
@@ -622,7 +751,11 @@ Chunk *parse_struture_file(u8 *path) {
 }
 
 Track *parse_constraint_file(u8 *path, u8 *in_buf) {
-  cJSON *cjson_head = get_structure_json(path, ".track");
+  return json_to_track(get_structure_json(path, ".track"), in_buf);
+}
+
+/* Takes ownership of cjson_head. */
+Track *json_to_track(cJSON *cjson_head, u8 *in_buf) {
   if (cjson_head == NULL) {
     return NULL;
   }
@@ -646,24 +779,30 @@ Track *parse_constraint_file(u8 *path, u8 *in_buf) {
     if (cJSON_HasObjectItem(item, "type")) {
       char *type = cJSON_GetObjectItemCaseSensitive(item, "type")->valuestring;
       if (strcmp(type, "enum") == 0) {
-        u32 cans_num = cJSON_GetObjectItemCaseSensitive(item, "num")->valueint;
-        Enum *enum_chunk =
-            ck_alloc(sizeof(struct Enum) + cans_num * 2 * sizeof(uint8_t *));
+        cJSON *cans_json = cJSON_GetObjectItemCaseSensitive(item, "candidates");
+        u32 cans_num = cJSON_GetArraySize(cans_json), data_len = 0;
+        /* Nothing to pick from; the stages need at least one candidate. */
+        if (!cans_num) continue;
+        for (u32 j = 0; j < cans_num; j++) {
+          data_len += decode_candidate(
+              cJSON_GetStringValue(cJSON_GetArrayItem(cans_json, j)), NULL);
+        }
+        Enum *enum_chunk = alloc_enum(cans_num, data_len);
         enum_chunk->start =
             cJSON_GetObjectItemCaseSensitive(item, "start")->valueint;
         enum_chunk->end =
             cJSON_GetObjectItemCaseSensitive(item, "end")->valueint;
-        enum_chunk->cans_num = cans_num * 2;
         enum_chunk->next = NULL;
         enum_chunk->id = (uint8_t *)ck_alloc(strlen(item->string) + 1);
         strcpy(enum_chunk->id, item->string);
-        cJSON *cans_json = cJSON_GetObjectItemCaseSensitive(item, "candidates");
-        for (u32 j = 0; j < cJSON_GetArraySize(cans_json); j++) {
-          char *candidate =
+        for (u32 j = 0; j < cans_num; j++) {
+          u8 *candidate =
               cJSON_GetStringValue(cJSON_GetArrayItem(cans_json, j));
-          enum_chunk->candidates[j] = ck_alloc(strlen(candidate) + 1);
-          strcpy(enum_chunk->candidates[j], candidate);
+          decode_candidate(candidate,
+                           enum_candidate(enum_chunk, j,
+                                          decode_candidate(candidate, NULL)));
         }
+        mirror_candidates(enum_chunk);
         if (enum_top) {
           enum_top->next = enum_chunk;
           enum_top = enum_chunk;
@@ -700,11 +839,9 @@ Track *parse_constraint_file(u8 *path, u8 *in_buf) {
           track->lengths = length_top = length_chunk;
         }
         track->length_number++;
-        u32 len = length_chunk->end - length_chunk->start;
-        u8 *val = ck_alloc(len);
-        memcpy(val, in_buf + length_chunk->start, len);
-        length_value_set->insert(length_value_set, val, len);
-        ck_free(val);
+        length_value_set->insert(length_value_set,
+                                 in_buf + length_chunk->start,
+                                 length_chunk->end - length_chunk->start);
       }
       if (strcmp(type, "offset") == 0) {
         Offset *offset_chunk = ck_alloc(sizeof(struct Offset));
@@ -728,11 +865,9 @@ Track *parse_constraint_file(u8 *path, u8 *in_buf) {
         } else {
           track->offsets = offset_top = offset_chunk;
         }
-        u32 len = offset_chunk->end - offset_chunk->start;
-        u8 *val = ck_alloc(len);
-        memcpy(val, in_buf + offset_chunk->start, len);
-        offset_value_set->insert(offset_value_set, val, len);
-        ck_free(val);
+        offset_value_set->insert(offset_value_set,
+                                 in_buf + offset_chunk->start,
+                                 offset_chunk->end - offset_chunk->start);
         track->offset_number++;
       }
       if (strcmp(type, "constraint") == 0) {
@@ -741,18 +876,6 @@ Track *parse_constraint_file(u8 *path, u8 *in_buf) {
       continue;
     }
   }
-  enum_top = track->enums;
-  while (enum_top) {
-    num = enum_top->cans_num / 2;
-    for (u32 i = 0; i < num; i++) {
-      enum_top->candidates[i + num] =
-          ck_alloc(strlen(enum_top->candidates[i]) + 1);
-      strcpy(enum_top->candidates[i + num], enum_top->candidates[i]);
-      enum_top->candidates[i + num] =
-          candidate_reverse(enum_top->candidates[i + num]);
-    }
-    enum_top = enum_top->next;
-  }
   cJSON_Delete(cjson_head);
   return track;
 }
@@ -764,26 +887,51 @@ Boolean chunk_overleap(Chunk *chunk1, Chunk *chunk2) {
   return True;
 }
 
-u8 *copy_and_insert(u8 *buf, u32 *len, u32 insert_at, u32 copy_start,
-                    u32 copy_len) {
-  u8 *new_buf;
-  new_buf = ck_alloc(*len + copy_len);
+/* Mutation buffers are plain ck_alloc() buffers whose capacity (ALLOC_S)
+   may exceed the current data length. Growing doubles the capacity and
+   nothing ever shrinks it, so after the first few execs stacked inserts
+   and deletes are just memmove()s within the same block. */
+u8 *reserve_mut_buf(u8 *buf, u32 size) {
+  u32 cap = buf ? ALLOC_S(buf) : 0;
+  if (cap >= size) {
+    return buf;
+  }
+  cap = MAX(size, cap * 2);
+  return ck_realloc(buf, cap);
+}
 
-  memcpy(new_buf, buf, insert_at);
-  memcpy(new_buf + insert_at, buf + copy_start, copy_len);
-  memcpy(new_buf + insert_at + copy_len, buf + insert_at, *len - insert_at);
+/* Open a gap of gap_len bytes at insert_at, moving the tail up. */
+static u8 *open_gap(u8 *buf, u32 *len, u32 insert_at, u32 gap_len) {
+  buf = reserve_mut_buf(buf, *len + gap_len);
+  memmove(buf + insert_at + gap_len, buf + insert_at, *len - insert_at);
+  *len += gap_len;
+  edit_insert(insert_at, gap_len);
+  return buf;
+}
 
-  *len += copy_len;
-  ck_free(buf);
-  return new_buf;
+u8 *copy_and_insert(u8 *buf, u32 *len, u32 insert_at, u32 copy_start,
+                    u32 copy_len) {
+  u32 head;
+  buf = open_gap(buf, len, insert_at, copy_len);
+
+  /* The source may have moved up with the tail, or straddle the gap. */
+  if (copy_start >= insert_at) {
+    memmove(buf + insert_at, buf + copy_start + copy_len, copy_len);
+  } else if (copy_start + copy_len <= insert_at) {
+    memmove(buf + insert_at, buf + copy_start, copy_len);
+  } else {
+    head = insert_at - copy_start;
+    memmove(buf + insert_at, buf + copy_start, head);
+    memmove(buf + insert_at + head, buf + insert_at + copy_len,
+            copy_len - head);
+  }
+  return buf;
 }
 
-u8 *insert_chunk(u8 *buf, u32 *len, HashMap map, u8 *insert_id, u8 *copy_id,
+u8 *insert_chunk(u8 *buf, u32 *len, Chunk *chunk_insert, Chunk *chunk_copy,
                  Boolean after) {
   uint8_t *new_buf;
   uint32_t insert_at;
-  Chunk *chunk_insert = map->get(map, insert_id);
-  Chunk *chunk_copy = map->get(map, copy_id);
   // if(chunk_copy->end - chunk_copy->start > *len / 4 && UR(100) < 75) {
   //   return buf;
   // }
@@ -800,18 +948,14 @@ u8 *insert_chunk(u8 *buf, u32 *len, HashMap map, u8 *insert_id, u8 *copy_id,
 }
 
 u8 *delete_data(u8 *buf, u32 *len, u32 delete_start, u32 delete_len) {
-  u8 *new_buf;
-  new_buf = ck_alloc(*len - delete_len);
-  memcpy(new_buf, buf, delete_start);
-  memcpy(new_buf + delete_start, buf + delete_start + delete_len,
-         *len - delete_start - delete_len);
+  memmove(buf + delete_start, buf + delete_start + delete_len,
+          *len - delete_start - delete_len);
   *len -= delete_len;
-  ck_free(buf);
-  return new_buf;
+  edit_delete(delete_start, delete_len);
+  return buf;
 }
 
-u8 *delete_chunk(u8 *buf, u32 *len, HashMap map, u8 *id) {
-  Chunk *chunk_delete = map->get(map, id);
+u8 *delete_chunk(u8 *buf, u32 *len, Chunk *chunk_delete) {
   if (chunk_delete == NULL || chunk_delete->start > *len ||
       chunk_delete->end > *len) {
     return buf;
@@ -823,25 +967,21 @@ u8 *delete_chunk(u8 *buf, u32 *len, HashMap map, u8 *id) {
                      chunk_delete->end - chunk_delete->start);
 }
 
-void get_exchange_chunks(uint32_t chunk_num, uint8_t **all_chunks, HashMap map,
-                         Chunk **chunks) {
-  uint32_t index1 = UR(chunk_num);
-  // uint32_t index2 = UR(chunk_num);
+void get_exchange_chunks(ChunkIndex *index, Chunk **chunks) {
   Chunk *chunk_left, *chunk_right, *temp;
-  chunk_left = map->get(map, all_chunks[index1]);
-  // chunk_right = map->get(map, all_chunks[index2]);
+  chunk_left = index->chunks[UR(index->num)];
   if (chunk_left == NULL) {
     return;
   }
   // if (chunk_left->parent == NULL) {
   //   return;
   // }
-  chunk_left = get_random_chunk(chunk_left->parent->child);
-  chunk_right = get_random_chunk(chunk_left->parent->child);
+  chunk_left = index_random_sibling(index, chunk_left);
+  chunk_right = index_random_sibling(index, chunk_left);
   if (chunk_overleap(chunk_left, chunk_right)) {
     return;
   }
-  if (strcmp(chunk_left->id, chunk_right->id) == 0) {
+  if (chunk_left->idx == chunk_right->idx) {
     return;
   }
   if (chunk_left->end >= chunk_right->end) {
@@ -855,32 +995,38 @@ void get_exchange_chunks(uint32_t chunk_num, uint8_t **all_chunks, HashMap map,
 
 uint8_t *exchange_chunk(uint8_t *buf, uint32_t len, Chunk *chunk_left,
                         Chunk *chunk_right) {
-  uint8_t *new_buf;
+  static u8 *scratch;
+  u32 span, right_len, mid_len;
   if (chunk_left == NULL || chunk_left->parent == NULL) {
     return buf;
   }
   if (chunk_left->start > len || chunk_left->end > len ||
-      chunk_right->start > len || chunk_right->end > len) {
-    return buf;
-  }
-  new_buf = ck_alloc(len);
-  memcpy(new_buf, buf, chunk_left->start);
-  memcpy(new_buf + chunk_left->start, buf + chunk_right->start,
-         chunk_right->end - chunk_right->start);
-  memcpy(new_buf + chunk_left->start + chunk_right->end - chunk_right->start,
-         buf + chunk_left->end, chunk_right->start - chunk_left->end);
-  memcpy(new_buf + chunk_left->start + chunk_right->end - chunk_left->end,
-         buf + chunk_left->start, chunk_left->end - chunk_left->start);
-  memcpy(new_buf + chunk_right->end, buf + chunk_right->end,
-         len - chunk_right->end);
-  ck_free(buf);
-  return new_buf;
+      chunk_right->start > len || chunk_right->end > len ||
+      chunk_left->end > chunk_right->start) {
+    return buf;
+  }
+
+  /* Only [left start, right end) changes; stash it and lay it out again
+     as right chunk, the bytes in between, left chunk. */
+  span = chunk_right->end - chunk_left->start;
+  right_len = chunk_right->end - chunk_right->start;
+  mid_len = chunk_right->start - chunk_left->end;
+  scratch = reserve_mut_buf(scratch, span);
+  memcpy(scratch, buf + chunk_left->start, span);
+  memcpy(buf + chunk_left->start,
+         scratch + chunk_right->start - chunk_left->start, right_len);
+  memcpy(buf + chunk_left->start + right_len,
+         scratch + chunk_left->end - chunk_left->start, mid_len);
+  memcpy(buf + chunk_left->start + right_len + mid_len, scratch,
+         chunk_left->end - chunk_left->start);
+  edit_swap(chunk_left->start, chunk_left->end, chunk_right->start,
+            chunk_right->end);
+  return buf;
 }
 
 void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
-                        Track *track) {
-  u8 **all_chunks;
-  u32 chunk_num = 0, out_len;
+                        Track *track, ChunkIndex *index) {
+  u32 out_len;
   u32 stage_max, stage_cur, i, perf_score = 100;
   u64 orig_hit_cnt, new_hit_cnt, struct_havoc_queued;
   u8 *out_buf;
@@ -890,15 +1036,7 @@ void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
   out_len = len;
   out_buf = ck_alloc(len);
   memcpy(out_buf, buf, len);
-  HashMap map = createHashMap(NULL, NULL);
-  tree_add_map(tree->child, map);
-  all_chunks = ck_alloc(map->size * sizeof(u8 *));
-  HashMapIterator map_iter = createHashMapIterator(map);
-  while (hasNextHashMapIterator(map_iter)) {
-    map_iter = nextHashMapIterator(map_iter);
-    all_chunks[chunk_num] = map_iter->entry->key;
-    chunk_num++;
-  }
+  edit_reset();
 
   perf_score = calculate_score(queue_cur);
 
@@ -914,44 +1052,46 @@ void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
   struct_havoc_queued = queued_paths;
   for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
       u32 use_stacking = 1 << (1 + UR(HAVOC_STACK_POW2));
+      u32 ops[1 << HAVOC_STACK_POW2];
+      rand_fill(ops, use_stacking, 3 + ((track == NULL) ? 0 : 14));
       for (i = 0; i < use_stacking; i++) {
       u32 num;
-      num = UR(3 + ((track == NULL) ? 0 : 14));
+      num = ops[i];
       //SAYF("#Before mutate num is %d, out_len is %d\n", num, out_len);
       switch (num) {
         case 0: {
           /* Randomly copy one chunk and insert before/after random chunk */
-          out_buf = insert_chunk_mutator(out_buf, &out_len, map, all_chunks, chunk_num);
+          out_buf = insert_chunk_mutator(out_buf, &out_len, index);
           break;
         };
         case 1: {
           /* Randomly delete one chunk */
-          out_buf = delete_chunk_mutator(out_buf, &out_len, map, all_chunks, chunk_num);
+          out_buf = delete_chunk_mutator(out_buf, &out_len, index);
           break;
         };
         case 2: {
           /* Randomly exchange two chunks */
-          out_buf = exchange_chunk_mutator(out_buf, &out_len, map, all_chunks, chunk_num);
+          out_buf = exchange_chunk_mutator(out_buf, &out_len, index);
           break;
         }
         case 3: {
-          enum_field = get_random_enum(track->enums);
-          out_buf = enum_insert_mutator(out_buf, &out_len, enum_field, map);
+          enum_field = index_random_enum(index);
+          out_buf = enum_insert_mutator(out_buf, &out_len, enum_field, index);
         }
         case 4: {
-          enum_field = get_random_enum(track->enums);
-          out_buf = enum_delete_mutator(out_buf, &out_len, enum_field, map);
+          enum_field = index_random_enum(index);
+          out_buf = enum_delete_mutator(out_buf, &out_len, enum_field, index);
         }
         case 5: {
-          enum_field = get_random_enum(track->enums);
-          out_buf = enum_exchange_mutator(out_buf, &out_len, enum_field, map);
+          enum_field = index_random_enum(index);
+          out_buf = enum_exchange_mutator(out_buf, &out_len, enum_field, index);
         }
         case 6: {
-          out_buf = high_order_structure_mutator(out_buf, &out_len, map, tree);
+          out_buf = high_order_structure_mutator(out_buf, &out_len, tree, index);
         }
         case 7: {
           /* Randomly replace one enum field to a legal candidate */
-          enum_field = get_random_enum(track->enums);
+          enum_field = index_random_enum(index);
           if(enum_field == NULL) {
             break;
           }
@@ -960,27 +1100,27 @@ void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
         }
         case 8: {
           /* Randomly add to length field, random endian */
-          len_field = get_random_length(track->lengths);
+          len_field = index_random_length(index);
           out_buf = increase_len_mutator(out_buf, out_len, len_field, UR(out_len));
         }
         case 9: {
           /* Randomly add to offset field, random endian */
-          offset_field = get_random_offset(track->offsets);
+          offset_field = index_random_offset(index);
           out_buf = increase_offset_mutator(out_buf, out_len, offset_field, UR(out_len));
         }
         case 10: {
           /* Randomly subtract to length field, random endian */
-          len_field = get_random_length(track->lengths);
+          len_field = index_random_length(index);
           out_buf = decrease_len_mutator(out_buf, out_len, len_field, UR(out_len));
         }
         case 11: {
           /* Randomly subtract to offset field, random endian */
-          offset_field = get_random_offset(track->offsets);
+          offset_field = index_random_offset(index);
           out_buf = decrease_offset_mutator(out_buf, out_len, offset_field, UR(out_len));
         }
         case 12: {
           /* Randomly set length to interesting value, random endian */
-          len_field = get_random_length(track->lengths);
+          len_field = index_random_length(index);
           if(len_field == NULL) {
             break;
           }
@@ -1000,7 +1140,7 @@ void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
         }
         case 13: {
           /* Randomly set offset to interesting value, random endian */
-          offset_field = get_random_offset(track->offsets);
+          offset_field = index_random_offset(index);
           if(offset_field == NULL) {
             break;
           }
@@ -1020,25 +1160,25 @@ void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
         }
         case 14: {
           /* Randomly insert data to length payloads */
-          len_field = get_random_length(track->lengths);
+          len_field = index_random_length(index);
           out_buf = insert_len_payload_mutator(out_buf, &out_len, len_field);
           break;
         }
         case 15: {
           /* Randomly insert data to offset payloads */
-          offset_field = get_random_offset(track->offsets);
+          offset_field = index_random_offset(index);
           out_buf = insert_offset_payload_mutator(out_buf, &out_len, offset_field);
           break;
         }
         case 16: {
           /* Randomly delete data from offset payloads */
-          len_field = get_random_length(track->lengths);
+          len_field = index_random_length(index);
           out_buf = delete_len_payload_mutator(out_buf, &out_len, len_field);
           break;
         }
         case 17: {
           /* Randomly delete data from offset payloads */
-          offset_field = get_random_offset(track->offsets);
+          offset_field = index_random_offset(index);
           out_buf = delete_offset_payload_mutator(out_buf, &out_len, offset_field);
           break;
         }
@@ -1046,14 +1186,13 @@ void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       //SAYF("#After mutate num is %d, out_len is %d\n", num, out_len);
     }
 
-    if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+    if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
       goto exit_struct_havoc_stage;
 
-    if (out_len < len) {
-      out_buf = ck_realloc(out_buf, len);
-    }
+    out_buf = reserve_mut_buf(out_buf, len);
     out_len = len;
     memcpy(out_buf, buf, len);
+    edit_reset();
 
     if (queued_paths != struct_havoc_queued) {
       if (perf_score <= HAVOC_MAX_MULT * 100) {
@@ -1065,19 +1204,39 @@ void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
     }
   }
 
+  if (flush_batch(argv)) goto exit_struct_havoc_stage;
+
   new_hit_cnt = queued_paths + unique_crashes;
   stage_finds[STAGE_STRUCT_DESCRIB] += new_hit_cnt - orig_hit_cnt;
   stage_cycles[STAGE_STRUCT_DESCRIB] += stage_max;
 
 exit_struct_havoc_stage:
 
-  freeHashMapIterator(&map_iter);
-  map->clear(map);
-  free(map);
-  ck_free(all_chunks);
   ck_free(out_buf);
 }
 
+/* With AFL_REUSING_SPILL, keep a copy of the last REUSING_SPILL_MAX reusing
+   candidates in <out_dir>/reusing/ for inspection. */
+
+static void spill_reusing_candidate(u8 *mem, u32 len) {
+
+  static u32 spill_cnt;
+  u8 *fn;
+  s32 fd;
+
+  fn = alloc_printf("%s/reusing/cand_%06u", out_dir,
+                    spill_cnt % REUSING_SPILL_MAX);
+  spill_cnt++;
+
+  fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+  ck_write(fd, mem, len, fn);
+  close(fd);
+
+  ck_free(fn);
+
+}
+
 void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree, Track *track){
   if (track == NULL) {
     return;
@@ -1137,10 +1296,35 @@ void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree, Track *track){
   uint64_t max_iteration;
   max_iteration = max3(track->enum_number, track->length_number, track->offset_number);
 
-  out_len = len;
+  /* Candidates are built, fixed up and executed in memory. A candidate is
+     the input with some enum values replaced by other candidates; these
+     keep their size, so the length fields of the input still describe it
+     and are fixed up directly rather than waiting for its structure to be
+     inferred again. */
+
+  u32 cand_num = MIN(max_iteration, REUSING_CANDIDATES);
+  u32 rounds = MIN(max_iteration, REUSING_ROUNDS);
+  u32 cand_cksum[REUSING_CANDIDATES], cand_cnt = 0, fix_num = 0, k;
+  u8 *cand;
+  Length *fix_orig, *fix;
+
+  for (length_iter = track->lengths; length_iter; length_iter = length_iter->next) {
+    fix_num++;
+  }
+  fix_orig = ck_alloc(fix_num * sizeof(Length));
+  fix = ck_alloc(fix_num * sizeof(Length));
+  k = 0;
+  for (length_iter = track->lengths; length_iter; length_iter = length_iter->next) {
+    fix_orig[k++] = *length_iter;
+  }
+
+  stage_cur = 0;
+  stage_max = cand_num * rounds;
+
+  cand = ck_alloc(len);
   out_buf = ck_alloc(len);
-  for(int i=0;i<max_iteration;i++){
-    memcpy(out_buf, buf, len);
+  for (u32 i = 0; i < cand_num; i++) {
+    memcpy(cand, buf, len);
 
     //enum replacing
     enum_iter = track->enums;
@@ -1161,16 +1345,14 @@ void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree, Track *track){
       //choose candidate randomly
       u32 index = UR(enum_iter->cans_num);
       stage_cur_byte = enum_iter->start;
-      last_len=0;
-      candi_str = parse_candidate(enum_iter->candidates[index], &last_len);
+      last_len = CAND_LEN(enum_iter, index);
+      candi_str = CAND_DATA(enum_iter, index);
 
-      if (stage_cur_byte < 0 || stage_cur_byte > out_len || (stage_cur_byte + last_len) > out_len) {
-        ck_free(candi_str);
+      if (stage_cur_byte < 0 || stage_cur_byte > len || (stage_cur_byte + last_len) > len) {
         enum_iter = enum_iter->next;
         continue;
       }
       if ((enum_iter->end - enum_iter->start) < last_len) {
-        ck_free(candi_str);
         enum_iter = enum_iter->next;
         continue;
       }
@@ -1182,147 +1364,36 @@ void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree, Track *track){
       //   candi_str[last_len - 1 - j] = tmp;
       // }
 
-      memcpy(out_buf + stage_cur_byte, candi_str, last_len);
+      memcpy(cand + stage_cur_byte, candi_str, last_len);
 
-      ck_free(candi_str);
       enum_iter = enum_iter->next;
     }
 
-    s32 fd;
-    u8* temp_fn = alloc_printf("/NestFuzzer/tmp/queue/%06u_%d", current_entry,i);
-    fd = open(temp_fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-    if (fd < 0){
-      ck_free(temp_fn);
-      continue;
-    }
-    ck_write(fd, out_buf, len, temp_fn);
-    close(fd);
-    ck_free(temp_fn);
-  }
-  ck_free(out_buf);
-
-  DIR *dir;
-  struct dirent *entry;
-
-  dir = opendir("/NestFuzzer/tmp/queue");
-  if (!dir) {
-    PFATAL("Unable open directory '/NestFuzzer/tmp/queue'");
-  }
+    /* Identical candidates only waste executions. */
 
-  while ((entry = readdir(dir)) != NULL) {
-    // Skip '.' and '..' entries
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+    u32 cksum = hash_bytes(cand, len, HASH_CONST), c;
+    for (c = 0; c < cand_cnt && cand_cksum[c] != cksum; c++);
+    if (c < cand_cnt) {
+      stage_max -= rounds;
       continue;
-
-    cJSON *cjson_head = get_structure_json_for_reusing(entry->d_name, ".track");
-    if (cjson_head == NULL) continue;
-    u32 num;
-    num = cJSON_GetArraySize(cjson_head);
-    Track *temp_track;
-    Offset *offset_top = NULL;
-    Length *length_top = NULL;
-    temp_track = ck_alloc(sizeof(struct Track));
-    temp_track->constraints = NULL;
-    temp_track->lengths = NULL;
-    temp_track->offsets = NULL;
-    temp_track->enums = NULL;
-    temp_track->enum_number = 0;
-    temp_track->length_number = 0;
-    temp_track->offset_number = 0;
-    for (u32 i = 0; i < num; i++) {
-      cJSON *item = cJSON_GetArrayItem(cjson_head, i);
-      if (cJSON_HasObjectItem(item, "type")) {
-        char *type = cJSON_GetObjectItemCaseSensitive(item, "type")->valuestring;
-
-        if (strcmp(type, "length") == 0) {
-          Length *length_chunk = ck_alloc(sizeof(struct Length));
-          length_chunk->start =
-              cJSON_GetObjectItemCaseSensitive(item, "start")->valueint;
-          length_chunk->end =
-              cJSON_GetObjectItemCaseSensitive(item, "end")->valueint;
-          length_chunk->id = (uint8_t *)ck_alloc(strlen(item->string) + 1);
-          strcpy(length_chunk->id, item->string);
-          cJSON *target = cJSON_GetArrayItem(item, cJSON_GetArraySize(item) - 1);
-          length_chunk->target_start =
-              cJSON_GetObjectItemCaseSensitive(target, "start")->valueint;
-          length_chunk->target_end =
-              cJSON_GetObjectItemCaseSensitive(target, "end")->valueint;
-          length_chunk->target_id = (uint8_t *)ck_alloc(strlen(target->string) + 1);
-          strcpy(length_chunk->target_id, target->string);
-          length_chunk->next = NULL;
-          if (length_top) {
-            length_top->next = length_chunk;
-            length_top = length_chunk;
-          } else {
-            temp_track->lengths = length_top = length_chunk;
-          }
-          temp_track->length_number++;
-        }
-
-        if (strcmp(type, "offset") == 0) {
-          Offset *offset_chunk = ck_alloc(sizeof(struct Offset));
-          offset_chunk->start =
-              cJSON_GetObjectItemCaseSensitive(item, "start")->valueint;
-          offset_chunk->end =
-              cJSON_GetObjectItemCaseSensitive(item, "end")->valueint;
-          offset_chunk->id = (uint8_t *)ck_alloc(strlen(item->string) + 1);
-          strcpy(offset_chunk->id, item->string);
-          cJSON *target = cJSON_GetArrayItem(item, cJSON_GetArraySize(item) - 1);
-          offset_chunk->target_start =
-              cJSON_GetObjectItemCaseSensitive(target, "start")->valueint;
-          offset_chunk->target_end =
-              cJSON_GetObjectItemCaseSensitive(target, "end")->valueint;
-          offset_chunk->target_id = (uint8_t *)ck_alloc(strlen(target->string) + 1);
-          strcpy(offset_chunk->target_id, target->string);
-          offset_chunk->next = NULL;
-          if (offset_top) {
-            offset_top->next = offset_chunk;
-            offset_top = offset_chunk;
-          } else {
-            temp_track->offsets = offset_top = offset_chunk;
-          }
-          temp_track->offset_number++;
-        }
-      }
-      else continue;
     }
+    cand_cksum[cand_cnt++] = cksum;
 
-    struct stat st;
-    u8* temp_fn = alloc_printf("/NestFuzzer/tmp/queue/%s", entry->d_name);
-    s32 fd = open(temp_fn, O_RDONLY);
-    if (fd < 0) PFATAL("Unable to open '%s'", temp_fn);
+    if (reusing_spill) spill_reusing_candidate(cand, len);
 
-    if (lstat(temp_fn, &st) || access(temp_fn, R_OK)) PFATAL("Unable to access '%s'", temp_fn);
-    u8* temp_buf;
-    u32 temp_buf_len;
-    temp_buf_len = st.st_size;
-    temp_buf = ck_alloc(temp_buf_len);
-    ssize_t bytes_read = read(fd, temp_buf, temp_buf_len);
-    if (bytes_read != temp_buf_len) {
-      PFATAL("Reusing: out_buf error");
-    }
-    close(fd);
+    for (u32 r = 0; r < rounds; r++) {
+      out_buf = reserve_mut_buf(out_buf, len);
+      out_len = len;
+      memcpy(out_buf, cand, len);
+      edit_reset();
+      memcpy(fix, fix_orig, fix_num * sizeof(Length));
 
-    for(int i=0;i<max_iteration;i++){
-      out_len = temp_buf_len;
-      out_buf = ck_alloc(out_len);
-      memcpy(out_buf,temp_buf,out_len);
-      
-      length_iter = temp_track->lengths;
-      while(length_iter != NULL) {
-        // u8* length_fn;
-        // s32 length_fd;
-        // length_fn = alloc_printf("/NestFuzzer/tmp/structure/%s_length",entry->d_name);
-        // length_fd = open(length_fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-        // if (length_fd < 0) PFATAL("Unable to create '%s'", length_fn);
-
-        // FILE *fp = fopen("/NestFuzzer/length_log.txt", "w");
+      for (k = 0; k < fix_num; k++) {
+        length_iter = &fix[k];
         uint32_t meta_len, payload_len;
-        uint32_t start;
         meta_len = payload_len = 0;
 
         if (length_iter->start > out_len || length_iter->end > out_len || length_iter->target_start > out_len || length_iter->target_end > out_len) {
-          length_iter = length_iter->next;
           continue;
         }
 
@@ -1330,27 +1401,19 @@ void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree, Track *track){
         payload_len = length_iter->target_end - length_iter->target_start;
 
         if (meta_len != 1 && meta_len != 2 && meta_len != 4) {
-          length_iter = length_iter->next;
           continue;
         }
         if (length_iter->start + meta_len > out_len) {
-          length_iter = length_iter->next;
           continue;
         }
 
         if(length_threshold > 1 && UR(length_threshold) != 0) {
-          length_iter = length_iter->next;
           continue;
         }
 
-        u32 index = UR(length_value_set->count);
-        UniqueValue *cur = length_value_set->head;
-        for (u32 i = 0; i < index && cur != NULL; i++) {
-          cur = cur->next;
-        }
+        UniqueValue *cur = pool_random_len(length_value_set, meta_len);
 
-        if (!cur || cur->length != meta_len) {
-          length_iter = length_iter->next;
+        if (!cur) {
           continue; 
         }
 
@@ -1421,8 +1484,8 @@ void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree, Track *track){
           }
         }
         s32 delta = (s32)new_len_value - (s32)payload_len;
-        Length *temp_length_iter = length_iter->next;
-        while(temp_length_iter!=NULL){
+        for (u32 m = k + 1; m < fix_num; m++) {
+          Length *temp_length_iter = &fix[m];
           //length field의 위치 조정
           if(temp_length_iter->start > length_iter->target_end){
             temp_length_iter->start += delta;
@@ -1432,49 +1495,21 @@ void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree, Track *track){
             temp_length_iter->target_start += delta;
             temp_length_iter->target_end += delta;
           }
-          temp_length_iter = temp_length_iter->next;
         }
-        length_iter = length_iter->next;
-
-        // u8* length_fn = alloc_printf("/NestFuzzer/tmp/structure/%s_length",entry->d_name);
-        // s32 length_fd = open(length_fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-        // if (length_fd < 0) PFATAL("Unable to create '%s'", length_fn);
-        // ck_write(length_fd, out_buf, strlen(out_buf), length_fn);
-        // s32 res = write(length_fd, out_buf, out_len);
-        // if (res != out_len) {
-        //   PFATAL("Short write to %s (wrote %d of %d bytes)", length_fn, res, out_len);
-        // }
-        // close(length_fd);
-        // ck_free(length_fn);
-
-        // if (fp) {
-        //   fclose(fp);
-        // }
       }
 
-      // offset_iter = temp_track->offsets;
-      // while(offset_iter != NULL){
-      //   offset_iter = offset_iter->next;
-      // }
-    
-      common_fuzz_stuff_for_reusing(argv, out_buf, out_len, tree, track);
-      ck_free(out_buf);
+      if (common_fuzz_stuff_for_reusing(argv, out_buf, out_len, tree, track))
+        goto exit_reusing_stage;
+      stage_cur++;
     }
-
-    u8* temp_track_fn = alloc_printf("/NestFuzzer/tmp/structure/%s.track",entry->d_name);
-    u8* temp_json_fn = alloc_printf("/NestFuzzer/tmp/structure/%s.json",entry->d_name);
-    remove(temp_fn);
-    remove(temp_track_fn);
-    remove(temp_json_fn);
-    ck_free(temp_fn);
-    ck_free(temp_track_fn);
-    ck_free(temp_json_fn);
-
-    cJSON_Delete(cjson_head);
-    free_track(temp_track);
   }
 
-  closedir(dir);
+exit_reusing_stage:
+
+  ck_free(cand);
+  ck_free(out_buf);
+  ck_free(fix_orig);
+  ck_free(fix);
   // for(int i=0;i<max_iteration;i++){
     /*mutation offset*/
     // offset_iter = track->offsets;
@@ -1556,7 +1591,7 @@ void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree, Track *track){
 }
 
 void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
-                            Track *track) {
+                            Track *track, ChunkIndex *index) {
   if (track == NULL) {
     return;
   }
@@ -1569,11 +1604,10 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
   Offset *offset_iter;
   Constraint *cons_iter;
   u64 orig_hit_cnt, new_hit_cnt;
-  HashMap map = createHashMap(NULL, NULL);
   out_len = len;
   out_buf = ck_alloc(len);
   memcpy(out_buf, buf, len);
-  tree_add_map(tree->child, map);
+  edit_reset();
   stage_name = "describing aware";
   stage_short = "chunkFuzzer2";
   orig_hit_cnt = queued_paths + unique_crashes;
@@ -1600,8 +1634,8 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
     }
     u32 last_len = 0, stage_cur_byte;
     for (i = 0; i < enum_iter->cans_num; i++) {
-      last_len = 0;
-      u8 *candi_str = parse_candidate(enum_iter->candidates[i], &last_len);
+      last_len = CAND_LEN(enum_iter, i);
+      u8 *candi_str = CAND_DATA(enum_iter, i);
       stage_cur_byte = enum_iter->start;
       if (stage_cur_byte < 0 || stage_cur_byte > out_len ||
           (stage_cur_byte + last_len) > out_len) {
@@ -1614,35 +1648,33 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       memcpy(out_buf + stage_cur_byte, candi_str, last_len);
 
       /*save testcase if interesting */
-      if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+      if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
         goto exit_describing_aware_stage;
 
       /* Restore all the clobbered memory */
       memcpy(out_buf + stage_cur_byte, buf + stage_cur_byte, last_len);
 
-      ck_free(candi_str);
       stage_max++;
     }
     if (UR(enum_iter->cans_num) <= enum_iter->cans_num / 2) {
       for(i = 0; i < enum_iter->cans_num / 2; i++) {
         switch(UR(3)) {
           case 0: {
-            out_buf = enum_insert_mutator(out_buf, &out_len, enum_iter, map);
+            out_buf = enum_insert_mutator(out_buf, &out_len, enum_iter, index);
           }
           case 1: {
-            out_buf = enum_delete_mutator(out_buf, &out_len, enum_iter, map);
+            out_buf = enum_delete_mutator(out_buf, &out_len, enum_iter, index);
           }
           case 2: {
-            out_buf = enum_exchange_mutator(out_buf, &out_len, enum_iter, map);
+            out_buf = enum_exchange_mutator(out_buf, &out_len, enum_iter, index);
           }
         }
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
-        if (out_len < len) {
-          out_buf = ck_realloc(out_buf, len);
-        }
+        out_buf = reserve_mut_buf(out_buf, len);
         out_len = len;
         memcpy(out_buf, buf, len);
+        edit_reset();
       }
     }
     enum_iter = enum_iter->next;
@@ -1683,15 +1715,14 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
           copy_and_insert(out_buf, &out_len, length_iter->target_end, start, i);
 
       /* save testcase if interesting */
-      if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+      if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
         goto exit_describing_aware_stage;
 
       /* Recover all the clobbered stucture */
-      if (out_len < len) {
-        out_buf = ck_realloc(out_buf, len);
-      }
+      out_buf = reserve_mut_buf(out_buf, len);
       out_len = len;
       memcpy(out_buf, buf, len);
+      edit_reset();
       stage_max++;
     }
 
@@ -1702,15 +1733,14 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       out_buf = delete_data(out_buf, &out_len, length_iter->target_start, i);
 
       /* save testcase if interesting */
-      if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+      if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
         goto exit_describing_aware_stage;
 
       /* Recover all the clobbered stucture */
-      if (out_len < len) {
-        out_buf = ck_realloc(out_buf, len);
-      }
+      out_buf = reserve_mut_buf(out_buf, len);
       out_len = len;
       memcpy(out_buf, buf, len);
+      edit_reset();
       stage_max++;
     }
 
@@ -1720,7 +1750,7 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       u8 orig = out_buf[index];
       for (i = 0; i < sizeof(interesting_8); i++) {
         out_buf[index] = interesting_8[i];
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
       }
@@ -1729,11 +1759,11 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       u16 orig = *(u16 *)(out_buf + index);
       for (i = 0; i < sizeof(interesting_16) / 2; i++) {
         *(u16 *)(out_buf + index) = interesting_16[i];
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
         *(u16 *)(out_buf + index) = SWAP16(interesting_16[i]);
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
       }
@@ -1742,11 +1772,11 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       u32 orig = *(u32 *)(out_buf + index);
       for (i = 0; i < sizeof(interesting_32) / 4; i++) {
         *(u32 *)(out_buf + index) = interesting_32[i];
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
         *(u32 *)(out_buf + index) = SWAP32(interesting_32[i]);
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
       }
@@ -1777,7 +1807,7 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
     payload_length = offset_iter->target_end - offset_iter->target_start;
     /* add to offset field */
     for (i = 1; i < 36; i++) {
-      if (i > out_len) {
+      if (i >= out_len) {
         break;
       }
       number_add(out_buf, offset_iter->start, meta_length, i);
@@ -1786,15 +1816,14 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
                                 UR(out_len - i), i);
 
       /* save testcase if interesting */
-      if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+      if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
         goto exit_describing_aware_stage;
 
       /* Recover all the clobbered stucture */
-      if (out_len < len) {
-        out_buf = ck_realloc(out_buf, len);
-      }
+      out_buf = reserve_mut_buf(out_buf, len);
       out_len = len;
       memcpy(out_buf, buf, len);
+      edit_reset();
       stage_max++;
     }
 
@@ -1805,15 +1834,14 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       out_buf = delete_data(out_buf, &out_len, offset_iter->target_start, i);
 
       /* save testcase if interesting */
-      if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+      if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
         goto exit_describing_aware_stage;
 
       /* Recover all the clobbered stucture */
-      if (out_len < len) {
-        out_buf = ck_realloc(out_buf, len);
-      }
+      out_buf = reserve_mut_buf(out_buf, len);
       out_len = len;
       memcpy(out_buf, buf, len);
+      edit_reset();
       stage_max++;
     }
 
@@ -1823,7 +1851,7 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       u8 orig = out_buf[index];
       for (i = 0; i < sizeof(interesting_8); i++) {
         out_buf[index] = interesting_8[i];
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
       }
@@ -1832,11 +1860,11 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       u16 orig = *(u16 *)(out_buf + index);
       for (i = 0; i < sizeof(interesting_16) / 2; i++) {
         *(u16 *)(out_buf + index) = interesting_16[i];
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
         *(u16 *)(out_buf + index) = SWAP16(interesting_16[i]);
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
       }
@@ -1845,11 +1873,11 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
       u32 orig = *(u32 *)(out_buf + index);
       for (i = 0; i < sizeof(interesting_32) / 4; i++) {
         *(u32 *)(out_buf + index) = interesting_32[i];
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
         *(u32 *)(out_buf + index) = SWAP32(interesting_32[i]);
-        if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+        if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
           goto exit_describing_aware_stage;
         stage_max++;
       }
@@ -1865,19 +1893,19 @@ void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
     cons_iter = cons_iter->next;
   }
 
+  if (flush_batch(argv)) goto exit_describing_aware_stage;
+
   new_hit_cnt = queued_paths + unique_crashes;
   stage_finds[STAGE_STRUCT_AWARE] += new_hit_cnt - orig_hit_cnt;
   stage_cycles[STAGE_STRUCT_AWARE] += stage_max;
 
 exit_describing_aware_stage:
   ck_free(out_buf);
-  free(map);
 }
 
 void struct_havoc_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
-                        Track *track) {
-  u8 **all_chunks;
-  u32 chunk_num = 0, out_len, splice_cycle = 0;
+                        Track *track, ChunkIndex *index) {
+  u32 out_len, splice_cycle = 0;
   u32 stage_max, stage_cur, i, perf_score = 100, orig_perf;
   u64 orig_hit_cnt, new_hit_cnt, struct_havoc_queued;
   u8 *out_buf;
@@ -1885,15 +1913,7 @@ void struct_havoc_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
   out_len = len;
   out_buf = ck_alloc(len);
   memcpy(out_buf, buf, len);
-  HashMap map = createHashMap(NULL, NULL);
-  tree_add_map(tree->child, map);
-  all_chunks = ck_alloc(map->size * sizeof(u8 *));
-  HashMapIterator map_iter = createHashMapIterator(map);
-  while (hasNextHashMapIterator(map_iter)) {
-    map_iter = nextHashMapIterator(map_iter);
-    all_chunks[chunk_num] = map_iter->entry->key;
-    chunk_num++;
-  }
+  edit_reset();
 
   orig_perf = perf_score = calculate_score(queue_cur);
 
@@ -1922,77 +1942,78 @@ struct_havoc_stage:
   struct_havoc_queued = queued_paths;
   for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
       u32 use_stacking = 1 << (1 + UR(HAVOC_STACK_POW2));
+      u32 ops[1 << HAVOC_STACK_POW2];
+      rand_fill(ops, use_stacking, 11 + ((track == NULL) ? 0 : 2));
       for (i = 0; i < use_stacking; i++) {
       u32 num;
-      num = UR(11 + ((track == NULL) ? 0 : 2));
+      num = ops[i];
       //SAYF("#Before mutate num is %d, out_len is %d\n", num, out_len);
       switch (num) {
         case 0: {
-          out_buf = flip_bit_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = flip_bit_mutator(out_buf, out_len, index);
           break;
         }
         case 1: {
-          out_buf = set_byte_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = set_byte_mutator(out_buf, out_len, index);
           break;
         }
         case 2: {
-          out_buf = set_word_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = set_word_mutator(out_buf, out_len, index);
           break;
         }
         case 3: {
-          out_buf = set_dword_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = set_dword_mutator(out_buf, out_len, index);
           break;
         }
         case 4: {
-          out_buf = sub_byte_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = sub_byte_mutator(out_buf, out_len, index);
           break;
         }
         case 5: {
-          out_buf = add_byte_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = add_byte_mutator(out_buf, out_len, index);
           break;
         }
         case 6: {
-          out_buf = sub_word_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = sub_word_mutator(out_buf, out_len, index);
           break;
         }
         case 7: {
-          out_buf = add_word_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = add_word_mutator(out_buf, out_len, index);
           break;
         }
         case 8: {
-          out_buf = sub_dword_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = sub_dword_mutator(out_buf, out_len, index);
           break;
         }
         case 9: {
-          out_buf = add_dword_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = add_dword_mutator(out_buf, out_len, index);
           break;
         }
         case 10: {
-          out_buf = random_set_byte_mutator(out_buf, out_len, map, all_chunks, chunk_num);
+          out_buf = random_set_byte_mutator(out_buf, out_len, index);
           break;
         }
         case 11: {
-          enum_field = get_random_enum(track->enums);
-          out_buf = overwrite_with_enum_mutator(out_buf, &out_len, enum_field, all_chunks, chunk_num);
+          enum_field = index_random_enum(index);
+          out_buf = overwrite_with_enum_mutator(out_buf, &out_len, enum_field);
           break;
         }
         case 12: {
-          enum_field = get_random_enum(track->enums);
-          out_buf = insert_with_enum_mutator(out_buf, &out_len, enum_field, all_chunks, chunk_num);
+          enum_field = index_random_enum(index);
+          out_buf = insert_with_enum_mutator(out_buf, &out_len, enum_field);
           break;
         }
       }
       //SAYF("#After mutate num is %d, out_len is %d\n", num, out_len);
     }
 
-    if (common_fuzz_stuff(argv, out_buf, out_len, tree, track))
+    if (batch_fuzz_stuff(argv, out_buf, out_len, tree, track))
       goto exit_struct_havoc_stage;
 
-    if (out_len < len) {
-      out_buf = ck_realloc(out_buf, len);
-    }
+    out_buf = reserve_mut_buf(out_buf, len);
     out_len = len;
     memcpy(out_buf, buf, len);
+    edit_reset();
 
     if (queued_paths != struct_havoc_queued) {
       if (perf_score <= HAVOC_MAX_MULT * 100) {
@@ -2004,6 +2025,8 @@ struct_havoc_stage:
     }
   }
 
+  if (flush_batch(argv)) goto exit_struct_havoc_stage;
+
   new_hit_cnt = queued_paths + unique_crashes;
   if(!splice_cycle) {
     stage_finds[STAGE_STRUCT_HAVOC] += new_hit_cnt - orig_hit_cnt;
@@ -2029,13 +2052,7 @@ retry_splicing:
     } while (tid == current_entry);
 
     splicing_with = tid;
-    target = queue;
-
-    while (tid >= 100) {
-      target = target->next_100;
-      tid -= 100;
-    }
-    while (tid--) target = target->next;
+    target = queue_buf[tid];
 
     /* Make sure that the target has a reasonable length. */
 
@@ -2078,8 +2095,7 @@ retry_splicing:
     out_len = target->len;
     memcpy(new_buf, out_buf, split_at);
 
-    ck_free(out_buf);
-    out_buf = ck_alloc(out_len);
+    out_buf = reserve_mut_buf(out_buf, out_len);
     memcpy(out_buf, new_buf, out_len);
     ck_free(new_buf);
     goto struct_havoc_stage;
@@ -2087,42 +2103,36 @@ retry_splicing:
 
 exit_struct_havoc_stage:
 
-  freeHashMapIterator(&map_iter);
-  map->clear(map);
-  free(map);
-  ck_free(all_chunks);
   ck_free(out_buf);
 }
 
-u8* insert_chunk_mutator(u8 *buf, u32 *len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* insert_chunk_mutator(u8 *buf, u32 *len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
   u32 index1, index2;
-  index1 = UR(chunk_num);
-  index2 = UR(chunk_num);
-  buf = insert_chunk(buf, len, map, all_chunks[index1], all_chunks[index2], UR(2));
+  index1 = UR(index->num);
+  index2 = UR(index->num);
+  buf = insert_chunk(buf, len, index->chunks[index1], index->chunks[index2], UR(2));
   return buf;
 }
 
-u8* delete_chunk_mutator(u8 *buf, u32 *len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* delete_chunk_mutator(u8 *buf, u32 *len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  u32 index;
-  index = UR(chunk_num);
-  buf = delete_chunk(buf, len, map, all_chunks[index]);
+  buf = delete_chunk(buf, len, index->chunks[UR(index->num)]);
   return buf;
 }
 
-u8* exchange_chunk_mutator(u8 *buf, u32 *len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* exchange_chunk_mutator(u8 *buf, u32 *len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
   Chunk *chunks[2];
   chunks[0] = NULL;
   chunks[1] = NULL;
-  get_exchange_chunks(chunk_num, all_chunks, map, chunks);
+  get_exchange_chunks(index, chunks);
   buf = exchange_chunk(buf, *len, chunks[0], chunks[1]);
   return buf;
 }
@@ -2135,11 +2145,10 @@ u8* enum_mutator(u8 *buf, u32 len, Enum *enum_field, u32 candi_index) {
     return buf;
   }
   u32 chunk_len = enum_field->end - enum_field->start;
-  u32 candi_len = 0;
-  u8 *candi_str = parse_candidate(enum_field->candidates[candi_index], &candi_len);
+  u32 candi_len = CAND_LEN(enum_field, candi_index);
   u32 copy_len = chunk_len > candi_len ? candi_len : chunk_len;
-  memcpy(buf + enum_field->start, candi_str, copy_len);
-  ck_free(candi_str);
+  memcpy(buf + enum_field->start, CAND_DATA(enum_field, candi_index),
+         copy_len);
   return buf;
 }
 
@@ -2181,7 +2190,6 @@ u8* set_len_mutator(u8* buf, u32 len, Length *len_field, u32 interest_index) {
 u8* insert_len_payload_mutator(u8* buf, u32 *len, Length *len_field) {
   u32 clone_from, clone_to, clone_len, payload_start, payload_end;
   u8 acturally_clone = UR(4);
-  u8 *new_buf;
   if (len_field == NULL || len_field->target_start > *len ||
       len_field->target_end > *len) {
     return buf;
@@ -2196,25 +2204,15 @@ u8* insert_len_payload_mutator(u8* buf, u32 *len, Length *len_field) {
     clone_from = 0;
   }
   clone_to = payload_start + UR(payload_end - payload_start);
-  new_buf = ck_alloc(*len + clone_len);
-
-  /* Head */
-  memcpy(new_buf, buf, clone_to);
 
-  /* Inserted part */
   if (acturally_clone) {
-    memcpy(new_buf + clone_to, buf + clone_from, clone_len);
+    buf = copy_and_insert(buf, len, clone_to, clone_from, clone_len);
   } else {
-    memset(new_buf + clone_to, UR(2) ? UR(256) : buf[UR(*len)],
-            clone_len);
+    u8 fill = UR(2) ? UR(256) : buf[UR(*len)];
+    buf = open_gap(buf, len, clone_to, clone_len);
+    memset(buf + clone_to, fill, clone_len);
   }
-
-  /* Tail */
-  memcpy(new_buf + clone_to + clone_len, buf + clone_to,
-          *len - clone_to);
-  ck_free(buf);
-  buf = new_buf;
-  *len += clone_len;
+  edit_owner(payload_start, payload_end);
 
   buf = increase_len_mutator(buf, *len, len_field, clone_len);
 
@@ -2238,9 +2236,7 @@ u8* delete_len_payload_mutator(u8* buf, u32 *len, Length *len_field) {
   }
   del_len = choose_block_len(payload_end - payload_start - 1);
   del_from = payload_start + UR(payload_end - payload_start - del_len);
-  memmove(buf + del_from, buf + del_from + del_len,
-          *len - del_from - del_len);
-  *len -= del_len;
+  buf = delete_data(buf, len, del_from, del_len);
 
   buf = decrease_len_mutator(buf, *len, len_field, del_len);
 
@@ -2285,7 +2281,6 @@ u8* set_offset_mutator(u8* buf, u32 len, Offset *offset_field, u32 interest_inde
 u8* insert_offset_payload_mutator(u8* buf, u32 *len, Offset *offset_field) {
   u32 clone_from, clone_to, clone_len, payload_start, payload_end;
   u8 acturally_clone = UR(4);
-  u8 *new_buf;
   if (offset_field == NULL || offset_field->target_start > *len ||
       offset_field->target_end > *len) {
     return buf;
@@ -2300,25 +2295,15 @@ u8* insert_offset_payload_mutator(u8* buf, u32 *len, Offset *offset_field) {
     clone_from = 0;
   }
   clone_to = payload_start + UR(payload_end - payload_start);
-  new_buf = ck_alloc(*len + clone_len);
-
-  /* Head */
-  memcpy(new_buf, buf, clone_to);
 
-  /* Inserted part */
   if (acturally_clone) {
-    memcpy(new_buf + clone_to, buf + clone_from, clone_len);
+    buf = copy_and_insert(buf, len, clone_to, clone_from, clone_len);
   } else {
-    memset(new_buf + clone_to, UR(2) ? UR(256) : buf[UR(*len)],
-            clone_len);
+    u8 fill = UR(2) ? UR(256) : buf[UR(*len)];
+    buf = open_gap(buf, len, clone_to, clone_len);
+    memset(buf + clone_to, fill, clone_len);
   }
-
-  /* Tail */
-  memcpy(new_buf + clone_to + clone_len, buf + clone_to,
-          *len - clone_to);
-  ck_free(buf);
-  buf = new_buf;
-  *len += clone_len;
+  edit_owner(payload_start, payload_end);
 
   buf = increase_offset_mutator(buf, *len, offset_field, clone_len);
 
@@ -2342,20 +2327,18 @@ u8* delete_offset_payload_mutator(u8* buf, u32 *len, Offset *offset_field) {
   }
   del_len = choose_block_len(payload_end - payload_start - 1);
   del_from = payload_start + UR(payload_end - payload_start - del_len);
-  memmove(buf + del_from, buf + del_from + del_len,
-          *len - del_from - del_len);
-  *len -= del_len;
+  buf = delete_data(buf, len, del_from, del_len);
 
   buf = decrease_offset_mutator(buf, *len, offset_field, del_len);
 
   return buf;
 }
 
-u8* enum_insert_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map) {
+u8* enum_insert_mutator(u8* buf, u32 *len, Enum *enum_field, ChunkIndex *index) {
   if(enum_field == NULL) {
     return buf;
   }
-  Chunk *chunk = map->get(map, enum_field->id);
+  Chunk *chunk = enum_chunk(enum_field, index);
   if(chunk == NULL) {
     return buf;
   }
@@ -2363,7 +2346,7 @@ u8* enum_insert_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map) {
   if(copy_chunk == NULL || copy_chunk->parent == NULL) {
     return buf;
   }
-  Chunk *insert_chunk = get_random_chunk(copy_chunk->parent);
+  Chunk *insert_chunk = index_random_chunk(index, copy_chunk->parent);
   if (copy_chunk->start > *len || copy_chunk->end > *len || insert_chunk->end > *len) {
     return buf;
   }
@@ -2372,11 +2355,11 @@ u8* enum_insert_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map) {
   return buf;
 }
 
-u8* enum_delete_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map) {
+u8* enum_delete_mutator(u8* buf, u32 *len, Enum *enum_field, ChunkIndex *index) {
   if(enum_field == NULL) {
     return buf;
   }
-  Chunk *chunk = map->get(map, enum_field->id);
+  Chunk *chunk = enum_chunk(enum_field, index);
   if(chunk == NULL) {
     return buf;
   }
@@ -2393,11 +2376,11 @@ u8* enum_delete_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map) {
   return delete_data(buf, len, delete_chunk->start, delete_chunk->end - delete_chunk->start);
 }
 
-u8* enum_exchange_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map) {
+u8* enum_exchange_mutator(u8* buf, u32 *len, Enum *enum_field, ChunkIndex *index) {
   if(enum_field == NULL) {
     return buf;
   }
-  Chunk *chunk = map->get(map, enum_field->id);
+  Chunk *chunk = enum_chunk(enum_field, index);
   if(chunk == NULL) {
     return buf;
   }
@@ -2405,11 +2388,11 @@ u8* enum_exchange_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map) {
   if(chunk1 == NULL || chunk1->parent == NULL) {
     return buf;
   }
-  Chunk *chunk2 = get_random_chunk(chunk1->parent->child);
+  Chunk *chunk2 = index_random_sibling(index, chunk1);
   if (chunk_overleap(chunk1, chunk2)) {
     return buf;
   }
-  if (strcmp(chunk1->id, chunk2->id) == 0) {
+  if (chunk1->idx == chunk2->idx) {
     return buf;
   }
   Chunk *temp;
@@ -2423,7 +2406,7 @@ u8* enum_exchange_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map) {
   return buf;
 }
 
-u8* high_order_structure_mutator(u8* buf, u32 *len, HashMap map, Chunk *tree) {
+u8* high_order_structure_mutator(u8* buf, u32 *len, Chunk *tree, ChunkIndex *index) {
   if(tree == NULL) {
     return buf;
   }
@@ -2432,14 +2415,14 @@ u8* high_order_structure_mutator(u8* buf, u32 *len, HashMap map, Chunk *tree) {
   if(level == 0) {
     root = tree->child;
   } else if(level == 1) {
-    root = get_random_chunk(tree->child);
+    root = index_random_chunk(index, tree->child);
     if(root) {
       root = root->child;
     }
   } else if(level == 2) {
-    root = get_random_chunk(tree->child);
+    root = index_random_chunk(index, tree->child);
     if(root) {
-      root = get_random_chunk(root->child);
+      root = index_random_chunk(index, root->child);
       if(root) {
         root = root->child;
       }
@@ -2450,11 +2433,11 @@ u8* high_order_structure_mutator(u8* buf, u32 *len, HashMap map, Chunk *tree) {
   }
   switch (UR(3)) {
     case 0: {
-      buf = insert_chunk(buf, len, map, get_random_chunk(root)->id, get_random_chunk(root)->id, UR(2));
+      buf = insert_chunk(buf, len, index_random_chunk(index, root), index_random_chunk(index, root), UR(2));
       break;
     }
     case 1: {
-      Chunk *delete_chunk = get_random_chunk(root);
+      Chunk *delete_chunk = index_random_chunk(index, root);
       if (delete_chunk->start > *len || delete_chunk->end > *len) {
         return buf;
       }
@@ -2465,7 +2448,7 @@ u8* high_order_structure_mutator(u8* buf, u32 *len, HashMap map, Chunk *tree) {
       break;
     }
     case 2: {
-      Chunk *chunk = get_random_chunk(root->next);
+      Chunk *chunk = index_random_chunk(index, root->next);
       if(chunk == NULL) {
         return buf;
       }
@@ -2479,7 +2462,7 @@ u8* high_order_structure_mutator(u8* buf, u32 *len, HashMap map, Chunk *tree) {
   return buf;
 }
 
-u8* multiple_enum_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map, Track *track) {
+u8* multiple_enum_mutator(u8* buf, u32 *len, Enum *enum_field, ChunkIndex *index, Track *track) {
   // if(enum_field == NULL) {
   //   return buf;
   // }
@@ -2508,16 +2491,16 @@ u8* multiple_enum_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map, Trac
   return buf;
 }
 
-u8* flip_bit_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
+u8* flip_bit_mutator(u8* buf, u32 len, ChunkIndex *index) {
   #define FLIP_BIT(_ar, _b) do { \
     u8* _arf = (u8*)(_ar); \
     u32 _bf = (_b); \
     _arf[(_bf) >> 3] ^= (128 >> ((_bf) & 7)); \
   } while (0)
-  if(chunk_num == 0) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || chunk->start >= len) {
     return buf;
   }else {
@@ -2526,11 +2509,11 @@ u8* flip_bit_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_n
   return buf;
 }
 
-u8* set_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* set_byte_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || chunk->start >= len) {
     return buf;
   }else {
@@ -2539,11 +2522,11 @@ u8* set_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_n
   return buf;
 }
 
-u8* set_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* set_word_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || len < 2 ||chunk->start >= len - 1) {
     return buf;
   }else {
@@ -2557,11 +2540,11 @@ u8* set_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_n
 }
 
 
-u8* set_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* set_dword_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || len < 4 ||chunk->start >= len - 3) {
     return buf;
   }else {
@@ -2574,11 +2557,11 @@ u8* set_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_
   return buf;
 }
 
-u8* sub_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* sub_byte_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || chunk->start >= len) {
     return buf;
   }else {
@@ -2587,11 +2570,11 @@ u8* sub_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_n
   return buf;
 }
 
-u8* add_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* add_byte_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || chunk->start >= len) {
     return buf;
   }else {
@@ -2600,11 +2583,11 @@ u8* add_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_n
   return buf;
 }
 
-u8* sub_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* sub_word_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || len < 2 ||chunk->start >= len - 1) {
     return buf;
   }else {
@@ -2618,11 +2601,11 @@ u8* sub_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_n
   return buf;
 }
 
-u8* add_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* add_word_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || len < 2 ||chunk->start >= len - 1) {
     return buf;
   }else {
@@ -2636,11 +2619,11 @@ u8* add_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_n
   return buf;
 }
 
-u8* sub_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* sub_dword_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || len < 4 ||chunk->start >= len - 3) {
     return buf;
   }else {
@@ -2654,11 +2637,11 @@ u8* sub_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_
   return buf;
 }
 
-u8* add_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
-  if(chunk_num == 0) {
+u8* add_dword_mutator(u8* buf, u32 len, ChunkIndex *index) {
+  if(index->num == 0) {
     return buf;
   }
-  Chunk *chunk = map->get(map, all_chunks[UR(chunk_num)]);
+  Chunk *chunk = index->chunks[UR(index->num)];
   if(chunk == NULL || len < 4 ||chunk->start >= len - 3) {
     return buf;
   }else {
@@ -2672,19 +2655,20 @@ u8* add_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_
   return buf;
 }
 
-u8* random_set_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num) {
+u8* random_set_byte_mutator(u8* buf, u32 len, ChunkIndex *index) {
   buf[UR(len)] ^= 1 + UR(255);
   return buf;
 }
 
-u8* overwrite_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field, u8 **all_chunks, u32 chunk_num) {
+u8* overwrite_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field) {
   if(enum_field == NULL || enum_field->start > *len || enum_field->cans_num == 0) {
     return buf;
   }
   u32 insert_at;
   u32 chunk_len = enum_field->end - enum_field->start;
-  u32 candi_len = 0;
-  u8 *candi_str = parse_candidate(enum_field->candidates[UR(enum_field->cans_num)], &candi_len);
+  u32 candi_index = UR(enum_field->cans_num);
+  u32 candi_len = CAND_LEN(enum_field, candi_index);
+  u8 *candi_str = CAND_DATA(enum_field, candi_index);
   u32 copy_len = chunk_len > candi_len ? candi_len : chunk_len;
   if(*len <= copy_len) {
     return buf;
@@ -2694,28 +2678,18 @@ u8* overwrite_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field, u8 **all_ch
   return buf;
 }
 
-u8* insert_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field, u8 **all_chunks, u32 chunk_num) {
+u8* insert_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field) {
   if(enum_field == NULL || enum_field->start > *len || enum_field->cans_num == 0) {
     return buf;
   }
-  u8* new_buf;
   u32 insert_at;
   u32 chunk_len = enum_field->end - enum_field->start;
-  u32 candi_len = 0;
-  u8 *candi_str = parse_candidate(enum_field->candidates[UR(enum_field->cans_num)], &candi_len);
+  u32 candi_index = UR(enum_field->cans_num);
+  u32 candi_len = CAND_LEN(enum_field, candi_index);
+  u8 *candi_str = CAND_DATA(enum_field, candi_index);
   u32 copy_len = chunk_len > candi_len ? candi_len : chunk_len;
   insert_at = UR(*len+ 1);
-  new_buf = ck_alloc_nozero(*len + copy_len);
-
-  /* Head */
-  memcpy(new_buf, buf, insert_at);
-
-  /* Inserted part */
-  memcpy(new_buf + insert_at, candi_str, copy_len);
-
-  memcpy(new_buf + insert_at + copy_len, buf + insert_at, *len - insert_at);
-
-  ck_free(buf);
-  *len += copy_len;
-  return new_buf;
+  buf = open_gap(buf, len, insert_at, copy_len);
+  memcpy(buf + insert_at, candi_str, copy_len);
+  return buf;
 }
\ No newline at end of file
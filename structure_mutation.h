@@ -22,15 +22,35 @@ u32 htoi(u8 s[]);
 
 uint8_t *itoh(uint32_t num);
 
-uint8_t *candidate_reverse(char *str);
+u32 decode_candidate(u8 *str, u8 *out);
 
-uint8_t *parse_candidate(uint8_t *str, u32 *len);
+u8 *candidate_to_hex(u8 *bytes, u32 len);
+
+Enum *alloc_enum(u32 num, u32 data_len);
+
+u8 *enum_candidate(Enum *e, u32 i, u32 len);
+
+void mirror_candidates(Enum *e);
+
+Enum *dup_enum(Enum *e);
 
 cJSON *tree_to_json(Chunk *chunk_head);
 
 cJSON *track_to_json(Track *track);
 
-void tree_add_map(Chunk *head, HashMap map);
+ChunkIndex *index_structure(Chunk *tree, Track *track);
+
+void free_chunk_index(ChunkIndex *index);
+
+Chunk *index_random_chunk(ChunkIndex *index, Chunk *head);
+
+Chunk *index_random_sibling(ChunkIndex *index, Chunk *chunk);
+
+Enum *index_random_enum(ChunkIndex *index);
+
+Length *index_random_length(ChunkIndex *index);
+
+Offset *index_random_offset(ChunkIndex *index);
 
 void free_tree(Chunk *head, Boolean recurse);
 
@@ -58,7 +78,6 @@ Constraint *get_random_constraint(Constraint *head);
 cJSON *get_json(const u8 *path);
 
 cJSON *get_structure_json(const u8 *path, const u8 *suffix);
-cJSON *get_structure_json_for_reusing(const u8 *path, const u8 *suffix);
 
 Chunk *json_to_tree(cJSON *cjson_head);
 Boolean is_inferred(u8 *path);
@@ -66,33 +85,36 @@ Chunk *parse_struture_file(u8 *path);
 
 Track *parse_constraint_file(u8 *path, u8 *in_buf);
 
+Track *json_to_track(cJSON *cjson_head, u8 *in_buf);
+
 Boolean chunk_overleap(Chunk *chunk1, Chunk *chunk2);
 
+u8 *reserve_mut_buf(u8 *buf, u32 size);
+
 u8 *copy_and_insert(u8 *buf, u32 *len, u32 insert_at, u32 copy_start,
                     u32 copy_len);
 
-u8 *insert_chunk(u8 *buf, u32 *len, HashMap map, u8 *insert_id, u8 *copy_id,
+u8 *insert_chunk(u8 *buf, u32 *len, Chunk *chunk_insert, Chunk *chunk_copy,
                  Boolean after);
 
 u8 *delete_data(u8 *buf, u32 *len, u32 delete_start, u32 delete_len);
 
 
-u8 *delete_chunk(u8 *buf, u32 *len, HashMap map, u8 *id);
+u8 *delete_chunk(u8 *buf, u32 *len, Chunk *chunk_delete);
 
-void get_exchange_chunks(uint32_t chunk_num, uint8_t **all_chunks, HashMap map,
-                         Chunk **chunks);
+void get_exchange_chunks(ChunkIndex *index, Chunk **chunks);
 
 uint8_t *exchange_chunk(uint8_t *buf, uint32_t len, Chunk *chunk_left,
                         Chunk *chunk_right);
 
 void struct_havoc_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
-                        Track *track);
+                        Track *track, ChunkIndex *index);
 
 void struct_describing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
-                        Track *track);
+                        Track *track, ChunkIndex *index);
                         
 void constraint_aware_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
-                            Track *track);
+                            Track *track, ChunkIndex *index);
 
 void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
                             Track *track);
@@ -103,29 +125,46 @@ void reusing_stage(char **argv, u8 *buf, u32 len, Chunk *tree,
 typedef struct UniqueValue {
   u8 *data;       // 값 (바이트 배열)
   u32 length;     // 값의 길이
-  struct UniqueValue *next;
+  u32 hash;
 } UniqueValue;
 
 typedef struct UniqueSet {
-  UniqueValue *head;
+  UniqueValue *values;  // in insertion order
   unsigned int count;
+  u32 size;
+  u32 *slots;           // open addressing, value index + 1 (0 = empty)
+  u32 slot_mask;
+  u8 *arena;
+  u32 arena_used;
+  u32 *by_len[POOL_LEN_MAX + 1];  // value indices, by length
+  u32 by_len_cnt[POOL_LEN_MAX + 1];
+  u32 saved;            // values already in the pool file
+  u64 bytes;            // total size of the values
+  u64 dups;             // inserts of values already present
+  u8 *name;
   void (*insert)(struct UniqueSet *, u8 *data, u32 length);
   bool (*contains)(struct UniqueSet *, u8 *data, u32 length);
 } UniqueSet;
 
-UniqueSet *enum_value_set;
-UniqueSet *length_value_set;
-UniqueSet *offset_value_set;
+extern UniqueSet *enum_value_set;
+extern UniqueSet *length_value_set;
+extern UniqueSet *offset_value_set;
 #endif
 
 bool contains(UniqueSet *set, u8 *data, u32 length);
 void insert(UniqueSet *set, u8 *data, u32 length);
+UniqueValue *pool_random(UniqueSet *set);
+UniqueValue *pool_random_len(UniqueSet *set, u32 length);
 void init_value_sets();
+void save_value_pools(void);
+void load_value_pools(void);
+void write_pool_stats(FILE *f);
+void maybe_dump_value_pools(u8 check_flag);
 
 /*All Mutators*/
-u8* insert_chunk_mutator(u8 *buf, u32 *len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* delete_chunk_mutator(u8 *buf, u32 *len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* exchange_chunk_mutator(u8 *buf, u32 *len, HashMap map, u8 **all_chunks, u32 chunk_num);
+u8* insert_chunk_mutator(u8 *buf, u32 *len, ChunkIndex *index);
+u8* delete_chunk_mutator(u8 *buf, u32 *len, ChunkIndex *index);
+u8* exchange_chunk_mutator(u8 *buf, u32 *len, ChunkIndex *index);
 
 u8* enum_mutator(u8 *buf, u32 len, Enum *enum_field, u32 candi_index);
 
@@ -141,22 +180,22 @@ u8* set_offset_mutator(u8* buf, u32 len, Offset *offset_field, u32 interest_num)
 u8* insert_offset_payload_mutator(u8* buf, u32 *len, Offset *offset_field);
 u8* delete_offset_payload_mutator(u8* buf, u32 *len, Offset *offset_field);
 
-u8* enum_insert_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map);
-u8* enum_delete_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map);
-u8* enum_exchange_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map);
-u8* multiple_enum_mutator(u8* buf, u32 *len, Enum *enum_field, HashMap map, Track *track);
-u8* high_order_structure_mutator(u8* buf, u32 *len, HashMap map, Chunk *tree);
-
-u8* flip_bit_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* set_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* set_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* set_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* sub_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* add_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* sub_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* add_word_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* sub_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* add_dword_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* random_set_byte_mutator(u8* buf, u32 len, HashMap map, u8 **all_chunks, u32 chunk_num);
-u8* overwrite_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field, u8 **all_chunks, u32 chunk_num);
-u8* insert_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field, u8 **all_chunks, u32 chunk_num);
\ No newline at end of file
+u8* enum_insert_mutator(u8* buf, u32 *len, Enum *enum_field, ChunkIndex *index);
+u8* enum_delete_mutator(u8* buf, u32 *len, Enum *enum_field, ChunkIndex *index);
+u8* enum_exchange_mutator(u8* buf, u32 *len, Enum *enum_field, ChunkIndex *index);
+u8* multiple_enum_mutator(u8* buf, u32 *len, Enum *enum_field, ChunkIndex *index, Track *track);
+u8* high_order_structure_mutator(u8* buf, u32 *len, Chunk *tree, ChunkIndex *index);
+
+u8* flip_bit_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* set_byte_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* set_word_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* set_dword_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* sub_byte_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* add_byte_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* sub_word_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* add_word_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* sub_dword_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* add_dword_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* random_set_byte_mutator(u8* buf, u32 len, ChunkIndex *index);
+u8* overwrite_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field);
+u8* insert_with_enum_mutator(u8* buf, u32 *len, Enum *enum_field);
\ No newline at end of file
@@ -0,0 +1,406 @@
+#include "afl-fuzz.h"
+
+/* Rebasing structure after structural mutations.
+
+   Structure stages insert, delete and swap whole byte ranges, but new
+   queue entries used to inherit the parent's tree and track verbatim,
+   with every interval after the first edit pointing at the wrong bytes
+   until the entry went through taint inference again. Instead, the
+   mutation primitives append each edit to a small script, and when a
+   mutated input is kept, the script is replayed on a copy of the
+   parent's tree and track: intervals after an edit are shifted, the ones
+   containing it grow or shrink, and the ones it cut in half are dropped.
+
+   The script describes the path from the stage's pristine input to the
+   current out_buf, so it is cleared whenever the two are in sync again,
+   that is at stage entry and after every execution. */
+
+#define EDIT_INSERT 0
+#define EDIT_DELETE 1
+#define EDIT_SWAP   2
+
+struct struct_edit {
+  u8  op;
+  u32 a, a_len;                     /* Insert / delete / left of swap     */
+  u32 b, b_len;                     /* Right of swap, or insert owner     */
+};
+
+static struct struct_edit edit_log[STRUCT_EDIT_MAX];
+static u32 edit_cnt;
+static u8  edit_lost;               /* Script overflowed, cannot rebase   */
+
+void edit_reset(void) {
+
+  edit_cnt  = 0;
+  edit_lost = 0;
+
+}
+
+/* Batched executions (see batch_fuzz_stuff()) run well after the stage has
+   moved on, so the script of each queued test case is set aside in its
+   batch slot, plus one for the stage's own. */
+
+static struct struct_edit batch_log[BATCH_MAX + 1][STRUCT_EDIT_MAX];
+static u32 batch_log_cnt[BATCH_MAX + 1];
+static u8  batch_log_lost[BATCH_MAX + 1];
+
+void edit_save(u32 slot) {
+
+  memcpy(batch_log[slot], edit_log, edit_cnt * sizeof(struct struct_edit));
+  batch_log_cnt[slot]  = edit_cnt;
+  batch_log_lost[slot] = edit_lost;
+
+}
+
+void edit_restore(u32 slot) {
+
+  edit_cnt  = batch_log_cnt[slot];
+  edit_lost = batch_log_lost[slot];
+  memcpy(edit_log, batch_log[slot], edit_cnt * sizeof(struct struct_edit));
+
+}
+
+static struct struct_edit* edit_append(u8 op) {
+
+  if (edit_cnt == STRUCT_EDIT_MAX) {
+    edit_lost = 1;
+    return NULL;
+  }
+
+  edit_log[edit_cnt].op = op;
+  edit_log[edit_cnt].b = edit_log[edit_cnt].b_len = 0;
+  return &edit_log[edit_cnt++];
+
+}
+
+void edit_insert(u32 at, u32 len) {
+
+  struct struct_edit* e;
+
+  if (!len || !(e = edit_append(EDIT_INSERT))) return;
+
+  e->a     = at;
+  e->a_len = len;
+
+}
+
+void edit_delete(u32 at, u32 len) {
+
+  struct struct_edit* e;
+
+  if (!len || !(e = edit_append(EDIT_DELETE))) return;
+
+  e->a     = at;
+  e->a_len = len;
+
+}
+
+void edit_swap(u32 l_start, u32 l_end, u32 r_start, u32 r_end) {
+
+  struct struct_edit* e;
+
+  if (!(e = edit_append(EDIT_SWAP))) return;
+
+  e->a     = l_start;
+  e->a_len = l_end - l_start;
+  e->b     = r_start;
+  e->b_len = r_end - r_start;
+
+}
+
+/* Replay the first cnt edits of the script on [*start, *end). Returns 0
+   if an edit cut through the interval, or deleted it altogether. Outer
+   intervals (the root of the tree) also swallow bytes appended right at
+   their end. */
+
+static u8 replay_edits(u32* start, u32* end, u8 outer, u32 cnt) {
+
+  u32 s = *start, e = *end, i;
+
+  for (i = 0; i < cnt; i++) {
+
+    struct struct_edit* ed = &edit_log[i];
+    u32 p = ed->a, n = ed->a_len;
+
+    switch (ed->op) {
+
+      case EDIT_INSERT: {
+
+        u8 owns = ed->b_len && s <= ed->b && e >= ed->b + ed->b_len;
+
+        if (s > p || (s == p && s != e && !owns)) {
+          s += n;
+          e += n;
+        } else if (e > p || (e == p && (outer || owns))) {
+          e += n;
+        }
+
+        break;
+
+      }
+
+      case EDIT_DELETE: {
+
+        u32 q = p + n, ns, ne;
+
+        ns = s <= p ? s : (s >= q ? s - n : p);
+        ne = e <= p ? e : (e >= q ? e - n : p);
+
+        if (ns == ne && s != e) return 0;
+
+        s = ns;
+        e = ne;
+        break;
+
+      }
+
+      case EDIT_SWAP: {
+
+        u32 l_end = p + n, r = ed->b, r_end = r + ed->b_len;
+        u8  seg_s, seg_e;
+        s32 shift;
+
+        /* Untouched, or containing both chunks and everything between. */
+
+        if (e <= p || s >= r_end || (s <= p && e >= r_end)) break;
+
+        /* Otherwise the interval must sit within the left chunk, the gap
+           or the right chunk. Bytes of the left chunk move to the end of
+           the span, bytes of the right one to its start, and the ones in
+           between by the difference in size. */
+
+#define SWAP_SEG(_x) \
+  ((_x) < p ? 0 : (_x) < l_end ? 1 : (_x) < r ? 2 : (_x) < r_end ? 3 : 4)
+
+        seg_s = SWAP_SEG(s);
+        seg_e = s == e ? seg_s : SWAP_SEG(e - 1);
+
+#undef SWAP_SEG
+
+        if (seg_s != seg_e) return 0;
+
+        switch (seg_s) {
+          case 1: shift = r_end - l_end; break;
+          case 2: shift = (s32)ed->b_len - (s32)n; break;
+          case 3: shift = (s32)p - (s32)r; break;
+          default: shift = 0;
+        }
+
+        s += shift;
+        e += shift;
+        break;
+
+      }
+
+    }
+
+  }
+
+  *start = s;
+  *end   = e;
+  return 1;
+
+}
+
+static u8 rebase_span(u32* start, u32* end, u8 outer) {
+
+  return replay_edits(start, end, outer, edit_cnt);
+
+}
+
+/* Same, for fields whose own size must not change (enum values, length
+   and offset meta bytes). */
+
+static u8 rebase_field(u32* start, u32* end) {
+
+  u32 size = *end - *start;
+
+  if (!rebase_span(start, end, 0)) return 0;
+  return *end - *start == size;
+
+}
+
+/* Mark [start, end) as the field the last insert went into, so that it
+   grows even when the insert landed right at its start (instead of being
+   treated as new bytes placed in front of it). The range comes from the
+   parent's track, so it is first moved past the edits made before the
+   insert, the way the intervals it is checked against will be. */
+
+void edit_owner(u32 start, u32 end) {
+
+  struct struct_edit* e;
+
+  if (edit_lost || !edit_cnt) return;
+
+  e = &edit_log[edit_cnt - 1];
+  if (e->op != EDIT_INSERT) return;
+
+  if (!replay_edits(&start, &end, 0, edit_cnt - 1)) return;
+
+  e->b     = start;
+  e->b_len = end - start;
+
+}
+
+/* Copy the sibling list at head, rebased, under parent. Chunks that did
+   not survive are dropped together with their subtree. Rebased siblings
+   are kept in file order, which a swap may have changed. */
+
+static Chunk* rebase_chunks(Chunk* head, Chunk* parent, u32 len) {
+
+  Chunk *out = NULL, *iter, *c, **pos;
+
+  for (iter = head; iter; iter = iter->next) {
+
+    u32 s = iter->start, e = iter->end;
+
+    if (!rebase_span(&s, &e, !parent && !iter->next && iter == head) ||
+        e > len || s == e)
+      continue;
+
+    c         = ck_alloc(sizeof(Chunk));
+    c->start  = s;
+    c->end    = e;
+    c->id     = ck_strdup(iter->id);
+    c->type   = iter->type;
+    c->parent = parent;
+    c->idx    = CHUNK_NONE;
+    c->child  = rebase_chunks(iter->child, c, len);
+
+    for (pos = &out; *pos && (*pos)->start <= s; pos = &(*pos)->next);
+
+    c->next = *pos;
+    *pos = c;
+
+  }
+
+  for (c = out; c; c = c->next)
+    if (c->next) c->next->prev = c;
+
+  return out;
+
+}
+
+static Track* rebase_track(Track* track, u32 len) {
+
+  Track* out = ck_alloc(sizeof(Track));
+
+  Enum**       enum_tail = &out->enums;
+  Length**     len_tail  = &out->lengths;
+  Offset**     off_tail  = &out->offsets;
+  Constraint** cons_tail = &out->constraints;
+
+  Enum*       en;
+  Length*     ln;
+  Offset*     of;
+  Constraint* cn;
+
+  for (en = track->enums; en; en = en->next) {
+
+    u32 s = en->start, e = en->end;
+    Enum* c;
+
+    if (!rebase_field(&s, &e) || e > len) continue;
+
+    c = dup_enum(en);
+    c->start     = s;
+    c->end       = e;
+    c->chunk_idx = CHUNK_NONE;
+
+    *enum_tail = c;
+    enum_tail = &c->next;
+    out->enum_number++;
+
+  }
+
+  for (ln = track->lengths; ln; ln = ln->next) {
+
+    u32 s = ln->start, e = ln->end, ts = ln->target_start,
+        te = ln->target_end;
+    Length* c;
+
+    if (!rebase_field(&s, &e) || !rebase_span(&ts, &te, 0) ||
+        e > len || te > len)
+      continue;
+
+    c = ck_alloc(sizeof(Length));
+    c->id           = ck_strdup(ln->id);
+    c->target_id    = ck_strdup(ln->target_id);
+    c->start        = s;
+    c->end          = e;
+    c->target_start = ts;
+    c->target_end   = te;
+
+    *len_tail = c;
+    len_tail = &c->next;
+    out->length_number++;
+
+  }
+
+  for (of = track->offsets; of; of = of->next) {
+
+    u32 s = of->start, e = of->end, ts = of->target_start,
+        te = of->target_end;
+    Offset* c;
+
+    if (!rebase_field(&s, &e) || !rebase_span(&ts, &te, 0) ||
+        e > len || te > len)
+      continue;
+
+    c = ck_alloc(sizeof(Offset));
+    c->id           = ck_strdup(of->id);
+    c->target_id    = ck_strdup(of->target_id);
+    c->abs          = of->abs;
+    c->start        = s;
+    c->end          = e;
+    c->target_start = ts;
+    c->target_end   = te;
+
+    *off_tail = c;
+    off_tail = &c->next;
+    out->offset_number++;
+
+  }
+
+  for (cn = track->constraints; cn; cn = cn->next) {
+
+    u32 s = cn->start, e = cn->end, ts = cn->target_start,
+        te = cn->target_end;
+    Constraint* c;
+
+    if (!rebase_span(&s, &e, 0) || !rebase_span(&ts, &te, 0) ||
+        e > len || te > len)
+      continue;
+
+    c = ck_alloc(sizeof(Constraint));
+    c->type         = cn->type;
+    c->start        = s;
+    c->end          = e;
+    c->target_start = ts;
+    c->target_end   = te;
+
+    *cons_tail = c;
+    cons_tail = &c->next;
+
+  }
+
+  return out;
+
+}
+
+/* Build copies of tree and track matching the current out_buf of len
+   bytes. Returns 0 (and leaves the outputs alone) if there is nothing to
+   rebase, or if the script is incomplete and the parent's structure is
+   the best we have; otherwise the caller owns the copies. */
+
+u8 rebase_structure(Chunk* tree, Track* track, u32 len, Chunk** new_tree,
+                    Track** new_track) {
+
+  if (!edit_cnt || edit_lost) return 0;
+
+  *new_tree  = tree ? rebase_chunks(tree, NULL, len) : NULL;
+  *new_track = track ? rebase_track(track, len) : NULL;
+
+  return 1;
+
+}
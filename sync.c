@@ -0,0 +1,482 @@
+#include "afl-fuzz.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif /* __linux__ */
+
+/* Syncing with other fuzzers.
+
+   Every SYNC_INTERVAL fuzz_one() calls, sync_fuzzers() looks for test cases
+   the other fuzzers in the sync directory have queued since the last time.
+   Rather than listing every peer's queue/ on each round, on Linux the
+   directories are watched with inotify, and each event for a new test case
+   just puts its name on the peer's pending list. A queue/ is only listed in
+   full when its watch is first set up, or after the event queue overflows.
+   Elsewhere, or if inotify is unavailable, all of them are listed on every
+   round, as before.
+
+   Pending test cases are then run through batch_fuzz_stuff(), so they make
+   use of batching and the executor pool just like the fuzzing stages do,
+   and come back through finish_fuzz_stuff() to import_case(). The
+   postprocessor is left out, as the peers have applied it already. None of
+   them needs its structure parsed: when one gets saved, the peer's .json,
+   .track and .simg are linked into our queue/ alongside it. */
+
+struct sync_case {
+  u32 id;                           /* Case ID at the peer                */
+  u8* name;                         /* File name in the peer's queue/     */
+};
+
+struct sync_peer {
+  u8* name;                         /* Peer's sync ID                     */
+  u8* qd_path;                      /* Peer's queue/                      */
+  s32 wd;                           /* Watch on queue/, -1 if none        */
+  u8  rescan;                       /* List queue/ next time?             */
+  u32 min_accept;                   /* Lowest case ID not looked at yet   */
+  struct sync_case* pending;        /* Cases to look at                   */
+  u32 pending_cnt, pending_size;
+};
+
+static struct sync_peer* peers;
+static u32 peer_cnt;
+
+static struct sync_peer* cur_peer;  /* Peer being imported from          */
+
+static s32 sync_fd = -1;            /* inotify instance                   */
+static s32 sync_wd = -1;            /* Watch on the sync dir itself       */
+static u8  peers_stale = 1;         /* Look for new peers?                */
+
+/* Tell if name is a test case, as opposed to one of the files that go with
+   it, and get its ID. */
+
+static u8 sync_case_id(u8* name, u32* id) {
+
+  u8* ext;
+
+  if (name[0] == '.' || sscanf(name, CASE_PREFIX "%06u", id) != 1) return 0;
+
+  ext = strrchr(name, '.');
+
+  if (ext && (!strcmp(ext, ".json") || !strcmp(ext, ".track") ||
+              !strcmp(ext, ".log") || !strcmp(ext, ".simg") ||
+              !strcmp(ext, ".tmp")))
+    return 0;
+
+  return 1;
+
+}
+
+static void add_pending(struct sync_peer* p, u8* name) {
+
+  u32 id;
+
+  if (!sync_case_id(name, &id) || id < p->min_accept) return;
+
+  if (p->pending_cnt == p->pending_size) {
+    p->pending_size = MAX(p->pending_size * 2, 64);
+    p->pending = ck_realloc(p->pending, p->pending_size *
+                                            sizeof(struct sync_case));
+  }
+
+  p->pending[p->pending_cnt].id   = id;
+  p->pending[p->pending_cnt].name = ck_strdup(name);
+  p->pending_cnt++;
+
+}
+
+static int compare_cases(const void* a, const void* b) {
+
+  u32 x = ((struct sync_case*)a)->id, y = ((struct sync_case*)b)->id;
+
+  return x < y ? -1 : x > y;
+
+}
+
+/* List the peer's queue/ the old-fashioned way. */
+
+static void scan_peer(struct sync_peer* p) {
+
+  DIR* qd;
+  struct dirent* qd_ent;
+
+  if (!(qd = opendir(p->qd_path))) return;
+
+  while ((qd_ent = readdir(qd))) add_pending(p, qd_ent->d_name);
+
+  closedir(qd);
+
+  p->rescan = 0;
+
+}
+
+/* Pick up any fuzzers that joined the sync directory, and set up watches on
+   the queue/ directories we don't have one on yet. */
+
+static void find_peers(void) {
+
+  DIR* sd;
+  struct dirent* sd_ent;
+  u8 incomplete = 0;
+  u32 i;
+
+  sd = opendir(sync_dir);
+  if (!sd) PFATAL("Unable to open '%s'", sync_dir);
+
+  while ((sd_ent = readdir(sd))) {
+
+    struct sync_peer* p;
+    u8 *qd_path, *fn;
+    s32 id_fd;
+
+    /* Skip dot files and our own output directory. */
+
+    if (sd_ent->d_name[0] == '.' || !strcmp(sync_id, sd_ent->d_name)) continue;
+
+    for (i = 0; i < peer_cnt; i++)
+      if (!strcmp(peers[i].name, sd_ent->d_name)) break;
+
+    if (i < peer_cnt) continue;
+
+    /* Skip anything that doesn't have a queue/ subdirectory (yet). */
+
+    qd_path = alloc_printf("%s/%s/queue", sync_dir, sd_ent->d_name);
+
+    if (access(qd_path, X_OK)) {
+      ck_free(qd_path);
+      incomplete = 1;
+      continue;
+    }
+
+    peers = ck_realloc(peers, (peer_cnt + 1) * sizeof(struct sync_peer));
+    p = &peers[peer_cnt++];
+
+    memset(p, 0, sizeof(struct sync_peer));
+
+    p->name    = ck_strdup(sd_ent->d_name);
+    p->qd_path = qd_path;
+    p->wd      = -1;
+    p->rescan  = 1;
+
+    /* Retrieve the ID of the last seen test case. */
+
+    fn = alloc_printf("%s/.synced/%s", out_dir, p->name);
+    id_fd = open(fn, O_RDONLY);
+
+    if (id_fd >= 0) {
+      if (read(id_fd, &p->min_accept, sizeof(u32)) != sizeof(u32))
+        p->min_accept = 0;
+      close(id_fd);
+    }
+
+    ck_free(fn);
+
+  }
+
+  closedir(sd);
+
+  /* Peers that don't have a queue/ yet won't tell us when they do. */
+
+  peers_stale = incomplete;
+
+#ifdef __linux__
+
+  /* A queue/ that was just (re)created may already have test cases in it,
+     so list it once the watch is in place. */
+
+  if (sync_fd >= 0)
+    for (i = 0; i < peer_cnt; i++) {
+
+      if (peers[i].wd >= 0) continue;
+
+      peers[i].wd = inotify_add_watch(sync_fd, peers[i].qd_path,
+                                      IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO |
+                                      IN_MOVE_SELF | IN_ONLYDIR);
+
+      if (peers[i].wd >= 0) peers[i].rescan = 1; else peers_stale = 1;
+
+    }
+
+#endif /* __linux__ */
+
+}
+
+#ifdef __linux__
+
+/* Go through whatever inotify has for us. */
+
+static void read_sync_events(void) {
+
+  static u8 buf[64 * 1024] __attribute__((aligned(8)));
+  struct inotify_event* ev;
+  s32 len, i;
+  u8* ptr;
+
+  while ((len = read(sync_fd, buf, sizeof(buf))) > 0) {
+
+    for (ptr = buf; ptr < buf + len; ptr += sizeof(*ev) + ev->len) {
+
+      ev = (struct inotify_event*)ptr;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+
+        peers_stale = 1;
+        for (i = 0; i < peer_cnt; i++) peers[i].rescan = 1;
+        continue;
+
+      }
+
+      if (ev->wd == sync_wd) {
+        peers_stale = 1;
+        continue;
+      }
+
+      for (i = 0; i < peer_cnt; i++)
+        if (peers[i].wd == ev->wd) break;
+
+      if (i == peer_cnt) continue;
+
+      /* The peer's queue/ got moved away or deleted, say, when it resumed.
+         find_peers() will watch whatever takes its place. */
+
+      if (ev->mask & (IN_MOVE_SELF | IN_IGNORED)) {
+
+        if (ev->mask & IN_MOVE_SELF) inotify_rm_watch(sync_fd, ev->wd);
+
+        peers[i].wd = -1;
+        peers_stale = 1;
+        continue;
+
+      }
+
+      if (ev->len && !(ev->mask & IN_ISDIR)) add_pending(&peers[i], ev->name);
+
+    }
+
+  }
+
+  if (len < 0 && errno != EAGAIN && errno != EINTR)
+    PFATAL("Unable to read inotify events");
+
+}
+
+#endif /* __linux__ */
+
+static void init_sync_watch(void) {
+
+#ifdef __linux__
+
+  sync_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (sync_fd >= 0) {
+
+    sync_wd = inotify_add_watch(sync_fd, sync_dir,
+                                IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+
+    if (sync_wd < 0) {
+      close(sync_fd);
+      sync_fd = -1;
+    }
+
+  }
+
+  if (sync_fd < 0)
+    WARNF("Unable to watch '%s', syncing will list it every time.", sync_dir);
+
+#endif /* __linux__ */
+
+}
+
+/* Save the test case if it's interesting, and give it the peer's structure.
+   finish_fuzz_stuff() hands over every test case run while syncing, with
+   its index in the peer's pending list in stage_cur_byte - the one value
+   batches and the executor pool keep for each test case. */
+
+u8 import_case(char** argv, u8* mem, u32 len, u8 fault) {
+
+  struct sync_case* c = &cur_peer->pending[stage_cur_byte];
+  struct queue_entry* q;
+  u8 *src, *dst;
+
+  syncing_case = c->id;
+
+  if (!save_if_interesting(argv, mem, len, fault, NULL, NULL)) goto done;
+
+  queued_imported++;
+  q = queue_top;
+
+  src = alloc_printf("%s/%s.json", cur_peer->qd_path, c->name);
+  if (!access(src, F_OK)) link_or_copy(src, q->format_file);
+  ck_free(src);
+
+  src = alloc_printf("%s/%s.track", cur_peer->qd_path, c->name);
+
+  if (!access(src, F_OK)) {
+    if (!q->track_file) q->track_file = alloc_printf("%s.track", q->fname);
+    link_or_copy(src, q->track_file);
+  }
+
+  ck_free(src);
+
+  src = alloc_printf("%s/%s.simg", cur_peer->qd_path, c->name);
+  dst = alloc_printf("%s.simg", q->fname);
+  if (!access(src, F_OK)) link_or_copy(src, dst);
+  ck_free(src);
+  ck_free(dst);
+
+done:
+
+  if (!(stage_cur++ % stats_update_freq)) show_stats();
+
+  return !!stop_soon;
+
+}
+
+/* Grab interesting test cases from other fuzzers. */
+
+void sync_fuzzers(char** argv) {
+
+  static u8 stage_tmp[128];
+  static u8 inited;
+  u32 sync_cnt = 0, i, j;
+  u32 old_tmout = fuzz_tmout;
+  u8* (*old_post)(u8*, u32*) = post_handler;
+
+  if (!inited) {
+    init_sync_watch();
+    inited = 1;
+  }
+
+#ifdef __linux__
+  if (sync_fd >= 0) read_sync_events();
+#endif /* __linux__ */
+
+  if (sync_fd < 0) {
+    peers_stale = 1;
+    for (i = 0; i < peer_cnt; i++) peers[i].rescan = 1;
+  }
+
+  if (peers_stale) find_peers();
+
+  stage_max = stage_cur = 0;
+  cur_depth = 0;
+
+  /* Imports get the full timeout, and none of the edits from the last
+     structure stage. They are also run as-is: the peers have already put
+     them through the postprocessor before saving them. */
+
+  fuzz_tmout = exec_tmout;
+  post_handler = NULL;
+  edit_reset();
+
+  for (i = 0; i < peer_cnt; i++) {
+
+    struct sync_peer* p = &peers[i];
+    u32 next_min_accept = p->min_accept, cnt = 0;
+    u8* fn;
+    u8  stop = 0;
+    s32 fd;
+
+    if (p->rescan) scan_peer(p);
+    if (!p->pending_cnt) continue;
+
+    /* Look at the cases in order, once each. */
+
+    qsort(p->pending, p->pending_cnt, sizeof(struct sync_case), compare_cases);
+
+    for (j = 0; j < p->pending_cnt; j++) {
+
+      struct sync_case* c = &p->pending[j];
+
+      if (c->id < next_min_accept) {
+        ck_free(c->name);
+        continue;
+      }
+
+      next_min_accept = c->id + 1;
+      p->pending[cnt++] = *c;
+
+    }
+
+    p->pending_cnt = cnt;
+
+    /* Show stats */
+
+    sprintf(stage_tmp, "sync %u", ++sync_cnt);
+    stage_name = stage_tmp;
+    stage_cur = 0;
+    stage_max = cnt;
+
+    cur_peer = p;
+    syncing_party = p->name;
+
+    for (j = 0; j < cnt; j++) {
+
+      struct stat st;
+      u8* path;
+
+      /* With a shared virgin map, once we have seen all that the others
+         have, the rest of their cases can't bring anything new. */
+
+      if (virgin_host && !host_ahead()) break;
+
+      path = alloc_printf("%s/%s", p->qd_path, p->pending[j].name);
+
+      /* Allow this to fail in case the other fuzzer is resuming or so... */
+
+      fd = open(path, O_RDONLY);
+
+      if (fd < 0) {
+        ck_free(path);
+        continue;
+      }
+
+      if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+      /* Ignore zero-sized or oversized files. */
+
+      if (st.st_size && st.st_size <= MAX_FILE) {
+
+        u8* mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", path);
+
+        stage_cur_byte = j;
+        stop = batch_fuzz_stuff(argv, mem, st.st_size, NULL, NULL);
+
+        munmap(mem, st.st_size);
+
+      }
+
+      ck_free(path);
+      close(fd);
+
+      if (stop) break;
+
+    }
+
+    if (!stop) flush_batch(argv);
+
+    syncing_party = 0;
+    cur_peer = NULL;
+
+    for (j = 0; j < cnt; j++) ck_free(p->pending[j].name);
+    p->pending_cnt = 0;
+
+    if (stop_soon) break;
+
+    p->min_accept = next_min_accept;
+
+    fn = alloc_printf("%s/.synced/%s", out_dir, p->name);
+    fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", fn);
+    ck_write(fd, &p->min_accept, sizeof(u32), fn);
+    close(fd);
+    ck_free(fn);
+
+  }
+
+  stage_cur_byte = -1;
+  fuzz_tmout = old_tmout;
+  post_handler = old_post;
+
+}
@@ -0,0 +1,74 @@
+/*
+   american fuzzy lop - dirty map test target
+   ------------------------------------------
+
+   Stands in for a program built by afl-clang-fast with AFL_DIRTY_MAP=1, so
+   that the runtime and fork server side of it can be checked without LLVM:
+   each edge bumps its counter in a 1 MB map and flags the block it is in,
+   just like the code afl-llvm-pass inserts. Built with -DFULL_MAP, it does
+   neither of the latter, the same as a build without AFL_DIRTY_MAP. Link
+   with llvm_mode/afl-llvm-rt.o.c; see "make test_dirtymap".
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+*/
+
+#include <unistd.h>
+
+#include "config.h"
+#include "types.h"
+
+#define TEST_MAP_SIZE (1 << 20)
+
+extern u8* __afl_area_ptr;
+extern u8* __afl_dirty_ptr;
+extern __thread u32 __afl_prev_loc;
+
+#ifdef FULL_MAP
+#  define TEST_MAP_FLAGS 0
+#else
+#  define TEST_MAP_FLAGS MAP_REC_DIRTY
+#endif /* ^FULL_MAP */
+
+/* The record afl-llvm-pass leaves for a module with hashed block IDs. */
+
+static struct {
+  u32* base;
+  u32  size;
+  u32  flags;
+} map_rec __attribute__((section("__afl_map"), used)) = {
+  0, TEST_MAP_SIZE, TEST_MAP_FLAGS
+};
+
+static void edge(u32 cur_loc) {
+  u32 idx = (cur_loc ^ __afl_prev_loc) & (TEST_MAP_SIZE - 1);
+
+  __afl_area_ptr[idx]++;
+
+#ifndef FULL_MAP
+  __afl_dirty_ptr[idx >> MAP_DIRTY_POW2] = 1;
+#endif /* !FULL_MAP */
+
+  __afl_prev_loc = cur_loc >> 1;
+}
+
+/* Every input byte makes for a few edges somewhere in the map, depending on
+   its value and position; a long input covers a good part of it. */
+
+int main(int argc, char** argv) {
+  static u8 buf[4096];
+  s32 len = read(0, buf, sizeof(buf)), i, j;
+
+  if (len < 0) return 1;
+
+  for (i = 0; i < len; i++) {
+    u32 cur_loc = (buf[i] * 0x9e3779b1) ^ (i * 0x85ebca6b);
+
+    for (j = 0; j <= buf[i] % 7; j++) edge(cur_loc);
+  }
+
+  return 0;
+}
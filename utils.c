@@ -22,20 +22,56 @@ u64 get_cur_time_us(void) {
   return (tv.tv_sec * 1000000ULL) + tv.tv_usec;
 }
 
-/* Generate a random number (from 0 to limit - 1). This may
-   have slight bias. */
+/* Seed the PRNG (see UR() in afl-fuzz.h). The state is expanded from the
+   seed with splitmix64, so that similar seeds still give unrelated streams;
+   the same seed always gives the same sequence of draws. */
 
-inline u32 UR(u32 limit) {
-  if (unlikely(!rand_cnt--)) {
-    u32 seed[2];
+void seed_rng(u64 seed) {
+  u32 i;
+
+  rand_seed = seed;
+
+  for (i = 0; i < 4; i++) {
+    u64 z = (seed += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    rand_state[i] = z ^ (z >> 31);
+  }
+}
+
+/* Fill buf[] with cnt draws of UR(limit), keeping the generator state in
+   registers for the whole batch. */
 
-    ck_read(dev_urandom_fd, &seed, sizeof(seed), "/dev/urandom");
+void rand_fill(u32* buf, u32 cnt, u32 limit) {
+  u64 s0 = rand_state[0], s1 = rand_state[1], s2 = rand_state[2],
+      s3 = rand_state[3];
+  u32 t, i = 0;
 
-    srandom(seed[0]);
-    rand_cnt = (RESEED_RNG / 2) + (seed[1] % RESEED_RNG);
+  assert(limit > 0);
+
+  t = -limit % limit;
+
+  while (i < cnt) {
+    u64 r = s1 * 5, x = s1 << 17, m;
+
+    r = ((r << 7) | (r >> 57)) * 9;
+
+    s2 ^= s0;
+    s3 ^= s1;
+    s1 ^= s2;
+    s0 ^= s3;
+    s2 ^= x;
+    s3 = (s3 << 45) | (s3 >> 19);
+
+    m = (r >> 32) * limit;
+    if ((u32)m >= t) buf[i++] = m >> 32;
   }
 
-  return random() % limit;
+  rand_state[0] = s0;
+  rand_state[1] = s1;
+  rand_state[2] = s2;
+  rand_state[3] = s3;
 }
 
 /* Shuffle an array of pointers. Might be slightly biased. */
@@ -234,11 +270,18 @@ u32 choose_block_len(u32 limit) {
 
 /* Write modified data to file for testing. If out_file is set, the old file
    is unlinked and a new one is created. Otherwise, out_fd is rewound and
-   truncated. */
+   truncated. Targets reading from the testcase SHM region just get a copy
+   there (truncated to MAX_FILE), and the length is sent by run_target(). */
 
 void write_to_testcase(void* mem, u32 len) {
   s32 fd = out_fd;
 
+  if (shm_fuzz_on) {
+    shm_fuzz_len = MIN(len, MAX_FILE);
+    memcpy(shm_fuzz_buf, mem, shm_fuzz_len);
+    return;
+  }
+
   if (out_file) {
     unlink(out_file); /* Ignore errors. */
 
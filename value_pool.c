@@ -0,0 +1,374 @@
+#include "afl-fuzz.h"
+
+/* Value pools.
+
+   Every length and offset field seen in a parsed seed contributes its raw
+   bytes to a pool that reusing_stage() later draws replacements from.
+   Pools only ever grow, and grow with the corpus, so values live in a
+   bump-allocated arena, are deduplicated through an open-addressing hash
+   table, and are additionally bucketed by size for the common 1 - 8 byte
+   fields, so that picking a value of the right width is O(1).
+
+   Pools are appended to <out_dir>/queue/.state/value_pools/ together with
+   the auto extras, and restored from <in_dir>/.state/value_pools/ when
+   resuming, so the reusing stage has all the values right away instead of
+   waiting for every queue entry to be parsed again. */
+
+#define POOL_MAGIC 0x4c4f4f50 /* "POOL" */
+
+static u8* pool_bytes(UniqueSet* set, u32 length) {
+
+  u8* ret;
+
+  /* Oversized values get a block of their own. */
+
+  if (length > POOL_ARENA_BLOCK / 4) return ck_alloc_nozero(length);
+
+  if (!set->arena || set->arena_used + length > POOL_ARENA_BLOCK) {
+    set->arena      = ck_alloc_nozero(POOL_ARENA_BLOCK);
+    set->arena_used = 0;
+  }
+
+  ret = set->arena + set->arena_used;
+  set->arena_used += length;
+  return ret;
+
+}
+
+static u32* pool_slot(UniqueSet* set, u8* data, u32 length, u32 hash) {
+
+  u32 i = hash & set->slot_mask;
+
+  while (set->slots[i]) {
+
+    UniqueValue* v = &set->values[set->slots[i] - 1];
+
+    if (v->hash == hash && v->length == length &&
+        !memcmp(v->data, data, length))
+      break;
+
+    i = (i + 1) & set->slot_mask;
+
+  }
+
+  return &set->slots[i];
+
+}
+
+static void pool_rehash(UniqueSet* set) {
+
+  u32 i, j, size = (set->slot_mask + 1) * 2;
+
+  ck_free(set->slots);
+  set->slots     = ck_alloc(size * sizeof(u32));
+  set->slot_mask = size - 1;
+
+  for (i = 0; i < set->count; i++) {
+
+    j = set->values[i].hash & set->slot_mask;
+    while (set->slots[j]) j = (j + 1) & set->slot_mask;
+    set->slots[j] = i + 1;
+
+  }
+
+}
+
+bool contains(UniqueSet* set, u8* data, u32 length) {
+
+  u32 hash = hash_bytes(data, length, HASH_CONST);
+
+  return !!*pool_slot(set, data, length, hash);
+
+}
+
+void insert(UniqueSet* set, u8* data, u32 length) {
+
+  u32 hash = hash_bytes(data, length, HASH_CONST), *slot;
+  UniqueValue* v;
+
+  if (!length) return;
+
+  slot = pool_slot(set, data, length, hash);
+
+  if (*slot) {
+    set->dups++;
+    return;
+  }
+
+  if (set->count == set->size) {
+    set->size   = set->size ? set->size * 2 : 64;
+    set->values = ck_realloc(set->values, set->size * sizeof(UniqueValue));
+  }
+
+  v         = &set->values[set->count];
+  v->data   = pool_bytes(set, length);
+  v->length = length;
+  v->hash   = hash;
+  memcpy(v->data, data, length);
+
+  *slot = ++set->count;
+  set->bytes += length;
+
+  if (length <= POOL_LEN_MAX) {
+
+    u32 n = set->by_len_cnt[length];
+
+    if (!(n & (n - 1)))
+      set->by_len[length] =
+          ck_realloc(set->by_len[length], (n ? n * 2 : 1) * sizeof(u32));
+
+    set->by_len[length][n] = set->count - 1;
+    set->by_len_cnt[length]++;
+
+  }
+
+  /* Keep the table at most 3/4 full. */
+
+  if (set->count * 4 > (set->slot_mask + 1) * 3) pool_rehash(set);
+
+}
+
+/* Pick a random value, or NULL if the pool is empty. */
+
+UniqueValue* pool_random(UniqueSet* set) {
+
+  if (!set->count) return NULL;
+  return &set->values[UR(set->count)];
+
+}
+
+/* Pick a random value exactly length bytes long, or NULL if there is
+   none (or length is above POOL_LEN_MAX). */
+
+UniqueValue* pool_random_len(UniqueSet* set, u32 length) {
+
+  if (length > POOL_LEN_MAX || !set->by_len_cnt[length]) return NULL;
+  return &set->values[set->by_len[length][UR(set->by_len_cnt[length])]];
+
+}
+
+static UniqueSet* new_value_set(u8* name) {
+
+  UniqueSet* set = ck_alloc(sizeof(UniqueSet));
+
+  set->name      = name;
+  set->slots     = ck_alloc(POOL_INIT_SLOTS * sizeof(u32));
+  set->slot_mask = POOL_INIT_SLOTS - 1;
+  set->insert    = insert;
+  set->contains  = contains;
+
+  return set;
+
+}
+
+void init_value_sets() {
+
+  enum_value_set   = new_value_set("enum");
+  length_value_set = new_value_set("length");
+  offset_value_set = new_value_set("offset");
+
+}
+
+/* Pool files are a u32 magic followed by (u32 length, data) records. New
+   values are appended, so saving is cheap enough to do along with the
+   stats file. */
+
+static void save_value_set(UniqueSet* set) {
+
+  u8* fn;
+  s32 fd;
+  u32 i;
+
+  if (set->saved == set->count) return;
+
+  fn = alloc_printf("%s/queue/.state/value_pools/pool_%s", out_dir, set->name);
+  fd = open(fn, O_WRONLY | O_CREAT | O_APPEND, 0600);
+
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+
+  if (!set->saved) {
+    u32 magic = POOL_MAGIC;
+    if (ftruncate(fd, 0)) PFATAL("ftruncate() failed");
+    ck_write(fd, &magic, sizeof(u32), fn);
+  }
+
+  for (i = set->saved; i < set->count; i++) {
+    ck_write(fd, &set->values[i].length, sizeof(u32), fn);
+    ck_write(fd, set->values[i].data, set->values[i].length, fn);
+  }
+
+  set->saved = set->count;
+
+  close(fd);
+  ck_free(fn);
+
+}
+
+void save_value_pools(void) {
+
+  save_value_set(enum_value_set);
+  save_value_set(length_value_set);
+  save_value_set(offset_value_set);
+
+}
+
+static void load_value_set(UniqueSet* set) {
+
+  struct stat st;
+  u8 *fn, *mem, *ptr, *end;
+  s32 fd;
+  u32 loaded = 0;
+
+  fn = alloc_printf("%s/.state/value_pools/pool_%s", in_dir, set->name);
+  fd = open(fn, O_RDONLY);
+
+  if (fd < 0) {
+    if (errno != ENOENT) PFATAL("Unable to open '%s'", fn);
+    ck_free(fn);
+    return;
+  }
+
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  if (st.st_size < sizeof(u32)) {
+    close(fd);
+    ck_free(fn);
+    return;
+  }
+
+  mem = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", fn);
+  close(fd);
+
+  if (*(u32*)mem != POOL_MAGIC) {
+
+    WARNF("Ignoring value pool '%s' (bad magic)", fn);
+
+  } else {
+
+    ptr = mem + sizeof(u32);
+    end = mem + st.st_size;
+
+    /* A truncated tail (e.g. from a crash mid-save) is simply dropped. */
+
+    while (end - ptr >= sizeof(u32)) {
+
+      u32 length = *(u32*)ptr;
+
+      ptr += sizeof(u32);
+      if (length > end - ptr) break;
+
+      set->insert(set, ptr, length);
+      ptr += length;
+      loaded++;
+
+    }
+
+  }
+
+  munmap(mem, st.st_size);
+
+  if (loaded) OKF("Loaded %u %s values from '%s'.", set->count, set->name, fn);
+
+  ck_free(fn);
+
+}
+
+/* Restore pools saved by a previous session, if in_dir is a resumed
+   queue. Values are rewritten in full to the new output dir on the first
+   save. */
+
+void load_value_pools(void) {
+
+  load_value_set(enum_value_set);
+  load_value_set(length_value_set);
+  load_value_set(offset_value_set);
+
+}
+
+/* Pool counters for fuzzer_stats. */
+
+void write_pool_stats(FILE* f) {
+
+  fprintf(f,
+          "pool_enum         : %u\n"
+          "pool_length       : %u\n"
+          "pool_offset       : %u\n"
+          "pool_bytes        : %llu\n"
+          "pool_dup_inserts  : %llu\n",
+          enum_value_set->count, length_value_set->count,
+          offset_value_set->count,
+          enum_value_set->bytes + length_value_set->bytes +
+              offset_value_set->bytes,
+          enum_value_set->dups + length_value_set->dups +
+              offset_value_set->dups);
+
+}
+
+static void dump_value_set(FILE* f, UniqueSet* set) {
+
+  u32 i, j;
+
+  fprintf(f, "# %s: %u values, %llu bytes\n", set->name, set->count,
+          set->bytes);
+
+  for (i = 0; i < set->count; i++) {
+
+    UniqueValue* v = &set->values[i];
+
+    fprintf(f, "%u ", v->length);
+    for (j = 0; j < v->length; j++) fprintf(f, "%02x", v->data[j]);
+    fputc('\n', f);
+
+  }
+
+}
+
+/* Write a hex dump of all pools to <out_dir>/value_pools.txt, when asked
+   to with SIGUSR2, or (checked when fuzzer_stats is updated) by creating
+   <out_dir>/dump_pools. Called from show_stats(), so dumps are rate-limited
+   to the UI refresh rate no matter how often the signal arrives. */
+
+void maybe_dump_value_pools(u8 check_flag) {
+
+  u8 *fn, *tmp, *flag = NULL;
+  FILE* f;
+
+  if (check_flag && !pool_dump_requested) {
+
+    flag = alloc_printf("%s/dump_pools", out_dir);
+
+    if (access(flag, F_OK)) {
+      ck_free(flag);
+      return;
+    }
+
+  } else if (!pool_dump_requested) return;
+
+  pool_dump_requested = 0;
+
+  fn  = alloc_printf("%s/value_pools.txt", out_dir);
+  tmp = alloc_printf("%s/.value_pools.tmp", out_dir);
+
+  f = fopen(tmp, "w");
+  if (!f) PFATAL("Unable to create '%s'", tmp);
+
+  dump_value_set(f, enum_value_set);
+  dump_value_set(f, length_value_set);
+  dump_value_set(f, offset_value_set);
+
+  fclose(f);
+
+  /* Readers never see a partial dump. */
+
+  if (rename(tmp, fn)) PFATAL("Unable to rename '%s'", tmp);
+
+  if (flag) {
+    unlink(flag); /* Ignore errors */
+    ck_free(flag);
+  }
+
+  ck_free(fn);
+  ck_free(tmp);
+
+}